@@ -0,0 +1,85 @@
+/*
+  BufferPool.c - Function definitions for the BufferPool interface,
+  which hands out fixed-size buffers from a pool with a fixed upper
+  bound on how many buffers can exist at once. Buffers are allocated
+  lazily the first time they are needed, and are recycled rather than
+  freed when they are given back.
+*/
+
+#include "BufferPool.h"
+
+static void * Malloc( size_t size ) {
+  void * toRet = malloc( size );
+  if ( ! toRet ) {
+    perror("malloc");
+    exit(1);
+  }
+  return toRet;
+
+}
+
+BufferPool * BP_Init( int bufferSize, int maxBuffers ) {
+
+  BufferPool * toRet = Malloc( sizeof( BufferPool ) );
+  toRet->freeList = Malloc( maxBuffers * sizeof( char * ) );
+  toRet->numFree = 0;
+  toRet->numAllocated = 0;
+  toRet->maxBuffers = maxBuffers;
+  toRet->bufferSize = bufferSize;
+
+  return toRet;
+
+}
+
+void BP_Destroy( BufferPool * p ) {
+
+  int i;
+
+  if ( p->numFree != p->numAllocated ) {
+    printf("Error: Destroying a BufferPool with buffers still in use!\n");
+    exit(1);
+  }
+
+  for ( i = 0; i < p->numFree; i ++ ) {
+    free( p->freeList[i] );
+  }
+  free( p->freeList );
+  free( p );
+  return;
+
+}
+
+char * BP_Acquire( BufferPool * p ) {
+
+  if ( p->numFree > 0 ) {
+    return p->freeList[ -- p->numFree ];
+  }
+  if ( p->numAllocated < p->maxBuffers ) {
+    void * buf;
+    if ( posix_memalign( &buf, BP_ALIGN, p->bufferSize ) ) {
+      perror("posix_memalign");
+      exit(1);
+    }
+    p->numAllocated ++;
+    return buf;
+  }
+  return NULL;
+
+}
+
+void BP_Release( BufferPool * p, char * buf ) {
+
+  if ( p->numFree >= p->numAllocated ) {
+    printf("Error: Released more buffers than were acquired!\n");
+    exit(1);
+  }
+  p->freeList[ p->numFree ++ ] = buf;
+  return;
+
+}
+
+int BP_Available( BufferPool * p ) {
+
+  return p->numFree + ( p->maxBuffers - p->numAllocated );
+
+}
@@ -0,0 +1,92 @@
+#ifndef BUFFER_POOL_BM_H
+#define BUFFER_POOL_BM_H
+
+/*
+  BufferPool.h - Function declarations for the BufferPool interface,
+  which hands out fixed-size buffers from a pool with a fixed upper
+  bound on how many buffers can exist at once. Buffers are allocated
+  lazily the first time they are needed, and are recycled rather than
+  freed when they are given back. Buffers are aligned to BP_ALIGN
+  bytes, so that they can be used for O_DIRECT reads and writes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BP_ALIGN 4096
+
+
+typedef struct {
+
+  char ** freeList; // Stack of buffers ready to be handed out
+  int numFree;      // How many buffers are on the stack?
+  int numAllocated; // How many buffers have we created so far?
+  int maxBuffers;   // Never create more than this many buffers
+  int bufferSize;   // Size of each buffer in bytes
+
+} BufferPool ;
+
+
+/*
+  BP_Init - Create and initialize a BufferPool object. No buffers
+  are allocated until they are acquired.
+
+  Parameters:
+  => bufferSize - size of each buffer in bytes
+  => maxBuffers - maximum number of buffers that may be handed out
+     at once
+
+  Returns: A pointer to an initialized BufferPool structure.
+ */
+BufferPool * BP_Init( int bufferSize, int maxBuffers ) ;
+
+/*
+  BP_Destroy - destroy and free all resources associated with an
+  existing BufferPool. Every buffer must have been released back to 
+  the pool first.
+
+  Parameters:
+  => p - BufferPool object pointer to destroy
+
+  Returns: Nothing.
+ */
+void BP_Destroy( BufferPool * p ) ;
+
+/*
+  BP_Acquire - take a buffer from the pool, allocating a new one if 
+  none are free and we are still under the limit.
+
+  Parameters:
+  => p - the BufferPool to take a buffer from
+
+  Returns: A pointer to a buffer of p->bufferSize bytes, or NULL if
+  the maximum number of buffers are already in use. The contents of 
+  the buffer are undefined.
+ */
+char * BP_Acquire( BufferPool * p ) ;
+
+/*
+  BP_Release - give a buffer previously returned by BP_Acquire back
+  to the pool.
+
+  Parameters:
+  => p - the BufferPool the buffer came from
+  => buf - the buffer to give back
+
+  Returns: Nothing.
+ */
+void BP_Release( BufferPool * p, char * buf ) ;
+
+/*
+  BP_Available - how many more buffers could be acquired right now?
+
+  Parameters:
+  => p - the BufferPool to query
+
+  Returns: The number of buffers that can be acquired before BP_Acquire
+  starts returning NULL.
+ */
+int BP_Available( BufferPool * p ) ;
+
+#endif
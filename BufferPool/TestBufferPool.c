@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "BufferPool.h"
+
+int main() {
+
+  int i;
+  char * bufs[8];
+
+  printf("Testing BP_Acquire up to the limit\n");
+  BufferPool * p = BP_Init( 4096, 8 );
+  assert( BP_Available( p ) == 8 );
+  assert( p->numAllocated == 0 );
+
+  for ( i = 0; i < 8; i ++ ) {
+    bufs[i] = BP_Acquire( p );
+    assert( bufs[i] );
+    assert( (unsigned long) bufs[i] % BP_ALIGN == 0 );
+    memset( bufs[i], i, 4096 );
+    assert( BP_Available( p ) == 7 - i );
+  }
+  assert( BP_Acquire( p ) == NULL );
+
+  printf("Testing BP_Release and recycling\n");
+  char * recycled = bufs[3];
+  BP_Release( p, bufs[3] );
+  assert( BP_Available( p ) == 1 );
+  bufs[3] = BP_Acquire( p );
+  assert( bufs[3] == recycled );
+  assert( p->numAllocated == 8 );
+
+  for ( i = 0; i < 8; i ++ ) {
+    BP_Release( p, bufs[i] );
+  }
+  assert( BP_Available( p ) == 8 );
+
+  BP_Destroy( p );
+
+  printf("PASS\n\n");
+
+  return 0;
+
+}
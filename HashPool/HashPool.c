@@ -0,0 +1,223 @@
+/*
+  HashPool.c - Function definitions for the HashPool interface, which
+  computes SHA1 digests on a pool of worker threads so that the thread
+  submitting the work never waits for it. Finished jobs are pushed onto
+  a lock-free list, and a byte is written to a pipe so that a select()
+  loop can wake up and collect them.
+*/
+
+#include "HashPool.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+
+static void * Malloc( size_t size ) {
+  void * toRet = malloc( size );
+  if ( ! toRet ) {
+    perror("malloc");
+    exit(1);
+  }
+  return toRet;
+
+}
+
+/*
+  pushCompleted - add a finished job to the lock-free completed list
+  and wake up whoever is waiting on the pipe.
+ */
+static void pushCompleted( HashPool * p, HP_Job * job ) {
+
+  HP_Job * head = __atomic_load_n( &p->completed, __ATOMIC_RELAXED );
+  do {
+    job->next = head;
+  } while ( ! __atomic_compare_exchange_n( &p->completed, &head, job, 1,
+					   __ATOMIC_RELEASE, 
+					   __ATOMIC_RELAXED ) );
+
+  // If the pipe is full, a wakeup is already pending
+  char c = 0;
+  if ( write( p->wakeFDs[1], &c, 1 ) < 0 && errno != EAGAIN ) {
+    perror("write");
+    exit(1);
+  }
+
+}
+
+static void * worker( void * arg ) {
+
+  HashPool * p = arg;
+  HP_Job * batch[ SHA1_MAX_LANES ];
+  const void * data[ SHA1_MAX_LANES ];
+  size_t lengths[ SHA1_MAX_LANES ];
+  unsigned char * digests[ SHA1_MAX_LANES ];
+  int i, num, numWhole;
+
+  while ( 1 ) {
+
+    pthread_mutex_lock( &p->lock );
+    while ( ! p->waitingHead && ! p->shutdown ) {
+      pthread_cond_wait( &p->ready, &p->lock );
+    }
+    if ( p->shutdown ) {
+      pthread_mutex_unlock( &p->lock );
+      return NULL;
+    }
+    // Take our share of the waiting jobs, so that a multi-buffer
+    // backend can hash several at once without idling other workers
+    num = ( p->numWaiting + p->numThreads - 1 ) / p->numThreads;
+    if ( num > SHA1_MAX_LANES ) {
+      num = SHA1_MAX_LANES;
+    }
+    for ( i = 0; i < num; i ++ ) {
+      batch[i] = p->waitingHead;
+      p->waitingHead = batch[i]->next;
+    }
+    if ( ! p->waitingHead ) {
+      p->waitingTail = NULL;
+    }
+    p->numWaiting -= num;
+    pthread_mutex_unlock( &p->lock );
+
+    // Digests in progress are finished off one at a time; whole
+    // messages are hashed together
+    numWhole = 0;
+    for ( i = 0; i < num; i ++ ) {
+      if ( batch[i]->load ) {
+	batch[i]->load( batch[i] );
+      }
+      if ( batch[i]->ctx ) {
+	Sha1_Update( batch[i]->ctx, batch[i]->data, batch[i]->length );
+	Sha1_Finish( batch[i]->ctx, batch[i]->digest );
+	continue;
+      }
+      data[ numWhole ] = batch[i]->data;
+      lengths[ numWhole ] = batch[i]->length;
+      digests[ numWhole ] = batch[i]->digest;
+      numWhole ++;
+    }
+    Sha1_DigestMany( numWhole, data, lengths, digests );
+    for ( i = 0; i < num; i ++ ) {
+      pushCompleted( p, batch[i] );
+    }
+
+  }
+
+}
+
+HashPool * HP_Init( int numThreads ) {
+
+  int i;
+  sigset_t all, old;
+
+  HashPool * toRet = Malloc( sizeof( HashPool ) );
+  if ( numThreads < 1 ) {
+    numThreads = 1;
+  }
+  toRet->numThreads = numThreads;
+  toRet->threads = Malloc( numThreads * sizeof( pthread_t ) );
+  pthread_mutex_init( &toRet->lock, NULL );
+  pthread_cond_init( &toRet->ready, NULL );
+  toRet->waitingHead = NULL;
+  toRet->waitingTail = NULL;
+  toRet->numWaiting = 0;
+  toRet->shutdown = 0;
+  toRet->completed = NULL;
+  toRet->numOutstanding = 0;
+
+  if ( pipe( toRet->wakeFDs ) ) {
+    perror("pipe");
+    exit(1);
+  }
+  for ( i = 0; i < 2; i ++ ) {
+    fcntl( toRet->wakeFDs[i], F_SETFL, 
+	   fcntl( toRet->wakeFDs[i], F_GETFL ) | O_NONBLOCK );
+  }
+
+  // Threads inherit our signal mask; keep signals on this thread
+  sigfillset( &all );
+  pthread_sigmask( SIG_BLOCK, &all, &old );
+  for ( i = 0; i < numThreads; i ++ ) {
+    if ( pthread_create( &toRet->threads[i], NULL, worker, toRet ) ) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  pthread_sigmask( SIG_SETMASK, &old, NULL );
+
+  return toRet;
+
+}
+
+void HP_Destroy( HashPool * p ) {
+
+  int i;
+
+  pthread_mutex_lock( &p->lock );
+  p->shutdown = 1;
+  pthread_cond_broadcast( &p->ready );
+  pthread_mutex_unlock( &p->lock );
+
+  for ( i = 0; i < p->numThreads; i ++ ) {
+    pthread_join( p->threads[i], NULL );
+  }
+
+  close( p->wakeFDs[0] );
+  close( p->wakeFDs[1] );
+  pthread_mutex_destroy( &p->lock );
+  pthread_cond_destroy( &p->ready );
+  free( p->threads );
+  free( p );
+
+}
+
+void HP_Submit( HashPool * p, HP_Job * job ) {
+
+  job->next = NULL;
+  p->numOutstanding ++;
+
+  pthread_mutex_lock( &p->lock );
+  if ( p->waitingTail ) {
+    p->waitingTail->next = job;
+  }
+  else {
+    p->waitingHead = job;
+  }
+  p->waitingTail = job;
+  p->numWaiting ++;
+  pthread_cond_signal( &p->ready );
+  pthread_mutex_unlock( &p->lock );
+
+}
+
+HP_Job * HP_Completed( HashPool * p ) {
+
+  char buf[64];
+  HP_Job * list, * reversed = NULL;
+
+  // Empty the pipe before taking the list, so that a job finishing 
+  // in between still leaves a wakeup behind
+  while ( read( p->wakeFDs[0], buf, sizeof( buf ) ) > 0 ) {
+    ;
+  }
+
+  list = __atomic_exchange_n( &p->completed, NULL, __ATOMIC_ACQUIRE );
+
+  // The list is newest first
+  while ( list ) {
+    HP_Job * next = list->next;
+    list->next = reversed;
+    reversed = list;
+    list = next;
+    p->numOutstanding --;
+  }
+  return reversed;
+
+}
+
+int HP_WaitFD( HashPool * p ) {
+
+  return p->wakeFDs[0];
+
+}
@@ -0,0 +1,131 @@
+#ifndef HASH_POOL_BM_H
+#define HASH_POOL_BM_H
+
+/*
+  HashPool.h - Function declarations for the HashPool interface, which
+  computes SHA1 digests on a pool of worker threads so that the thread
+  submitting the work never waits for it. Each worker takes up to
+  SHA1_MAX_LANES jobs at a time, for the multi-buffer backends. Finished jobs are pushed onto
+  a lock-free list, and a byte is written to a pipe so that a select()
+  loop can wake up and collect them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../sha1/sha1.h"
+
+
+/*
+  An HP_Job is one buffer to be hashed. The caller fills in data,
+  length and whatever tags it needs, and gets the same struct back
+  from HP_Completed with digest filled in.
+ */
+typedef struct HP_Job {
+
+  char * data;       // Bytes to hash; must stay valid until completed
+  int length;        // How many bytes?
+  Sha1_Ctx * ctx;    // If set, data is the rest of a digest already
+                     // begun in ctx, rather than a whole message
+  int tag;           // For the caller (a piece number, say)
+  void * arg;        // For the caller
+  void (*load)( struct HP_Job * job ); // If set, called on the worker
+                     // to fill in data before it is hashed, so that
+                     // reading it from disk does not block the caller
+  void * source;     // For load (the file to read, say)
+  long long offset;  // For load
+  unsigned char digest[20]; // SHA1 of the data, once completed
+  struct HP_Job * next;     // Used by the pool while it holds the job
+
+} HP_Job;
+
+
+typedef struct {
+
+  pthread_t * threads;  // Worker threads
+  int numThreads;
+
+  // Jobs waiting for a worker, oldest first. Workers sleep on the
+  // condition variable while this is empty.
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  HP_Job * waitingHead;
+  HP_Job * waitingTail;
+  int numWaiting;
+  int shutdown;         // Set to make the workers exit
+
+  // Finished jobs, newest first. Workers push with compare-and-swap;
+  // HP_Completed takes the whole list with one atomic exchange.
+  HP_Job * completed;
+
+  // Workers write a byte to wakeFDs[1] after finishing a job
+  int wakeFDs[2];
+
+  // How many jobs have been submitted and not yet collected?
+  int numOutstanding;
+
+} HashPool ;
+
+
+/*
+  HP_Init - Create a HashPool and start its worker threads. The
+  workers block every signal, so signal handlers always run on the
+  thread that created the pool.
+
+  Parameters:
+  => numThreads - number of worker threads to start (at least 1)
+
+  Returns: A pointer to an initialized HashPool structure.
+ */
+HashPool * HP_Init( int numThreads ) ;
+
+/*
+  HP_Destroy - stop the worker threads and free the pool. Jobs that 
+  had not been started are abandoned, and jobs that had not been 
+  collected are not returned; the caller still owns all of them.
+
+  Parameters:
+  => p - HashPool object pointer to destroy
+
+  Returns: Nothing.
+ */
+void HP_Destroy( HashPool * p ) ;
+
+/*
+  HP_Submit - queue a job to be hashed.
+
+  Parameters:
+  => p - the HashPool to hash with
+  => job - the job; the pool uses it until it is returned by
+     HP_Completed
+
+  Returns: Nothing.
+ */
+void HP_Submit( HashPool * p, HP_Job * job ) ;
+
+/*
+  HP_Completed - collect every job that has finished since the last
+  call. Never blocks.
+
+  Parameters:
+  => p - the HashPool to collect from
+
+  Returns: A list of finished jobs linked through their next members,
+  in the order they finished, or NULL if there are none.
+ */
+HP_Job * HP_Completed( HashPool * p ) ;
+
+/*
+  HP_WaitFD - file descriptor that becomes readable when jobs have
+  finished. HP_Completed empties it.
+
+  Parameters:
+  => p - the HashPool to wait on
+
+  Returns: A file descriptor to add to a select() read set.
+ */
+int HP_WaitFD( HashPool * p ) ;
+
+#endif
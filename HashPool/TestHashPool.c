@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/select.h>
+#include <openssl/sha.h>
+
+#include "HashPool.h"
+
+#define NUM_JOBS 200
+
+/*
+  copyIn - a load callback that copies the job's data in from source,
+  as the client reads it in from the save file.
+ */
+static void copyIn( HP_Job * job ) {
+
+  memcpy( job->data, (char *) job->source + job->offset, job->length );
+
+}
+
+int main() {
+
+  int i, numDone = 0;
+  HP_Job jobs[ NUM_JOBS ];
+  Sha1_Ctx ctxs[ NUM_JOBS ];
+  char * whole[ NUM_JOBS ];
+  char * loaded[ NUM_JOBS ];
+  int wholeLength[ NUM_JOBS ];
+  int seen[ NUM_JOBS ];
+  unsigned char expected[20];
+
+  printf("Testing HP_Submit and HP_Completed with 4 threads\n");
+  HashPool * p = HP_Init( 4 );
+  assert( HP_Completed( p ) == NULL );
+
+  for ( i = 0; i < NUM_JOBS; i ++ ) {
+    wholeLength[i] = 1 + ( rand() % 300000 );
+    whole[i] = malloc( wholeLength[i] );
+    memset( whole[i], i, wholeLength[i] );
+    jobs[i].data = whole[i];
+    jobs[i].length = wholeLength[i];
+    jobs[i].ctx = NULL;
+    jobs[i].load = NULL;
+    loaded[i] = NULL;
+    if ( i % 3 == 1 ) {
+      // Have the worker fetch the data itself
+      loaded[i] = malloc( wholeLength[i] );
+      jobs[i].data = loaded[i];
+      jobs[i].load = copyIn;
+      jobs[i].source = whole[i];
+      jobs[i].offset = 0;
+    }
+    if ( i % 3 == 0 ) {
+      // Finish a digest that has already been started
+      int begun = rand() % wholeLength[i];
+      Sha1_Begin( &ctxs[i] );
+      Sha1_Update( &ctxs[i], whole[i], begun );
+      jobs[i].ctx = &ctxs[i];
+      jobs[i].data += begun;
+      jobs[i].length -= begun;
+    }
+    jobs[i].tag = i;
+    seen[i] = 0;
+    HP_Submit( p, &jobs[i] );
+  }
+  assert( p->numOutstanding == NUM_JOBS );
+
+  while ( numDone < NUM_JOBS ) {
+    // Wait for the pipe, as the client's select loop does
+    fd_set readFDs;
+    FD_ZERO( &readFDs );
+    FD_SET( HP_WaitFD( p ), &readFDs );
+    assert( select( HP_WaitFD( p ) + 1, &readFDs, NULL, NULL, NULL ) == 1 );
+
+    HP_Job * job;
+    for ( job = HP_Completed( p ); job; job = job->next ) {
+      assert( ! seen[ job->tag ] );
+      seen[ job->tag ] = 1;
+      SHA1( (unsigned char *) whole[ job->tag ], wholeLength[ job->tag ], 
+	    expected );
+      assert( ! memcmp( expected, job->digest, 20 ) );
+      numDone ++;
+    }
+  }
+  assert( p->numOutstanding == 0 );
+  assert( HP_Completed( p ) == NULL );
+
+  printf("Testing HP_Destroy\n");
+  HP_Destroy( p );
+  for ( i = 0; i < NUM_JOBS; i ++ ) {
+    free( whole[i] );
+    free( loaded[i] );
+  }
+
+  printf("PASS\n\n");
+
+  return 0;
+
+}
@@ -24,18 +24,29 @@ StringStream * SS_Init() {
   toRet->data = Malloc( 8 );
   toRet->head = toRet->data;
   toRet->tail = toRet->data;
+  toRet->accounted = NULL;
 
   return toRet;
 } 
 
 void SS_Destroy( StringStream * s ) {
 
+  if ( s->accounted ) {
+    *s->accounted -= s->size;
+  }
   free( s->data );
   free( s );
   return;
 
 }
 
+void SS_SetAccounting( StringStream * s, long long * counter ) {
+
+  s->accounted = counter;
+  *counter += s->size;
+
+}
+
 
 /* Returns the lowest power of 2 that is greater than
    or equal to the passed in parameter */
@@ -109,6 +120,9 @@ void SS_Push( StringStream * s, void * new, int len ) {
   memmove( s->tail, new, len );
   s->size += len;
   s->tail += len;
+  if ( s->accounted ) {
+    *s->accounted += len;
+  }
   return; 
 }
 
@@ -121,6 +135,9 @@ void SS_Pop( StringStream * s, int numBytes ) {
 
   s->head += numBytes;
   s->size -= numBytes;
+  if ( s->accounted ) {
+    *s->accounted -= numBytes;
+  }
 
 
 }
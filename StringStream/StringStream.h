@@ -22,6 +22,7 @@ typedef struct {
   char * tail;  // Where should new data be inserted
   int size;     // How much data do we have?
   int capacity; // How much data do we have room for?
+  long long * accounted; // If set, total that size is counted in
 
 } StringStream ;
 
@@ -46,6 +47,21 @@ StringStream * SS_Init() ;
  */
 void SS_Destroy( StringStream * s ) ;
 
+/*
+  SS_SetAccounting - count the data waiting on the stream in an
+  external total. The current size is added to the total now; pushes
+  add to it and pops take away, and SS_Destroy subtracts what is
+  left. The buffer's spare capacity is not counted, so that a stream
+  that once grew large does not count against the total when empty.
+
+  Parameters:
+  => s - StringStream object to account for
+  => counter - total to keep up to date
+
+  Returns: Nothing.
+ */
+void SS_SetAccounting( StringStream * s, long long * counter ) ;
+
 /*
   SS_Push - append data to the end of the data stream and
   update the associated state.
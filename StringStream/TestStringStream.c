@@ -20,6 +20,9 @@ static void * Malloc( size_t size ) {
 int main() {
 
   StringStream * s = SS_Init() ;
+  long long accounted = 0;
+  SS_SetAccounting( s, &accounted );
+  assert( accounted == 0 );
 
   SS_Print( s );
 
@@ -35,6 +38,7 @@ int main() {
   
   SS_Pop( s, 15 );
   SS_Print( s );
+  assert( accounted == s->size );
 
   strcpy( buf, "over the lazy dogs of yes the");
   SS_Push( s, buf, strlen(buf) );
@@ -46,10 +50,22 @@ int main() {
   strcpy( buf, "One two three!");
   SS_Push( s, buf, strlen(buf) );
   SS_Print( s );
+  assert( accounted == s->size );
   
   
   free( buf );
   SS_Destroy( s );
+  assert( accounted == 0 );
+
+  // Whatever is left on a stream is taken off the total with it
+  s = SS_Init();
+  SS_Push( s, "queued", 6 );
+  SS_SetAccounting( s, &accounted );
+  assert( accounted == 6 );
+  SS_Push( s, "more", 4 );
+  assert( accounted == 10 );
+  SS_Destroy( s );
+  assert( accounted == 0 );
 
   return 0;
 }
@@ -2,67 +2,309 @@
   bitfield.h - contains function definitions for a bitfield structure,
   which implements an abstraction over getting and setting individual
   bits in a flag-type structure.
+
+  Bits are stored in the BitTorrent wire format (bit 0 is the high bit
+  of byte 0), and the buffer is padded with zeros to a whole number of 
+  16-byte blocks. Operations over whole bitfields work on 64-bit words,
+  or on 128-bit SSE2 registers where they are available; none of them
+  care about bit order within a word except for finding set bits.
  */
 
 
 #include "bitfield.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static void* Malloc( size_t size ) {
-  void * toRet = malloc( size );
-  if ( ! toRet ) {
+  void * toRet = NULL;
+  if ( posix_memalign( &toRet, 16, size ) ) {
     perror("malloc");
     exit(1);
   }
   return toRet;
 }
 
-int Bitfield_AllSet( Bitfield * cur ) {
+static uint64_t * words( Bitfield * cur ) {
+  return (uint64_t *) cur->buffer;
+}
 
-  int i;
-  char mask[ cur->numBytes ];
-  memset( mask, 0xff, cur->numBytes );
+/*
+  swapWord - convert a word loaded from the buffer so that its most
+  significant bit is the lowest numbered bit it holds.
+ */
+static uint64_t swapWord( uint64_t w ) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return __builtin_bswap64( w );
+#else
+  return w;
+#endif
+}
 
-  int numExtra = (cur->numBits % 8 == 0 ? 0 : 
-		  8 - cur->numBits % 8 ) ;
-  
-  for ( i = 0; i < numExtra; i ++ ) {
-    mask[cur->numBytes-1] &= ~( 1 << i ) ;
+/*
+  Population counts. The popcnt instruction is much faster than the
+  generic fallback, so use it when the CPU has it.
+ */
+static int popcountGeneric( const uint64_t * a, const uint64_t * b, 
+			    int invert, int numWords ) {
+  int i, count = 0;
+  for ( i = 0; i < numWords; i ++ ) {
+    uint64_t w = b ? a[i] & ( invert ? ~b[i] : b[i] ) : a[i];
+    count += __builtin_popcountll( w );
   }
+  return count;
+}
 
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("popcnt")))
+static int popcountHardware( const uint64_t * a, const uint64_t * b, 
+			     int invert, int numWords ) {
+  int i, count = 0;
+  for ( i = 0; i < numWords; i ++ ) {
+    uint64_t w = b ? a[i] & ( invert ? ~b[i] : b[i] ) : a[i];
+    count += __builtin_popcountll( w );
+  }
+  return count;
+}
+#endif
+
+static int popcountWords( const uint64_t * a, const uint64_t * b, 
+			  int invert, int numWords ) {
+#if defined(__x86_64__) && defined(__GNUC__)
+  static int hasPopcnt = -1;
+  if ( hasPopcnt < 0 ) {
+    __builtin_cpu_init();
+    hasPopcnt = __builtin_cpu_supports( "popcnt" ) ? 1 : 0;
+  }
+  if ( hasPopcnt ) {
+    return popcountHardware( a, b, invert, numWords );
+  }
+#endif
+  return popcountGeneric( a, b, invert, numWords );
+}
 
-  for ( i = 0; i < cur->numBytes; i ++ ) {
-    if ( (cur->buffer[i] & mask[i]) != mask[i] ) {
-      // There is some difference 
-      return 0;
+/*
+  combine - the shared body of And, AndNot and Or.
+ */
+#define OP_AND 0
+#define OP_ANDNOT 1
+#define OP_OR 2
+
+static int combine( Bitfield * dst, Bitfield * a, Bitfield * b, int op ) {
+
+  int i = 0;
+
+  if ( dst->numBits != a->numBits || a->numBits != b->numBits ) {
+    return -1;
+  }
+
+#ifdef __SSE2__
+  __m128i * d = (__m128i *) dst->buffer;
+  const __m128i * x = (const __m128i *) a->buffer;
+  const __m128i * y = (const __m128i *) b->buffer;
+  for ( i = 0; i < dst->numWords / 2; i ++ ) {
+    __m128i vx = _mm_load_si128( &x[i] );
+    __m128i vy = _mm_load_si128( &y[i] );
+    if ( op == OP_AND ) {
+      _mm_store_si128( &d[i], _mm_and_si128( vx, vy ) );
+    } 
+    else if ( op == OP_ANDNOT ) {
+      _mm_store_si128( &d[i], _mm_andnot_si128( vy, vx ) );
+    }
+    else {
+      _mm_store_si128( &d[i], _mm_or_si128( vx, vy ) );
     }
   }
-  return 1;
+  i *= 2;
+#endif
+
+  uint64_t * dw = words( dst );
+  const uint64_t * xw = words( a );
+  const uint64_t * yw = words( b );
+  for ( ; i < dst->numWords; i ++ ) {
+    if ( op == OP_AND ) {
+      dw[i] = xw[i] & yw[i];
+    }
+    else if ( op == OP_ANDNOT ) {
+      dw[i] = xw[i] & ~yw[i];
+    }
+    else {
+      dw[i] = xw[i] | yw[i];
+    }
+  }
+  // Bits past numBits are never set, so whole words can be counted
+  dst->numSet = popcountWords( dw, NULL, 0, dst->numWords );
+  return 0;
+
+}
+
+
+int Bitfield_AllSet( Bitfield * cur ) {
+
+  return cur->numSet == cur->numBits;
     
 }
 
 
 int Bitfield_NoneSet( Bitfield * cur ) {
-  int i;
-  char mask[ cur->numBytes ];
-  memset( mask, 0xff, cur->numBytes );
 
-  int numExtra = (cur->numBits % 8 == 0 ? 0 : 
-		  8 - cur->numBits % 8 ) ;
-  
-  for ( i = 0; i < numExtra; i ++ ) {
-    mask[cur->numBytes-1] &= ~( 1 << i ) ;
+  return cur->numSet == 0;
+
+}
+
+
+int Bitfield_Count( Bitfield * cur ) {
+
+  return cur->numSet;
+
+}
+
+
+int Bitfield_CountAnd( Bitfield * a, Bitfield * b ) {
+
+  if ( a->numBits != b->numBits ) {
+    return -1;
+  }
+  return popcountWords( words( a ), words( b ), 0, a->numWords );
+
+}
+
+
+int Bitfield_CountAndNot( Bitfield * a, Bitfield * b ) {
+
+  if ( a->numBits != b->numBits ) {
+    return -1;
   }
+  return popcountWords( words( a ), words( b ), 1, a->numWords );
 
-  char zeroMask[ cur->numBytes ];
-  memset( zeroMask, 0x0, cur->numBytes );
+}
+
+
+int Bitfield_And( Bitfield * dst, Bitfield * a, Bitfield * b ) {
+  return combine( dst, a, b, OP_AND );
+}
+
+
+int Bitfield_AndNot( Bitfield * dst, Bitfield * a, Bitfield * b ) {
+  return combine( dst, a, b, OP_ANDNOT );
+}
 
-  for ( i = 0; i < cur->numBytes; i ++ ) {
-    if ( (cur->buffer[i] & mask[i]) != 0 ) {
-      // There is some difference 
-      return 0;
+
+int Bitfield_Or( Bitfield * dst, Bitfield * a, Bitfield * b ) {
+  return combine( dst, a, b, OP_OR );
+}
+
+
+int Bitfield_NextSet( Bitfield * cur, int from ) {
+
+  if ( from < 0 ) {
+    from = 0;
+  }
+  if ( from >= cur->numBits ) {
+    return -1;
+  }
+
+  int i = from / 64;
+  // Ignore the bits before from in the first word
+  uint64_t w = swapWord( words( cur )[i] ) & ( ~0ULL >> ( from % 64 ) );
+
+  while ( 1 ) {
+    if ( w ) {
+      return i * 64 + __builtin_clzll( w );
+    }
+    if ( ++ i >= cur->numWords ) {
+      return -1;
     }
+    w = swapWord( words( cur )[i] );
   }
-  return 1;
+
+}
+
+
+/*
+  expandByte - the eight bits of each byte value, in wire order, as
+  masks of all zeros or all ones, so that a byte can be added to eight
+  counters at once.
+ */
+static int32_t expandByte[256][8] __attribute__((aligned(16)));
+static int expandReady = 0;
+
+static void buildExpandTable() {
+
+  int b, k;
+  for ( b = 0; b < 256; b ++ ) {
+    for ( k = 0; k < 8; k ++ ) {
+      expandByte[b][k] = - ( ( b >> ( 7 - k ) ) & 0x1 );
+    }
+  }
+  expandReady = 1;
+
+}
+
+
+void Bitfield_AddToCounts( Bitfield * cur, int * counts, int delta ) {
+
+  int i, k;
+  int fullBytes = cur->numBits / 8;
+
+  if ( ! expandReady ) {
+    buildExpandTable();
+  }
+
+#ifdef __SSE2__
+  __m128i vdelta = _mm_set1_epi32( delta );
+#endif
+
+  for ( i = 0; i < fullBytes; i ++ ) {
+    unsigned char b = cur->buffer[i];
+    if ( ! b ) {
+      continue;
+    }
+    int * c = &counts[ i * 8 ];
+#ifdef __SSE2__
+    // Each bit becomes 0 or delta in its lane
+    __m128i lo = _mm_and_si128( vdelta, 
+		   _mm_load_si128( (const __m128i *) &expandByte[b][0] ) );
+    __m128i hi = _mm_and_si128( vdelta, 
+		   _mm_load_si128( (const __m128i *) &expandByte[b][4] ) );
+    _mm_storeu_si128( (__m128i *) c, 
+		      _mm_add_epi32( _mm_loadu_si128( (__m128i *) c ), lo ) );
+    _mm_storeu_si128( (__m128i *) ( c + 4 ), 
+		      _mm_add_epi32( _mm_loadu_si128( (__m128i *) ( c + 4 ) ),
+				     hi ) );
+#else
+    for ( k = 0; k < 8; k ++ ) {
+      c[k] += expandByte[b][k] & delta;
+    }
+#endif
+  }
+
+  // The last, partial byte must not touch counters past numBits
+  for ( k = fullBytes * 8; k < cur->numBits; k ++ ) {
+    if ( Bitfield_IsSet( cur, k ) ) {
+      counts[k] += delta;
+    }
+  }
+
+}
+
+
+void Bitfield_ForEachSet( Bitfield * cur, 
+			  void (*fn)( int bitNum, void * arg ), 
+			  void * arg ) {
+
+  int i;
+
+  for ( i = 0; i < cur->numWords; i ++ ) {
+    uint64_t w = swapWord( words( cur )[i] );
+    while ( w ) {
+      int bit = __builtin_clzll( w );
+      fn( i * 64 + bit, arg );
+      w &= ~( 0x8000000000000000ULL >> bit );
+    }
+  }
+
 }
 
 
@@ -71,13 +313,18 @@ Bitfield * Bitfield_Init( int numBits ) {
   Bitfield * toRet = Malloc( sizeof( Bitfield ) );
 
   int numBytes = (numBits + 7) / 8;
-  char * buf = Malloc( numBytes );
+  // Round up to whole 16-byte blocks, which is always an even number
+  // of words
+  int numWords = ( ( numBytes + 15 ) / 16 ) * 2;
+  char * buf = Malloc( numWords * 8 );
 
-  memset( buf, 0x0, numBytes );
+  memset( buf, 0x0, numWords * 8 );
 
   toRet-> buffer = buf;
   toRet-> numBytes = numBytes;
   toRet-> numBits  = numBits ;
+  toRet-> numWords = numWords ;
+  toRet-> numSet = 0 ;
 
   return toRet;
 
@@ -108,13 +355,14 @@ int Bitfield_FromExisting( Bitfield * cur, char * other, int numBytes ) {
 
 
   memcpy( cur->buffer, other, numBytes );
+  cur->numSet = popcountWords( words( cur ), NULL, 0, cur->numWords );
   return 0;
 
 }
 
 int Bitfield_Get( Bitfield * cur, int bitNum, int * val ) {
 
-  if ( cur->numBits <= bitNum ) {
+  if ( bitNum < 0 || cur->numBits <= bitNum ) {
     return -1;
   }
 
@@ -126,14 +374,29 @@ int Bitfield_Get( Bitfield * cur, int bitNum, int * val ) {
 }
 
 
+int Bitfield_IsSet( Bitfield * cur, int bitNum ) {
+
+  if ( bitNum < 0 || cur->numBits <= bitNum ) {
+    return 0;
+  }
+
+  return ( cur->buffer[ bitNum / 8 ] >> (7-( bitNum % 8 )) ) & 0x1 ;
+
+}
+
+
 int Bitfield_Set( Bitfield * cur, int bitNum ) {
 
-  if ( cur->numBits <= bitNum ) {
+  if ( bitNum < 0 || cur->numBits <= bitNum ) {
     return -1;
   }
 
   int byteNum = bitNum / 8;
-  cur->buffer[ byteNum ] |= 0x1 << (7-( bitNum % 8 )) ;
+  char mask = 0x1 << (7-( bitNum % 8 ));
+  if ( ! ( cur->buffer[ byteNum ] & mask ) ) {
+    cur->buffer[ byteNum ] |= mask ;
+    cur->numSet ++;
+  }
   return 0;
 
 }
@@ -141,12 +404,24 @@ int Bitfield_Set( Bitfield * cur, int bitNum ) {
 
 int Bitfield_Clear( Bitfield * cur, int bitNum ) {
 
-  if ( cur->numBits <= bitNum ) {
+  if ( bitNum < 0 || cur->numBits <= bitNum ) {
     return -1;
   }
 
   int byteNum = bitNum / 8;
-  cur->buffer[ byteNum ] &= ~(0x1 << (7-( bitNum % 8 ))) ;
+  char mask = 0x1 << (7-( bitNum % 8 ));
+  if ( cur->buffer[ byteNum ] & mask ) {
+    cur->buffer[ byteNum ] &= ~mask ;
+    cur->numSet --;
+  }
   return 0;
 
 }
+
+
+void Bitfield_ClearAll( Bitfield * cur ) {
+
+  memset( cur->buffer, 0x0, cur->numWords * 8 );
+  cur->numSet = 0;
+
+}
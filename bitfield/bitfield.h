@@ -10,13 +10,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 
 
 typedef struct {
 
-  char * buffer; // Characters storing 8 bits each
+  char * buffer; // Characters storing 8 bits each, padded with zeros
+                 // to a multiple of 16 bytes
   int numBits;   // Number of bits we are storing
-  int numBytes;  // Number of bytes in the buffer
+  int numBytes;  // Number of bytes in the bitfield (excluding padding)
+  int numWords;  // Number of 64-bit words in the buffer
+  int numSet;    // Number of bits that are set, kept up to date by
+                 // every function that changes the bitfield
 
 } Bitfield ;
 
@@ -61,6 +66,19 @@ int Bitfield_FromExisting( Bitfield * cur, char * other, int numBytes ) ;
 int Bitfield_Get( Bitfield * cur, int bitNum, int * val ) ;
 
 
+/*
+  Bitfield_IsSet - Gets the value of a bit from the bitfield, for use
+  in conditions where the bit number is already known to be valid.
+
+  Parameters:
+  => cur - Bitfield to access
+  => bitNum - Bit number to access
+
+  Returns: 1 if the bit is set; 0 if it is not set or out of range.
+ */
+int Bitfield_IsSet( Bitfield * cur, int bitNum ) ;
+
+
 /*
   Bitfield_Set - Set bit number bitNum in Bitfield cur
   to be 1. 
@@ -77,10 +95,17 @@ int Bitfield_Set( Bitfield * cur, int bitNum ) ;
  */
 int Bitfield_Clear( Bitfield * cur, int bitNum ) ;
 
+/*
+  Bitfield_ClearAll - Set every bit in Bitfield cur to be 0.
+
+  Returns: Nothing.
+ */
+void Bitfield_ClearAll( Bitfield * cur ) ;
+
 
 /*
   Bitfield_AllSet - Returns 1 if all of the bits are set;
-  0 if some of the bits are not set.
+  0 if some of the bits are not set. Takes constant time.
 */
 
 int Bitfield_AllSet( Bitfield * cur );
@@ -88,9 +113,83 @@ int Bitfield_AllSet( Bitfield * cur );
 
 /*
   Bitfield_NoneSet - Returns 1 if none of the bits are set;
-  0 if some of the bits are set.
+  0 if some of the bits are set. Takes constant time.
 */
 int Bitfield_NoneSet( Bitfield * cur );
 
 
+/*
+  Bitfield_Count - Returns the number of bits that are set. Takes
+  constant time.
+*/
+int Bitfield_Count( Bitfield * cur );
+
+
+/*
+  Bitfield_CountAnd - Returns the number of bits that are set in both
+  a and b, or -1 if they are not the same size.
+*/
+int Bitfield_CountAnd( Bitfield * a, Bitfield * b );
+
+
+/*
+  Bitfield_CountAndNot - Returns the number of bits that are set in a
+  but not in b, or -1 if they are not the same size.
+*/
+int Bitfield_CountAndNot( Bitfield * a, Bitfield * b );
+
+
+/*
+  Bitfield_And, Bitfield_AndNot, Bitfield_Or - Set dst to the bitwise
+  combination of a and b (a & b, a & ~b, a | b). dst may be the same
+  bitfield as a or b.
+
+  Returns: 0 on success; non-zero if the bitfields are not all the
+  same size.
+*/
+int Bitfield_And( Bitfield * dst, Bitfield * a, Bitfield * b );
+int Bitfield_AndNot( Bitfield * dst, Bitfield * a, Bitfield * b );
+int Bitfield_Or( Bitfield * dst, Bitfield * a, Bitfield * b );
+
+
+/*
+  Bitfield_NextSet - Find the first set bit at or after bit number 
+  from.
+
+  Returns: The bit number, or -1 if no bits from there on are set.
+*/
+int Bitfield_NextSet( Bitfield * cur, int from );
+
+
+/*
+  Bitfield_AddToCounts - Add delta to counts[i] for every bit i that
+  is set, leaving the other counts alone. Used to keep per-bit tallies
+  across many bitfields (how many peers have each piece, say).
+
+  Parameters:
+  => cur - Bitfield whose set bits are added
+  => counts - array of cur->numBits counters
+  => delta - amount to add for each set bit (negative to subtract)
+
+  Returns: Nothing.
+*/
+void Bitfield_AddToCounts( Bitfield * cur, int * counts, int delta );
+
+
+/*
+  Bitfield_ForEachSet - Call fn for every set bit, in increasing order
+  of bit number. fn must not change the bitfield.
+
+  Parameters:
+  => cur - Bitfield to iterate over
+  => fn - called with the bit number and arg for each set bit
+  => arg - passed through to fn
+
+  Returns: Nothing.
+*/
+void Bitfield_ForEachSet( Bitfield * cur, 
+			  void (*fn)( int bitNum, void * arg ), 
+			  void * arg );
+
+
 #endif
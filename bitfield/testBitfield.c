@@ -25,6 +25,247 @@ char * genMask( int numBits ) {
 
 }
 
+Bitfield * randomBitfield( int numBits ) {
+
+  int i;
+  Bitfield * toRet = Bitfield_Init( numBits );
+  for ( i = 0; i < numBits; i ++ ) {
+    if ( rand() % 3 == 0 ) {
+      Bitfield_Set( toRet, i );
+    }
+  }
+  return toRet;
+
+}
+
+void countBit( int bitNum, void * arg ) {
+
+  int * args = arg;
+  // Bits must arrive in increasing order
+  assert( bitNum > args[1] );
+  args[1] = bitNum;
+  args[0] ++;
+
+}
+
+double elapsed( struct timespec * start ) {
+
+  struct timespec end;
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( end.tv_sec - start->tv_sec ) * 1000.0 + 
+    ( end.tv_nsec - start->tv_nsec ) / 1000000.0;
+
+}
+
+/*
+  testKernels - check every whole-bitfield operation against the 
+  same operation done one bit at a time.
+ */
+void testKernels() {
+
+  int n, i, trial;
+
+  printf("Testing Bitfield_Count, CountAnd, CountAndNot, And, AndNot, Or,\n"
+	 "        ClearAll, NextSet and ForEachSet\n");
+  for ( n = 0; n < 300; n ++ ) {
+    for ( trial = 0; trial < 4; trial ++ ) {
+      Bitfield * a = randomBitfield( n );
+      Bitfield * b = randomBitfield( n );
+      Bitfield * d = Bitfield_Init( n );
+      int count = 0, countAnd = 0, countAndNot = 0;
+
+      for ( i = 0; i < n; i ++ ) {
+	count += Bitfield_IsSet( a, i );
+	countAnd += Bitfield_IsSet( a, i ) && Bitfield_IsSet( b, i );
+	countAndNot += Bitfield_IsSet( a, i ) && ! Bitfield_IsSet( b, i );
+      }
+      assert( Bitfield_Count( a ) == count );
+      assert( Bitfield_CountAnd( a, b ) == countAnd );
+      assert( Bitfield_CountAndNot( a, b ) == countAndNot );
+      assert( Bitfield_AllSet( a ) == ( count == n ) );
+      assert( Bitfield_NoneSet( a ) == ( count == 0 ) );
+
+      assert( ! Bitfield_And( d, a, b ) );
+      assert( Bitfield_Count( d ) == countAnd );
+      for ( i = 0; i < n; i ++ ) {
+	assert( Bitfield_IsSet( d, i ) == 
+		( Bitfield_IsSet( a, i ) && Bitfield_IsSet( b, i ) ) );
+      }
+      assert( ! Bitfield_AndNot( d, a, b ) );
+      assert( Bitfield_Count( d ) == countAndNot );
+      for ( i = 0; i < n; i ++ ) {
+	assert( Bitfield_IsSet( d, i ) == 
+		( Bitfield_IsSet( a, i ) && ! Bitfield_IsSet( b, i ) ) );
+      }
+      assert( ! Bitfield_Or( d, a, b ) );
+      for ( i = 0; i < n; i ++ ) {
+	assert( Bitfield_IsSet( d, i ) == 
+		( Bitfield_IsSet( a, i ) || Bitfield_IsSet( b, i ) ) );
+      }
+      Bitfield_ClearAll( d );
+      assert( Bitfield_NoneSet( d ) );
+      assert( Bitfield_NextSet( d, 0 ) == -1 );
+
+      int next = Bitfield_NextSet( a, 0 );
+      for ( i = 0; i < n; i ++ ) {
+	if ( Bitfield_IsSet( a, i ) ) {
+	  assert( next == i );
+	  next = Bitfield_NextSet( a, i + 1 );
+	}
+      }
+      assert( next == -1 );
+
+      int args[2] = { 0, -1 };
+      Bitfield_ForEachSet( a, countBit, args );
+      assert( args[0] == count );
+
+      // One extra counter past the end, which must not be touched
+      int * counts = calloc( n + 1, sizeof( int ) );
+      Bitfield_AddToCounts( a, counts, 3 );
+      Bitfield_AddToCounts( b, counts, -1 );
+      for ( i = 0; i < n; i ++ ) {
+	assert( counts[i] == 3 * Bitfield_IsSet( a, i ) - 
+		Bitfield_IsSet( b, i ) );
+      }
+      assert( counts[n] == 0 );
+      free( counts );
+
+      Bitfield_Destroy( a );
+      Bitfield_Destroy( b );
+      Bitfield_Destroy( d );
+    }
+  }
+
+  Bitfield * a = Bitfield_Init( 10 );
+  Bitfield * b = Bitfield_Init( 11 );
+  assert( Bitfield_And( a, a, b ) );
+  assert( Bitfield_CountAnd( a, b ) == -1 );
+  Bitfield_Destroy( a );
+  Bitfield_Destroy( b );
+
+}
+
+/*
+  benchmark - time the whole-bitfield operations against the loops
+  over Bitfield_Get that they replace, on a bitfield the size of a
+  large torrent.
+ */
+void benchmark() {
+
+  int i, j, val;
+  int numBits = 1 << 20;
+  int reps = 50;
+  struct timespec start;
+  volatile int sink = 0;
+  double slow, fast;
+
+  Bitfield * a = randomBitfield( numBits );
+  Bitfield * b = randomBitfield( numBits );
+  Bitfield * d = Bitfield_Init( numBits );
+
+  printf("Benchmarking on %d bits (ms per operation)\n", numBits );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    int count = 0;
+    for ( i = 0; i < numBits; i ++ ) {
+      Bitfield_Get( a, i, &val );
+      count += val != 0;
+    }
+    sink += count;
+  }
+  slow = elapsed( &start ) / reps;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    sink += Bitfield_Count( a );
+  }
+  fast = elapsed( &start ) / reps;
+  printf("  Count:       %8.3f per bit, %8.3f kept count\n", 
+	 slow, fast );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    int count = 0;
+    for ( i = 0; i < numBits; i ++ ) {
+      count += Bitfield_IsSet( a, i ) && ! Bitfield_IsSet( b, i );
+    }
+    sink += count;
+  }
+  slow = elapsed( &start ) / reps;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    sink += Bitfield_CountAndNot( a, b );
+  }
+  fast = elapsed( &start ) / reps;
+  printf("  CountAndNot: %8.3f per bit, %8.3f word (%.0fx)\n", 
+	 slow, fast, slow / fast );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    for ( i = 0; i < numBits; i ++ ) {
+      if ( Bitfield_IsSet( a, i ) && Bitfield_IsSet( b, i ) ) {
+	Bitfield_Set( d, i );
+      }
+      else {
+	Bitfield_Clear( d, i );
+      }
+    }
+  }
+  slow = elapsed( &start ) / reps;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    Bitfield_And( d, a, b );
+  }
+  fast = elapsed( &start ) / reps;
+  printf("  And:         %8.3f per bit, %8.3f SIMD (%.0fx)\n", 
+	 slow, fast, slow / fast );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    for ( i = 0; i < numBits; i ++ ) {
+      if ( Bitfield_IsSet( a, i ) ) {
+	sink += i;
+      }
+    }
+  }
+  slow = elapsed( &start ) / reps;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    for ( i = Bitfield_NextSet( a, 0 ); i >= 0; 
+	  i = Bitfield_NextSet( a, i + 1 ) ) {
+      sink += i;
+    }
+  }
+  fast = elapsed( &start ) / reps;
+  printf("  NextSet:     %8.3f per bit, %8.3f word (%.0fx)\n", 
+	 slow, fast, slow / fast );
+
+  int * counts = calloc( numBits, sizeof( int ) );
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    for ( i = 0; i < numBits; i ++ ) {
+      Bitfield_Get( a, i, &val );
+      if ( val ) {
+	counts[i] ++;
+      }
+    }
+  }
+  slow = elapsed( &start ) / reps;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    Bitfield_AddToCounts( a, counts, 1 );
+  }
+  fast = elapsed( &start ) / reps;
+  printf("  AddToCounts: %8.3f per bit, %8.3f SIMD (%.0fx)\n\n", 
+	 slow, fast, slow / fast );
+  free( counts );
+
+  Bitfield_Destroy( a );
+  Bitfield_Destroy( b );
+  Bitfield_Destroy( d );
+
+}
+
 int main() {
 
   int i, j;
@@ -36,9 +277,20 @@ int main() {
     assert( Bitfield_NoneSet( bitfield ) );
 
     for ( j = 0; j < i; j ++ ) {
+      assert( Bitfield_Count( bitfield ) == j );
+      Bitfield_Set( bitfield, j );
+      // Setting a bit twice must not count it twice
       Bitfield_Set( bitfield, j );
     }
     assert( Bitfield_AllSet( bitfield ) );
+    assert( Bitfield_Count( bitfield ) == i );
+    for ( j = 0; j < i; j ++ ) {
+      Bitfield_Clear( bitfield, j );
+      Bitfield_Clear( bitfield, j );
+      assert( Bitfield_Count( bitfield ) == i - j - 1 );
+      assert( ! Bitfield_AllSet( bitfield ) );
+    }
+    assert( Bitfield_NoneSet( bitfield ) );
 
     Bitfield_Destroy( bitfield );
 
@@ -52,6 +304,8 @@ int main() {
       assert( i < j ? 
 	      Bitfield_FromExisting( bitfield, mask, 2 ) == -1 :
 	      Bitfield_FromExisting( bitfield, mask, 2 ) == 0 );
+      assert( Bitfield_Count( bitfield ) == ( i < j ? 0 : j ) );
+      assert( Bitfield_AllSet( bitfield ) == ( i == j ) );
 
       free( mask );
       Bitfield_Destroy( bitfield );
@@ -71,7 +325,9 @@ int main() {
     r = rand() % size;
     assert( !Bitfield_Get( bitfield, r, &val ) );
     assert( ! val );
+    assert( ! Bitfield_IsSet( bitfield, r ) );
     assert( !Bitfield_Set( bitfield, r ) );
+    assert( Bitfield_IsSet( bitfield, r ) == 1 );
 
     for ( j = 0; j < size; j ++ ) {
       assert( !Bitfield_Get( bitfield, j, &val ) );
@@ -88,12 +344,18 @@ int main() {
     assert( Bitfield_NoneSet( bitfield ) );
 
   }
+  assert( ! Bitfield_IsSet( bitfield, size ) );
+  assert( ! Bitfield_IsSet( bitfield, -1 ) );
 
 
   Bitfield_Destroy( bitfield );
 
+  testKernels();
+
   printf("PASS\n\n");
 
+  benchmark();
+
 
   return 0;
 
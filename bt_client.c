@@ -19,6 +19,13 @@
 #include "startup.h"
 #include "managePeers.h"
 #include "utils/algorithms.h"
+#include "utils/requests.h"
+#include "utils/memory.h"
+#include "utils/fastResume.h"
+#include "utils/blame.h"
+#include "utils/scrub.h"
+#include "utils/writeback.h"
+#include "utils/pieceCache.h"
 #include "bt_client.h"
 
 /*
@@ -35,7 +42,12 @@
 #endif
 
 
+// Set by requestShutdown() when the user hits Ctrl^C
+static volatile sig_atomic_t shutdownRequested = 0;
 
+void requestShutdown( int sig ) {
+  shutdownRequested = 1;
+}
 
 void destroyTorrentInfo( ) { 
   int i; 
@@ -55,30 +67,76 @@ void destroyTorrentInfo( ) {
   free( t->trackerDomain );
   free( t->trackerIP );
 
+  // Stop checking pieces before their buffers are given back
+  HP_Destroy( t->hashPool );
+
+  // Write out and flush every finished piece, so that everything in
+  // our bitfield has been checked and is on disk
+  finishWriteback( t );
+  saveFastResume( t );
+  if ( t->resumeJobs ) {
+    // Jobs still checking the file hold piece buffers
+    for ( i = 0; i < t->numResumeJobs; i ++ ) {
+      if ( t->resumeJobs[i].load ) {
+	BP_Release( t->piecePool, t->resumeJobs[i].data );
+      }
+    }
+    memFree( t, MEM_METADATA, t->resumeJobs, 
+	     t->numResumeJobs * sizeof( HP_Job ) );
+  }
+
   for ( i = 0; i < t->numChunks; i ++ ) {
-    if (! t->chunks[i].have )  {
-      free( t->chunks[i].data );
-      free( t->chunks[i].subChunks );
+    if (! Bitfield_IsSet( t->ourBitfield, i ) )  {
+      if ( t->chunkData[i] ) {
+	BP_Release( t->piecePool, t->chunkData[i] );
+      }
+      free( t->chunkHashState[i] );
+      freePieceSources( t, i );
     }
   }
+  freePieceReads( t );
+  if ( t->scrubBusy && t->scrubJob.load ) {
+    BP_Release( t->piecePool, t->scrubJob.data );
+  }
+  BP_Destroy( t->piecePool );
+  printCacheStatus( t );
+  destroyPieceCache( t );
 
   for ( i = 0; i < t->peerListLen; i ++ ) {
-    if ( t->peerList[i].defined ) {
-      destroyPeer( &t->peerList[i], t );
+    if ( peerAt( t, i )->defined ) {
+      destroyPeer( peerAt( t, i ), t );
     }
   }
 
   printf("Freed data chunks and peer metadata structures\n");
   logToFile( t, "SHUTDOWN Freed data chunks and peer metadata structures\n");
 
-  free( t->chunks );
+  free( t->prevalence );
+  Bitfield_Destroy( t->chunksRequested );
+  free( t->chunkHashes );
+  free( t->chunkData );
+  free( t->numSubChunksReceived );
+  free( t->chunkHashState );
+  free( t->chunkSources );
+  free( t->blame );
   free( t->chunkOrdering );
   free( t->name );
   free( t->comment );
   free( t->infoHash );
   free( t->peerID );
-  free( t->peerList );
+  for ( i = 0; i < t->numPeerSlabs; i ++ ) {
+    free( t->peerSlabs[i] );
+  }
+  free( t->peerSlabs );
   Bitfield_Destroy( t->ourBitfield );
+  Bitfield_Destroy( t->seedBitfield );
+  Bitfield_Destroy( t->unflushed );
+  Bitfield_Destroy( t->flushing );
+  if ( t->unverified ) {
+    Bitfield_Destroy( t->unverified );
+  }
+  Bitfield_Destroy( t->subChunksRequested );
+  Bitfield_Destroy( t->subChunksReceived );
   if ( timer_delete( t->timerTimeoutID ) ) {
     perror("timer_delete");
     logToFile( t, "SHUTDOWN Error deleting timer.\n");
@@ -89,10 +147,10 @@ void destroyTorrentInfo( ) {
   }
 
 
-  munmap( t->fileData, t->totalSize );
+  Storage_Close( t->storage );
 
-  printf("Unmapped file.\nClosing logfile.\n");
-  logToFile( t, "SHUTDOWN Unmapped file.\n");
+  printf("Closed file.\nClosing logfile.\n");
+  logToFile( t, "SHUTDOWN Closed file.\n");
   logToFile( t, "SHUTDOWN Closing logfile.\n");
 
   if ( t->logFile ) {
@@ -117,25 +175,25 @@ int setupReadWriteSets( fd_set * readPtr,
 
   int maxFD = 0;
 
-  struct timeval tv;
-  if ( gettimeofday( &tv, NULL ) ){
-    perror("gettimeofday");
-    exit(1);
-  }
+  // While the upload queues are full, stop reading from peers who
+  // still have data queued, so that their requests wait in the
+  // socket instead of in memory.
+  int queuesFull = memOverLimit( torrent, MEM_OUTGOING );
 
   for ( i = 0; i < torrent->peerListLen; i ++ ) {
-    if ( torrent->peerList[i].defined ) {
-      FD_SET( torrent->peerList[i].socket, readPtr );
-      if ( maxFD < torrent->peerList[i].socket ) {
-	maxFD = torrent->peerList[i].socket;
+    if ( peerAt( torrent, i )->defined ) {
+      if ( ! queuesFull || peerAt( torrent, i )->outgoingData->size == 0 ) {
+	FD_SET( peerAt( torrent, i )->socket, readPtr );
+	if ( maxFD < peerAt( torrent, i )->socket ) {
+	  maxFD = peerAt( torrent, i )->socket;
+	}
       }
 
       // We want to write to anybody who has data pending
-      if ( torrent->peerList[i].outgoingData->size > 0 && 
-	   tv.tv_sec - torrent->peerList[i].lastWrite > 2 ) {
-	FD_SET( torrent->peerList[i].socket, writePtr ) ;
-	if ( maxFD < torrent->peerList[i].socket ) {
-	  maxFD = torrent->peerList[i].socket;
+      if ( peerAt( torrent, i )->outgoingData->size > 0 ) {
+	FD_SET( peerAt( torrent, i )->socket, writePtr ) ;
+	if ( maxFD < peerAt( torrent, i )->socket ) {
+	  maxFD = peerAt( torrent, i )->socket;
 	}
       }
     } /* Peer is defined */
@@ -219,7 +277,7 @@ void handleActiveFDs( fd_set * readFDs,
   // Iterate twice in case an invalid read message leads us to 
   // close the socket while we still wanted to write to it.
   for ( i = 0; i < torrent->peerListLen; i ++ ) {
-    struct peerInfo * this = &torrent->peerList[i] ;
+    struct peerInfo * this = peerAt( torrent, i ) ;
     if ( this->defined ) {
       if ( FD_ISSET( this->socket, readFDs ) ) {
 	handleRead( this, torrent );
@@ -228,7 +286,7 @@ void handleActiveFDs( fd_set * readFDs,
   }
 
   for ( i = 0; i < torrent->peerListLen; i ++ ) {
-    struct peerInfo * this = &torrent->peerList[i] ;
+    struct peerInfo * this = peerAt( torrent, i ) ;
     if ( this->defined ) {
       if ( FD_ISSET( this->socket, writeFDs ) ) {
 	handleWrite( this, torrent );
@@ -240,90 +298,6 @@ void handleActiveFDs( fd_set * readFDs,
 
 
 
-void generateMessages( struct torrentInfo * t ) {
-
-
-
-  int i,j, k,val, ret;
-
-  val = 0;
-
-  struct timeval cur;
-  ret = gettimeofday( &cur, NULL );
-  if ( ret ) {
-    perror("gettimeofday");
-    exit(1);
-  }
-
-
-  // If we are choked but they have a piece that 
-  // we don't have, then send them an interest 
-  // message.
-  for ( i = 0; i < t->peerListLen; i ++ ){
-    if ( ! t->peerList[i].defined ) {
-      continue ; // Unused slot
-    }
-    for ( j = 0; j < t->numChunks; j ++ ) {
-
-      struct chunkInfo * curPtr = 
-	t->chunkOrdering[j];
-
-      if ( t->peerList[i].numPendingSubchunks >= MAX_PENDING_SUBCHUNKS ) {
-	break; // This peer already has enough outstanding requests
-	// so we don't want to waste time getting more.
-      }
-    
-      if ( ! curPtr->have ) {
-	struct peerInfo* peerPtr = &(t->peerList[i]);
-	if ( (! Bitfield_Get( peerPtr->haveBlocks, j, &val )) && val ) {
-	  // Our peer has this chunk, and we want it.
-	  t->peerList[i].am_interested = 1;
-	  
-	  // This peer is choking us. Tell them we'll download from them if
-	  // they unchoke us.
-	  if ( t->peerList[i].peer_choking && 
-	       (cur.tv_sec - t->peerList[i].lastInterestedRequest) > 5) {
-	    sendInterested( &t->peerList[i], t );
-	    t->peerList[i].lastInterestedRequest = cur.tv_sec;
-	    break;
-   	  }
-
-	  // This peer is not choking us. Request up to 
-	  // MAX_PENDING_SUBCHUNKS subchunks from them.
-	  else if ( ! t->peerList[i].peer_choking ) {
-	    for ( k = 0; k < curPtr->numSubChunks; k ++ ) {
-	      if ( t->peerList[i].numPendingSubchunks >= MAX_PENDING_SUBCHUNKS ) {
-		break;
-	      }
-	      if ( curPtr->subChunks[k].have == 0 &&
-		   cur.tv_sec - curPtr->subChunks[k].requestTime > 20 ) {
-		sendPieceRequest( &t->peerList[i], t, j, k );
-		curPtr->subChunks[k].requestTime = cur.tv_sec;
-		curPtr->requested = 1;
-	      }
-	    }
-	  }
-
-	  else { 
-	    // We're choked, we can't ask again to be unchoked,
-	    // and we can't request things while choked.
-	    // So, do nothing. 
-	    break;
-	  }
-
-	    
-	} /* If they have this block */
-      }   /* If we don't have this block */
-
-    } /* For all blocks */
-  }  /* For all peers */
-
-
-
-}
-
-
-
 void printStatus( struct torrentInfo * t ) {
 
   int i;
@@ -346,10 +320,10 @@ void printStatus( struct torrentInfo * t ) {
       printf("\n");
     }
 
-    if ( t->chunks[i].have ) {
+    if ( Bitfield_IsSet( t->ourBitfield, i ) ) {
       printf("X");
     }
-    else if ( t->chunks[i].requested ) {
+    else if ( Bitfield_IsSet( t->chunksRequested, i ) ) {
       printf("x");
     }
     else {
@@ -363,6 +337,12 @@ void printStatus( struct torrentInfo * t ) {
   printf("Number of Unknown: %d\n", t->numUnknown);
   printf("  Download Amount: %.1f kB\n", 1.0*t->numBytesDownloaded / 1000 );
   printf("    Upload Amount: %.1f kB\n", 1.0*t->numBytesUploaded / 1000 );
+  if ( t->resumeChecked < t->numChunks ) {
+    printf("  Checking File: %d/%d pieces\n", t->resumeChecked, t->numChunks);
+  }
+  printCacheStatus( t );
+  printf("\n");
+  printMemoryStatus( t );
   printf("\n===================================\n");
   logToFile( t, "STATUS UPDATE  Downloaded:%.1f, Uploaded %.1f\n",
 	     1.0*t->numBytesDownloaded/1000, 
@@ -397,8 +377,8 @@ int main(int argc, char ** argv) {
   setupSignals( SIGALRM, trackerCheckin );
   alarm( 30 );  
 
-  // When the user hits Ctrl^C, exit
-  setupSignals( SIGINT, destroyTorrentInfo );
+  // When the user hits Ctrl^C, exit once we are back in the loop
+  setupSignals( SIGINT, requestShutdown );
 
   // Every 30 seconds, check for idle connections
   t->timerTimeoutID = setupSignal( SIGUSR1, timeoutDetection, 30, t );
@@ -412,29 +392,66 @@ int main(int argc, char ** argv) {
   // We can now start our select loop
   fd_set readFDs, writeFDs;
   struct timeval tv; 
+  unsigned long long now, wake;
+  long long scrubWait;
 
   while ( 1 ) {
 
+    // select() returns early when SIGINT arrives, so we get here soon
+    if ( shutdownRequested ) {
+      destroyTorrentInfo();
+    }
+
     FD_ZERO( &readFDs );
     FD_ZERO( &writeFDs );
 
-    tv.tv_sec = 2;
-    tv.tv_usec = 0;
-
     blockSignal( SIGUSR1 );
     blockSignal( SIGUSR2 );
     blockSignal( SIGALRM );
 
-    sortChunks( t ) ;
+    // Requests are generated as messages arrive; all that is left
+    // for us is to notice requests that have gone unanswered and
+    // hand any given-back blocks to somebody else.
+    now = getTimeMs();
+    if ( now >= t->nextRequestDeadline ) {
+      expireRequests( t, now );
+    }
+    if ( t->requestsReleased ) {
+      fillAllRequests( t );
+    }
+
+    scrubTick( t, now );
+    writebackTick( t, now );
+    if ( t->numWaitingReads > 0 ) {
+      startWaitingReads( t );
+    }
 
-    generateMessages( t );
+    // Wake up in time for the next request deadline, or for the
+    // scrub to start another piece
+    wake = t->nextRequestDeadline;
+    scrubWait = scrubDelay( t );
+    if ( scrubWait >= 0 && now + scrubWait < wake ) {
+      wake = now + scrubWait;
+    }
+    tv.tv_sec = SELECT_TIMEOUT;
+    tv.tv_usec = 0;
+    if ( wake - now < SELECT_TIMEOUT * 1000 ) {
+      tv.tv_sec = ( wake - now ) / 1000;
+      tv.tv_usec = ( ( wake - now ) % 1000 ) * 1000;
+    }
 
-    // We always want to accept new connections
+    // We always want to accept new connections, and to hear about
+    // pieces that have been checked or written
     FD_SET( listeningSocket, &readFDs );    
+    FD_SET( HP_WaitFD( t->hashPool ), &readFDs );
+    FD_SET( writebackFD( t ), &readFDs );
 
     int maxFD = setupReadWriteSets( &readFDs, &writeFDs, t );
     
     maxFD = ( maxFD > listeningSocket ? maxFD : listeningSocket );
+    maxFD = ( maxFD > HP_WaitFD( t->hashPool ) ? 
+	      maxFD : HP_WaitFD( t->hashPool ) );
+    maxFD = ( maxFD > writebackFD( t ) ? maxFD : writebackFD( t ) );
 
 
     ret = select( maxFD + 1, &readFDs, &writeFDs, NULL, &tv );
@@ -447,10 +464,27 @@ int main(int argc, char ** argv) {
       exit(1);
     }
 
+    if ( FD_ISSET( HP_WaitFD( t->hashPool ), &readFDs ) ) {
+      collectVerifiedPieces( t );
+    }
+    if ( FD_ISSET( writebackFD( t ), &readFDs ) ) {
+      collectWrites( t );
+    }
+
     handleActiveFDs( &readFDs, &writeFDs, t, listeningSocket );
     
     printStatus( t );
 
+    // Close connections to anybody we have just banned
+    if ( t->bansPending ) {
+      dropBannedPeers( t );
+    }
+
+    // Keep a restart from having to check the pieces we have finished
+    if ( fastResumeDue( t, now ) ) {
+      saveFastResume( t );
+    }
+
     // Handle any pending signals 
 
     // Idle connections timeout
@@ -20,6 +20,19 @@
  */
 void destroyTorrentInfo( ) ;
 
+/*
+  requestShutdown - SIGINT handler. Only notes that we should stop;
+  the main loop calls destroyTorrentInfo() when it next comes round,
+  since shutting down takes locks and joins threads, which a signal
+  handler must not do.
+
+  Parameters:
+  => sig - the signal number
+
+  Returns: Nothing.
+ */
+void requestShutdown( int sig ) ;
+
 /*
   setupReadWriteSets - setup our read and write file descriptor sets
   for our next call to select. We want to read from everybody and write
@@ -84,20 +97,6 @@ void handleActiveFDs( fd_set * readFDs,
 		      struct torrentInfo * torrent, 
 		      int listeningSock ) ;
 
-/*
-  generateMessages - creates and appends intersted and request messages to 
-  connected peers and seeds based on what they have, what we want, what is
-  rare, whether or not they are choking us, how much we have requested from
-  them already, and how much time they have had to respond to earlier requests.
-
-  Parameters: 
-  => torrent - pointer to current torrentInfo structure for download
-
-  Returns: Nothing.
-
- */
-void generateMessages( struct torrentInfo * t ) ;
-
 /*
   printStatus - prints out a graphical display of the blocks downloaded
   and requested so far, the number of connections, and the amount of data
@@ -30,6 +30,10 @@
 
 #include "bitfield/bitfield.h"
 #include "StringStream/StringStream.h"
+#include "BufferPool/BufferPool.h"
+#include "HashPool/HashPool.h"
+#include "storage/storage.h"
+#include "sha1/sha1.h"
 
 /***************************************************
   Preprocessor defined variables     
@@ -54,12 +58,86 @@
 
 #define BACKLOG 20  // Max number of connections to wait for
 
+// Pieces are transferred in subchunks (blocks) of this many bytes
+#define SUBCHUNK_SIZE ( 1 << 14 )
+
+// The longest block we will send in answer to one request. Peers ask
+// for SUBCHUNK_SIZE, and other clients refuse more than this.
+#define MAX_REQUEST_SIZE ( 8 * SUBCHUNK_SIZE )
+
 // How many requests should each peer have at once?
 #define MAX_PENDING_SUBCHUNKS 10 
 
+// How many of a peer's requests may wait for their pieces to be read
+// from the save file? Further requests are refused.
+#define MAX_DEFERRED_REQUESTS 64
+
+// How long should a block request be outstanding before we give up on
+// it and let somebody else serve it? Each peer starts at the initial
+// value, and then adapts to the request latency we measure for them,
+// in the style of TCP's retransmission timer. (milliseconds)
+#define INITIAL_REQUEST_TIMEOUT_MS 20000
+#define MIN_REQUEST_TIMEOUT_MS 200
+#define MAX_REQUEST_TIMEOUT_MS 60000
+
+// Peers we have requests outstanding to are allowed to be silent for
+// this many of their request timeouts before we disconnect them.
+#define IDLE_TIMEOUT_MULTIPLE 4
+
+// Longest we will sit in select() before doing housekeeping (seconds)
+#define SELECT_TIMEOUT 2
+
+// Default memory budget for pieces that are being downloaded (MB)
+#define DEFAULT_PIECE_BUDGET_MB 64
+
 // How long should we wait for idle connections before closing them?
+// (seconds; slow peers with requests outstanding get longer)
 #define MAX_TIMEOUT_WAIT 20 
 
+// Default memory budget for data queued to be uploaded (MB)
+#define DEFAULT_QUEUE_BUDGET_MB 16
+
+// Default size of the cache of pieces served to peers (MB)
+#define DEFAULT_CACHE_MB 16
+
+// How much of the save file to have in flight (read ahead and being
+// hashed) while checking it on startup (MB)
+#define RESUME_READAHEAD_MB 32
+
+// Shortest time between saves of the fast-resume file (seconds)
+#define FAST_RESUME_INTERVAL 60
+
+// How finished pieces are made durable; see utils/writeback.h
+#define WRITEBACK_SYNC  0
+#define WRITEBACK_ASYNC 1
+#define WRITEBACK_BATCH 2
+
+// How often the async and batch writeback policies flush the save
+// file to disk (seconds)
+#define WRITEBACK_INTERVAL 10
+
+// How often to log the throughput of the background scrub (seconds)
+#define SCRUB_REPORT_INTERVAL 60
+
+// How many pieces that fail their hash check may one address send us,
+// on its own, before we ban it?
+#define MAX_HASH_STRIKES 2
+
+// How many failed copies of a piece to keep block digests for
+#define MAX_FAILED_COPIES 4
+
+// Categories of memory use that we account for
+#define MEM_PIECES 0     // Buffers for pieces being downloaded
+#define MEM_OUTGOING 1   // Data queued to be sent to peers
+#define MEM_RECEIVE 2    // Buffers for messages being received
+#define MEM_BITFIELDS 3  // Our bitfields and those of our peers
+#define MEM_METADATA 4   // Per-piece and per-peer bookkeeping
+#define MEM_CACHE 5      // Pieces cached for uploads
+#define MEM_NUM_CATEGORIES 6
+
+// Number of peer slots allocated at a time when the table is full
+#define PEER_SLAB_SIZE 32
+
 /***************************************************
   Structure Definitions
 ****************************************************/
@@ -75,41 +153,98 @@ struct argsInfo {
   char * nodeID;    // Unique ID for our client
   char * fileName;  // Name of .torrent file
   int maxPeers;     // Max number of peers to support
+  int pieceBudget;  // MB of memory for in-flight pieces
+  int queueBudget;  // MB of memory for queued uploads
+  int cacheSize;    // MB of memory for pieces cached for uploads
+  int hashThreads;  // Number of threads for checking pieces
+  int seedMode;     // Assume the save file is complete?
+  int scrubRate;    // kB/s for re-checking pieces we have; 0 for none
+  int writeback;    // One of the WRITEBACK_* policies
+  char * storage;   // Backend for the save file; see storage/storage.h
   int bindAddress ; // IP address to listen for connections
   unsigned short bindPort; // Port to bind to when listening
 };
 
 /*
-  A subChunk struct stores information about a part of a larger
-  file piece, since file pieces are too large to be transmitted 
-  int a single message.
+  A peerHandle refers to a connection that may since have been 
+  closed. The slot's generation changes whenever a connection in it
+  is destroyed, so getPeer() returns NULL for stale handles instead
+  of whoever has taken over the slot.
+ */
+typedef struct {
+  int slot;
+  unsigned int generation;
+} peerHandle;
+
+/*
+  A block request waiting for its piece to be read and checked before
+  we answer it; see struct pieceRead.
+ */
+struct deferredRequest {
+  peerHandle peer;
+  int piece;
+  int begin;
+  int length;
+  struct deferredRequest * next;
+};
+
+/*
+  A pieceRead is a piece being read from the save file and checked on
+  the hash pool, and the requests waiting for it: in seed mode, for a
+  piece that has not been checked yet, or for a piece being read into
+  the piece cache (see utils/pieceCache.h). The job comes first,
+  so that the finished job leads back to the pieceRead.
  */
-struct subChunk {
-  int start;  // Offset into larger piece where this subchunk data starts
-  int end;    // Ending offset into this larger piece where this subchunk
-              // data ends.
-  int len;    // Length of subchunk
-  int have;   // Boolean if subchunk has been received or not
-  int requested; // Boolean if subchunk has been requested or not
-  int requestTime; // Time in seconds past the epoch of last request sent
+struct pieceRead {
+  HP_Job job;                          // job.tag is the piece
+  int submitted;                       // On the hash pool yet, or
+                                       // waiting for a buffer?
+  char * buffer;                       // Buffer it is read into, or
+                                       // NULL to hash it in the map
+  int cached;                          // Is buffer a piece cache slot,
+                                       // rather than from the pool?
+  struct deferredRequest * requests;   // Newest first
+  struct pieceRead * prev;             // In torrentInfo's pieceReadList
+  struct pieceRead * next;
 };
 
 /*
-  A chunkInfo struct stores information about a piece of the file
-  being torrented.
+  A blameRecord counts the bad pieces an address has sent us, and 
+  whether we have banned it. See utils/blame.h.
  */
-struct chunkInfo {
-
-  int prevalence; // How many people that we are connected to have this piece?
-  int size;  // How long is this piece?
-  int have;  // Boolean do we have this piece or not? 
-  int requested; // Boolean have we requested this piece?
-  char * data;  // Pointer to data buffer for this piece
-  char hash[20]; // SHA1 hash of piece
-  int numSubChunks; // Number of subChunks corresponding to this piece
-  struct subChunk * subChunks; // Pointer to array of subChunk structs
+struct blameRecord {
+  char ip[16];
+  int strikes;
+  int banned;
 };
 
+/*
+  A pieceSources struct records where each block of a piece being 
+  downloaded came from, as indexes into the blame table. If earlier
+  copies of the piece failed their hash check, it also keeps the
+  digest and source of each block of the last few of them, to compare
+  against the good copy. Once a copy from several peers has failed, 
+  the piece is fetched from one address at a time.
+ */
+struct pieceSources {
+  int * source;              // Per block; -1 until it arrives
+  int numSuspect;            // Failed copies kept, oldest first
+  int * suspectSource;       // Per block of each failed copy, or NULL
+  unsigned char * suspect;   // SHA1 of each block of each failed copy
+  int singleSource;          // Fetch the piece from one address?
+  int owner;                 // If so, the one fetching it, or -1
+};
+
+/*
+  A pendingRequest struct records a block request that we have sent to
+  a peer and that they have not yet answered.
+ */
+struct pendingRequest {
+  int piece;     // Piece number we requested
+  int subChunk;  // Subchunk number within that piece
+  unsigned long long sentTime; // When the request was queued (ms)
+  unsigned long long deadline; // When we give up on the request (ms)
+};
 
 /*
   A torrentInfo struct stores all of the relevant information for the current 
@@ -151,38 +286,146 @@ struct torrentInfo {
   /*
     Information about the downloaded file data.
    */
-  int totalSize; // How much data is the file we are downloading?
+  long long totalSize; // How much data are we downloading, in all?
   int chunkSize; // How large is each chunk?
   int numChunks; // How many chunks is it broken into?
-  struct chunkInfo * chunks; // Array of chunkInfo structs, defined above
-  struct chunkInfo ** chunkOrdering; // Array of pointers to each chunk,
-                                     // with chunks sorted in order of 
-                                     // prevalence (rarest chunks first).
-  int numPrevalenceChanges; // Number of times prevalence numbers have
+
+  // Per-piece state, kept as parallel arrays indexed by piece number
+  // so that sweeps over every piece touch only the field they need.
+  // Whether we have a piece is recorded in ourBitfield.
+  int * prevalence; // How many peers (not counting seeds) we are 
+                    // connected to have each piece? Seeds have every
+                    // piece, so add numSeeds for the full count.
+  Bitfield * chunksRequested; // Have we requested any of each piece?
+  unsigned char * chunkHashes; // SHA1 hash of piece i at 20*i
+  char ** chunkData;  // Data buffer for each piece; taken from the
+                      // piece pool when we request the first block,
+                      // and given back once the piece is in the file.
+                      // NULL whenever the piece has no buffer.
+  unsigned short * numSubChunksReceived; // Subchunks arrived per piece
+  struct pieceSources ** chunkSources; // Who sent each block of the
+                                       // pieces being downloaded
+  Sha1_Ctx ** chunkHashState; // Running SHA1 of the blocks at the start
+                              // of each piece being downloaded, which 
+                              // have all arrived; NULL for the others
+  BufferPool * piecePool; // Buffers for pieces being downloaded
+  HashPool * hashPool;    // Threads checking the hashes of pieces
+
+  // State of the subchunks of each piece we are downloading, one bit
+  // per subchunk. Subchunk k of piece i is bit i*subChunksPerChunk + k.
+  int subChunksPerChunk;
+  Bitfield * subChunksRequested; // Outstanding at some peer
+  Bitfield * subChunksReceived;  // Arrived and copied into the piece
+  int * chunkOrdering; // Piece numbers sorted in order of 
+                       // prevalence (rarest chunks first).
+  int numPrevalenceChanges; // Number of prevalence counts that have
                             // changed (due to have messages, bitfields,
                             // closed connections) since we last sorted
                             // the chunks by prevalence.
-  // Pointer to the beginning of a memory mapped file that we are downloading.
-  // AKA - a huge array storing all of the downloaded data.
-  char * fileData;
+
+  // Bytes of memory in use for each MEM_* category, and the limit
+  // for each (zero if unlimited). See utils/memory.h.
+  long long memUsed[ MEM_NUM_CATEGORIES ];
+  long long memLimit[ MEM_NUM_CATEGORIES ];
+
+  // Earliest time (ms) at which an outstanding block request could
+  // expire. Nothing needs to be checked before then.
+  unsigned long long nextRequestDeadline;
+  // Set when requests have been given back (timeouts, chokes, closed
+  // connections) so that the main loop can hand them to other peers.
+  int requestsReleased;
+  // Set when a connection closes, as partly downloaded pieces may have
+  // lost their last source. Cleared when a search finds none; see
+  // fillRequests().
+  int sourcesLost;
+  // The file we are downloading into, and serving from
+  Storage * storage;
+  // Whole pieces read from it for uploads, or NULL if there is no
+  // cache. See utils/pieceCache.h.
+  struct pieceCache * cache;
+
+  // Copies finished pieces into the file and flushes them to disk.
+  // Pieces that are written but not known to be on disk are in
+  // unflushed, or in flushing while a flush is under way. See
+  // utils/writeback.h.
+  struct writeback * writeback;
+  Bitfield * unflushed;
+  Bitfield * flushing;
+  unsigned long long lastFlush;
+
+  // State of the check of the existing save file that runs on the
+  // hash pool at startup. See loadPartialResults().
+  HP_Job * resumeJobs;  // One job per piece that may be in flight
+  int numResumeJobs;
+  int resumeNext;       // Next piece to be submitted
+  int resumeChecked;    // How many pieces have been checked?
+  int resumeValid;      // How many of those were already complete?
+  long long resumeBytes; // Bytes hashed so far
+  unsigned long long resumeStart; // Time the check started (ms)
+  unsigned long long resumeLastReport; // Time of last progress report
+
+  // How many pieces did the fast-resume file list when we last saved
+  // it, and when was that? See utils/fastResume.h.
+  int fastResumeSaved;
+  unsigned long long lastFastResume;
+
+  // State of the background check of the pieces we have on disk. See
+  // utils/scrub.h.
+  long long scrubRate;     // Bytes per second, or 0 if it is off
+  long long scrubCredit;   // Bytes the rate lets us read right now
+  unsigned long long scrubLastTick;
+  HP_Job scrubJob;         // The one piece being checked
+  int scrubBusy;           // Is scrubJob on the hash pool?
+  int scrubNext;           // Where to look for the next piece
+  int scrubPasses;         // Full passes over the file so far
+  int scrubBad;            // Bad pieces found so far
+  long long scrubBytes;    // Bytes checked since the last report
+  unsigned long long scrubLastReport;
 
   // Which file pieces do we have?
   Bitfield * ourBitfield;
+  // Every piece set. Shared by all seeds as their haveBlocks, and 
+  // never modified.
+  Bitfield * seedBitfield;
+  // In seed mode, the pieces in ourBitfield that we have assumed we
+  // have without checking them; NULL otherwise. Each is checked when
+  // it is first requested, and requests wait in its pieceRead.
+  Bitfield * unverified;
+  // Pieces being read for requests that wait on them, by piece number
+  // (NULL where there is none), and all of them in a list
+  struct pieceRead ** pieceReads;
+  struct pieceRead * pieceReadList;
+  int numWaitingReads;  // How many are waiting for a buffer?
 
 
   /*
     Information about people connected to us ...
    */
 
-  // Array of peerInfo structs with state for each connection
-  struct peerInfo * peerList;
+  // Slots for peerInfo structs with state for each connection,
+  // allocated PEER_SLAB_SIZE at a time. Slabs never move once 
+  // allocated, so a peerInfo pointer stays valid for as long as the
+  // connection does. Use peerAt() to find a slot by number.
+  struct peerInfo ** peerSlabs;
+  int numPeerSlabs;
 
-  // How many people are in this list?
+  // How many slots are there in total?
   int peerListLen;
 
-  // Pointer to the peerInfo struct of the peer that is currently
-  // optimistically unchoked
-  struct peerInfo * optimisticUnchoke;
+  // First unused slot (-1 if none); the rest are chained through
+  // their nextFree members
+  int freeSlot;
+
+  // Every address that has sent us blocks, with its bad pieces and
+  // whether it is banned. Set bansPending when banning, so that the
+  // main loop disconnects them.
+  struct blameRecord * blame;
+  int numBlame;
+  int blameCapacity;
+  int bansPending;
+
+  // Handle of the peer that is currently optimistically unchoked
+  peerHandle optimisticUnchoke;
 
   // How many times have we executed the choking algorithm?
   // Since we execute it every 10 seconds, but only change
@@ -218,7 +461,9 @@ struct torrentInfo {
 
 /*
   A peerInfo struct stores all of the information and state
-  about somebody connected to us.
+  about somebody connected to us. Fields touched on every pass
+  through the main loop come first, so that sweeps over the peer
+  table stay within the first cache lines of each slot.
  */
 struct peerInfo {
 
@@ -231,8 +476,6 @@ struct peerInfo {
   
   // Connection information
   int socket ;  
-  char ipString[16];
-  unsigned short portNum;
 
   // Boolean state variables
   int peer_choking ;
@@ -240,8 +483,18 @@ struct peerInfo {
   int peer_interested ;
   int am_interested ;
 
+  // How many pieces do they have that we still want? We are
+  // interested in them exactly when this is non-zero.
+  int numWanted;
+  // How many subchunks have we requested from them?
+  int numPendingSubchunks;
+  // How many of their requests wait in pieceReads?
+  int numDeferred;
+
   // What blocks do they have
   Bitfield * haveBlocks ;
+  // What do we want to send them
+  StringStream * outgoingData ;
 
   /*
     Information for receiving from them 
@@ -249,12 +502,16 @@ struct peerInfo {
   int readingHeader; // Are we reading in a message header?
   // How much more data in this message?
   int incomingMessageRemaining ; 
-  // What data have we received ?
-  char * incomingMessageData ;
   // How much data have we received?
   int incomingMessageOffset;
+  // What data have we received ?
+  char * incomingMessageData ;
+  // How large is that buffer?
+  int incomingMessageCapacity;
   // When was the last time we heard from them?
   int lastMessage;
+  // When was the last time we wrote to them ?
+  int lastWrite;
   // How much have we downloaded from them? 
   /*
     Note - technically used to store upload amounts
@@ -265,24 +522,36 @@ struct peerInfo {
   int downloadAmt;
   // Have they been marked to be unchoked soon?
   int willUnchoke;
-  // Are they new? (And thus more likely to be
-  // opportunisitically unchoked?)
-  int firstChokePass;
 
   /*
-    Information for sending to them.
+    Less frequently used state
    */
-  // What do we want to send them
-  StringStream * outgoingData ;
+  char ipString[16];
+  unsigned short portNum;
+  // Their entry in the blame table, or -1 until they send a block
+  int blameRecord;
+  // Are they new? (And thus more likely to be
+  // opportunisitically unchoked?)
+  int firstChokePass;
   // If they're choking us, when was the last time we
   // asked to be unchoked?
   int lastInterestedRequest;
-  // When was the last time we wrote to them ?
-  int lastWrite;
-  // How many subchunks have we requested from them?
-  int numPendingSubchunks;
-  
-
+  // Which subchunks have we requested from them?
+  struct pendingRequest pending[ MAX_PENDING_SUBCHUNKS ];
+  // How long do they take to answer a request? Smoothed latency and
+  // its mean deviation, and the resulting request timeout (ms)
+  int srtt;
+  int rttvar;
+  int rto;
+  int numRttSamples;
+
+  // Where this struct lives in the peer table, and how many
+  // connections have used this slot before (so that stale
+  // peerHandles can be detected)
+  int slot;
+  unsigned int generation;
+  // Next unused slot, while this one is unused
+  int nextFree;
 
 };
 
@@ -1,7 +1,7 @@
 /*
 
   managePeers.c - Function definitions for accepting new connections,
-  destroying connections, and maintaining the peerList in the 
+  destroying connections, and maintaining the peer table in the 
   torrentInfo struct.
 
 */
@@ -21,55 +21,121 @@ void destroyPeer( struct peerInfo * peer, struct torrentInfo * torrent ) {
   }
   logToFile( torrent, "STATUS Destroying connection: %s:%d\n", 
 	     peer->ipString, peer->portNum);
+
+  // Let somebody else serve whatever we were waiting on from them
+  releaseRequests( peer, torrent );
+  // And stop holding their requests for pieces being read
+  dropDeferredRequests( peer, torrent );
     
   // Update chunk prevalence counts for the blocks this 
-  // peer had.
-  int i;
-  int val;
-  for ( i = 0; i < torrent->numChunks; i ++ ) {
-    if ( !Bitfield_Get( peer->haveBlocks, i, &val ) &&
-	 val ) {
-      torrent->chunks[i].prevalence -- ;
-      torrent->numPrevalenceChanges ++ ;
-    }
+  // peer had. Seeds are not counted there, and share their bitfield.
+  if ( peer->haveBlocks != torrent->seedBitfield ) {
+    Bitfield_AddToCounts( peer->haveBlocks, torrent->prevalence, -1 );
+    torrent->numPrevalenceChanges += Bitfield_Count( peer->haveBlocks );
+    memCharge( torrent, MEM_BITFIELDS, - peer->haveBlocks->numBytes );
+    Bitfield_Destroy( peer->haveBlocks );
   }
+  // Pieces only they had can no longer be finished
+  torrent->sourcesLost = 1;
 
 
   close( peer->socket );
-  Bitfield_Destroy( peer->haveBlocks );
-  free( peer->incomingMessageData );
+  memFree( torrent, MEM_RECEIVE, peer->incomingMessageData, 
+	   peer->incomingMessageCapacity );
   SS_Destroy( peer->outgoingData );
   peer->defined = 0;
 
+  // Invalidate any handles to this connection, and let the slot
+  // be reused
+  peer->generation ++;
+  releaseSlot( torrent, peer->slot );
+
   return;
 
 }
 
+/*
+  addPeerSlab - allocate PEER_SLAB_SIZE more peer slots and put them
+  on the free list. Existing slots are not moved.
+ */
+static void addPeerSlab( struct torrentInfo * torrent ) {
 
-int getFreeSlot( struct torrentInfo * torrent ) {
-
-  // Find a suitable slot for this peer
   int i;
-  for ( i = 0; i < torrent->peerListLen; i ++ ) {
-    if ( torrent->peerList[i].defined == 0 ) {
-      return i ;
-    }
-  }
-  torrent->peerList = realloc( torrent->peerList, 
-			       2 * torrent->peerListLen * 
-			       sizeof( struct peerInfo ) );
-  if ( ! torrent->peerList ) {
+
+  torrent->peerSlabs = realloc( torrent->peerSlabs,
+				( torrent->numPeerSlabs + 1 ) * 
+				sizeof( struct peerInfo * ) );
+  if ( ! torrent->peerSlabs ) {
     perror("realloc");
     exit(1);
   }
-  for ( i = torrent->peerListLen; i < torrent->peerListLen*2; i ++ ) {
-    torrent->peerList[i].defined = 0;
+  struct peerInfo * slab = memAlloc( torrent, MEM_METADATA, 
+				     PEER_SLAB_SIZE * sizeof( struct peerInfo ) );
+  torrent->peerSlabs[ torrent->numPeerSlabs ++ ] = slab;
+
+  // Push in reverse, so that the lowest numbered slots are used first
+  for ( i = PEER_SLAB_SIZE - 1; i >= 0; i -- ) {
+    slab[i].defined = 0;
+    slab[i].slot = torrent->peerListLen + i;
+    slab[i].generation = 0;
+    slab[i].nextFree = torrent->freeSlot;
+    torrent->freeSlot = slab[i].slot;
+  }
+  torrent->peerListLen += PEER_SLAB_SIZE;
+
+}
+
+
+struct peerInfo * peerAt( struct torrentInfo * torrent, int slot ) {
+
+  return &torrent->peerSlabs[ slot / PEER_SLAB_SIZE ][ slot % PEER_SLAB_SIZE ];
+
+}
+
+
+int getFreeSlot( struct torrentInfo * torrent ) {
+
+  if ( torrent->freeSlot < 0 ) {
+    addPeerSlab( torrent );
   }
 
-  int retVal = torrent->peerListLen;
-  torrent->peerListLen *= 2;
+  int slot = torrent->freeSlot;
+  torrent->freeSlot = peerAt( torrent, slot )->nextFree;
+  return slot;
+
+}
+
+
+void releaseSlot( struct torrentInfo * torrent, int slot ) {
+
+  struct peerInfo * peer = peerAt( torrent, slot );
+  peer->defined = 0;
+  peer->nextFree = torrent->freeSlot;
+  torrent->freeSlot = slot;
+
+}
+
+
+peerHandle peerHandleOf( struct peerInfo * peer ) {
 
-  return retVal;
+  peerHandle h;
+  h.slot = peer->slot;
+  h.generation = peer->generation;
+  return h;
+
+}
+
+
+struct peerInfo * getPeer( struct torrentInfo * torrent, peerHandle h ) {
+
+  if ( h.slot < 0 || h.slot >= torrent->peerListLen ) {
+    return NULL;
+  }
+  struct peerInfo * peer = peerAt( torrent, h.slot );
+  if ( ! peer->defined || peer->generation != h.generation ) {
+    return NULL;
+  }
+  return peer;
 
 }
 
@@ -84,9 +150,16 @@ void peerConnectedToUs( struct torrentInfo * torrent, int listenFD ) {
     exit(1);
   }
 
+  if ( isBanned( torrent, inet_ntoa( remote_addr.sin_addr ) ) ) {
+    logToFile( torrent, "STATUS Refused connection from banned %s\n",
+	       inet_ntoa( remote_addr.sin_addr ) );
+    close( newfd );
+    return;
+  }
+
   int slotIdx = getFreeSlot( torrent );
 
-  struct peerInfo * this = & torrent->peerList[ slotIdx ] ;
+  struct peerInfo * this = peerAt( torrent, slotIdx ) ;
   this->socket = newfd;
   strncpy( this->ipString, inet_ntoa( remote_addr.sin_addr ), 16 );
   this->portNum = ntohs(remote_addr.sin_port) ;
@@ -136,7 +209,7 @@ int connectToPeer( struct peerInfo * this,
   }
   else {
     // Just get rid of this slot
-    this->defined = 0;
+    releaseSlot( torrent, this->slot );
     close( sock );
     return -1;
   }
@@ -167,25 +240,37 @@ void initializePeer( struct peerInfo * this, struct torrentInfo * torrent ) {
   this->am_choking = 1;
   this->peer_interested = 0;
   this->am_interested = 0;
+  this->numWanted = 0;
   
   this->haveBlocks = Bitfield_Init( torrent->numChunks );
+  memCharge( torrent, MEM_BITFIELDS, this->haveBlocks->numBytes );
   
   this->readingHeader = 1;
   this->incomingMessageRemaining = 68; // Length
   this->incomingMessageOffset = 0;
   // First message we expect is a handshake, which is 68 bytes
-  this->incomingMessageData = Malloc( 68 ); 
+  this->incomingMessageData = memAlloc( torrent, MEM_RECEIVE, 68 ); 
+  this->incomingMessageCapacity = 68;
   
   this->outgoingData = SS_Init();
+  SS_SetAccounting( this->outgoingData, &torrent->memUsed[ MEM_OUTGOING ] );
 
   this->lastInterestedRequest = 0;
   this->lastWrite = 0;
   this->lastMessage = 0;
 
   this->numPendingSubchunks = 0;
+  this->numDeferred = 0;
+
+  // We know nothing about their latency yet
+  this->srtt = 0;
+  this->rttvar = 0;
+  this->rto = INITIAL_REQUEST_TIMEOUT_MS;
+  this->numRttSamples = 0;
 
   this->downloadAmt = 0;
   this->willUnchoke = 0;
+  this->blameRecord = -1;
   this->firstChokePass = 1;
 
   // Slot is taken
@@ -4,13 +4,17 @@
 /*
 
   managePeers.h - Function declarations for accepting new connections,
-  destroying connections, and maintaining the peerList in the 
+  destroying connections, and maintaining the peer table in the 
   torrentInfo struct.
 
 */
 
 #include "common.h"
 #include "utils/base.h"
+#include "utils/requests.h"
+#include "utils/memory.h"
+#include "utils/blame.h"
+#include "messages/incomingMessages.h"
 
 /*
   destroyPeer - close down our connection and clean up any associated state
@@ -27,18 +31,70 @@
 void destroyPeer( struct peerInfo * peer, struct torrentInfo * torrent ) ;
 
 /*
-  getFreeSlot - find an unused slot in the peerList for our torrent,
-  expanding the list if it is full.
+  getFreeSlot - take an unused slot from the peer table for our 
+  torrent, adding another slab of slots if there are none left. The
+  slot must either be initialized with initializePeer() or given back
+  with releaseSlot().
 
   Parameters:
   => torrent - the torrentInfo struct for our current download.
 
   Returns:
-  => Index into the peerList array that we should use for this peer
+  => Slot number in the peer table that we should use for this peer
   
  */
 int getFreeSlot( struct torrentInfo * torrent ) ;
 
+/*
+  releaseSlot - return an unused slot to the peer table's free list.
+
+  Parameters:
+  => torrent - the torrentInfo struct for our current download.
+  => slot - slot number, as returned by getFreeSlot()
+
+  Returns:
+  Nothing.
+ */
+void releaseSlot( struct torrentInfo * torrent, int slot ) ;
+
+/*
+  peerAt - find a slot in the peer table by number. The slot may be 
+  unused; check its defined member.
+
+  Parameters:
+  => torrent - the torrentInfo struct for our current download.
+  => slot - slot number, from 0 to torrent->peerListLen - 1
+
+  Returns:
+  => Pointer to the peerInfo struct in that slot
+ */
+struct peerInfo * peerAt( struct torrentInfo * torrent, int slot ) ;
+
+/*
+  peerHandleOf - make a handle for a connection, which can be kept
+  after the connection might have been destroyed.
+
+  Parameters:
+  => peer - peerInfo struct for the connection
+
+  Returns:
+  => Handle for the connection
+ */
+peerHandle peerHandleOf( struct peerInfo * peer ) ;
+
+/*
+  getPeer - find the connection a handle refers to.
+
+  Parameters:
+  => torrent - the torrentInfo struct for our current download.
+  => h - handle returned by peerHandleOf()
+
+  Returns:
+  => Pointer to the peerInfo struct, or NULL if the connection has 
+  been destroyed since the handle was made.
+ */
+struct peerInfo * getPeer( struct torrentInfo * torrent, peerHandle h ) ;
+
 /*
   peerConnectedToUs - called when somebody has initiated a connection
   with us; initializes the data structures for their connection and
@@ -6,7 +6,29 @@
 */
 
 #include "incomingMessages.h"
+#include "../startup.h"
+
+/*
+  useSeedBitfield - replace the bitfield of a peer that has every piece
+  with the shared seed bitfield. Seeds are left out of the prevalence
+  counts, so if theirs were included, take them back out.
+ */
+static void useSeedBitfield( struct peerInfo * this, 
+			     struct torrentInfo * torrent,
+			     int countedPrevalence ) {
+
+  if ( this->haveBlocks == torrent->seedBitfield ) {
+    return;
+  }
+  if ( countedPrevalence ) {
+    // Every piece drops by one, so the rarest-first order still holds
+    Bitfield_AddToCounts( torrent->seedBitfield, torrent->prevalence, -1 );
+  }
+  memCharge( torrent, MEM_BITFIELDS, - this->haveBlocks->numBytes );
+  Bitfield_Destroy( this->haveBlocks );
+  this->haveBlocks = torrent->seedBitfield;
 
+}
 
 
 int handleHaveMessage( struct peerInfo * this, struct torrentInfo * torrent ) {
@@ -17,13 +39,25 @@ int handleHaveMessage( struct peerInfo * this, struct torrentInfo * torrent ) {
   blockNum = ntohl( blockNum );
   logToFile(torrent, "MESSAGE HAVE %u FROM %s:%d \n", 
 	    blockNum, this->ipString, this->portNum );
-  int ret = Bitfield_Set( this->haveBlocks, blockNum );
-
-  torrent->chunks[ blockNum ].prevalence ++;
-  torrent->numPrevalenceChanges ++;
+  int hadBefore;
+  if ( Bitfield_Get( this->haveBlocks, blockNum, &hadBefore ) ) {
+    return -1; // Out of range
+  }
+  int ret = 0;
+
+  if ( ! hadBefore ) {
+    ret = Bitfield_Set( this->haveBlocks, blockNum );
+    torrent->prevalence[ blockNum ] ++;
+    torrent->numPrevalenceChanges ++;
+    if ( ! Bitfield_IsSet( torrent->ourBitfield, blockNum ) ) {
+      this->numWanted ++;
+      updateInterest( this, torrent );
+    }
+  }
 
   // If they are now finished, we should classify them as a seeder
   if ( Bitfield_AllSet( this->haveBlocks) ) {
+    useSeedBitfield( this, torrent, 1 );
     if ( this->type == BT_UNKNOWN ) {
       torrent->numUnknown --;
       torrent->numSeeds ++;
@@ -93,17 +127,25 @@ int handleBitfieldMessage( struct peerInfo * this,
     }
   }
 
-  // Update chunk prevalence counts for these blocks
-  int i;
-  int val;
-  for ( i = 0; i < torrent->numChunks; i ++ ) {
-    if ( !Bitfield_Get( this->haveBlocks, i, &val ) &&
-	 val ) {
-      torrent->chunks[i].prevalence ++;
-      torrent->numPrevalenceChanges ++;
-    }
+  // Seeds have every piece we still want, and are not counted in
+  // the prevalence counts
+  if ( this->type == BT_SEED ) {
+    useSeedBitfield( this, torrent, 0 );
+    this->numWanted = 
+      Bitfield_CountAndNot( this->haveBlocks, torrent->ourBitfield );
+    updateInterest( this, torrent );
+    return ret;
   }
 
+  // Update chunk prevalence counts for these blocks, and count how
+  // many of them we still want. Every piece they have is a change
+  // towards the next re-sort, as if each had come in a HAVE.
+  Bitfield_AddToCounts( this->haveBlocks, torrent->prevalence, 1 );
+  torrent->numPrevalenceChanges += Bitfield_Count( this->haveBlocks );
+  this->numWanted = 
+    Bitfield_CountAndNot( this->haveBlocks, torrent->ourBitfield );
+  updateInterest( this, torrent );
+
 
 
   return ret;
@@ -111,6 +153,357 @@ int handleBitfieldMessage( struct peerInfo * this,
 }
 
 
+/*
+  sendBlock - queue a PIECE message carrying a block of a piece.
+ */
+static void sendBlock( struct peerInfo * this, struct torrentInfo * torrent,
+		       int idx, int begin, int len, char * data ) {
+
+  char header[ 13 ];
+  int respLen = 9 + len;
+  int nrespLen = htonl( respLen );
+  memcpy( &header[0], &nrespLen, 4 );
+  char id = 7;
+  memcpy( &header[4], &id, 1 );
+  int nIdx = htonl( idx );
+  int nBegin = htonl( begin );
+  memcpy( &header[5], &nIdx, 4 );
+  memcpy( &header[9], &nBegin, 4 );
+  SS_Push( this->outgoingData, header, 13 );
+  SS_Push( this->outgoingData, data, len );
+  torrent->numBytesUploaded += len;
+
+  // If the torrent is finished, then we use our own upload
+  // speed for choking purposes instead of our download speed
+  // from them
+  if ( torrent->completed ) {
+    this->downloadAmt += len ;
+  }
+
+}
+
+/*
+  refuseRequest - turn down a request that we have no room for.
+  Choking them tells them that their requests are dropped; they ask
+  again once the choke algorithm unchokes them.
+ */
+static void refuseRequest( struct peerInfo * this, 
+			   struct torrentInfo * torrent, const char * why ) {
+
+  logToFile( torrent, "WARNING Refusing request from %s:%d, %s\n",
+	     this->ipString, this->portNum, why );
+  if ( this->type == BT_PEER && ! this->am_choking ) {
+    this->am_choking = 1;
+    sendChoke( this, torrent );
+  }
+
+}
+
+/*
+  submitPieceRead - hand a piece read to the hash pool. With a piece
+  cache, the piece is read into a slot of it. Otherwise, unless the
+  file is mapped, it needs a buffer from the piece pool to read into,
+  so that reads for requests stay within the memory budget. If there
+  is no slot or buffer free, it waits.
+
+  Returns: 1 if it was submitted, or 0 if it is still waiting.
+ */
+static int submitPieceRead( struct torrentInfo * torrent, 
+			    struct pieceRead * pr ) {
+
+  int idx = pr->job.tag;
+
+  if ( torrent->cache ) {
+    if ( ! ( pr->buffer = claimCacheSlot( torrent, idx ) ) ) {
+      return 0;
+    }
+    pr->cached = 1;
+  }
+  else if ( ! torrent->storage->map ) {
+    if ( ! ( pr->buffer = BP_Acquire( torrent->piecePool ) ) ) {
+      return 0;
+    }
+  }
+  if ( torrent->unverified && Bitfield_IsSet( torrent->unverified, idx ) ) {
+    logToFile( torrent, "STATUS Checking piece %d before serving it\n", 
+	       idx );
+  }
+  else {
+    logToFile( torrent, "STATUS Reading piece %d into the cache\n", idx );
+  }
+  readPieceJob( torrent, &pr->job, idx, pr->buffer );
+  pr->job.arg = torrent->pieceReads; // Tells collectVerifiedPieces
+  pr->submitted = 1;
+  HP_Submit( torrent->hashPool, &pr->job );
+  return 1;
+
+}
+
+/*
+  startPieceRead - start reading and checking a piece on the hash
+  pool, for requests to wait on, as soon as there is a buffer for it.
+ */
+static struct pieceRead * startPieceRead( struct torrentInfo * torrent, 
+					  int idx ) {
+
+  struct pieceRead * pr = memAlloc( torrent, MEM_METADATA, 
+				    sizeof( struct pieceRead ) );
+  pr->job.tag = idx;
+  pr->submitted = 0;
+  pr->buffer = NULL;
+  pr->cached = 0;
+  pr->requests = NULL;
+  pr->prev = NULL;
+  pr->next = torrent->pieceReadList;
+  if ( pr->next ) {
+    pr->next->prev = pr;
+  }
+  torrent->pieceReadList = pr;
+  torrent->pieceReads[idx] = pr;
+
+  if ( ! submitPieceRead( torrent, pr ) ) {
+    logToFile( torrent, "STATUS Piece %d waits for a buffer to be "
+	       "read into\n", idx );
+    torrent->numWaitingReads ++;
+  }
+  return pr;
+
+}
+
+/*
+  endPieceRead - free a finished piece read, and whatever is still
+  waiting on it.
+ */
+static void endPieceRead( struct torrentInfo * torrent, 
+			  struct pieceRead * pr ) {
+
+  struct deferredRequest * r;
+
+  while ( ( r = pr->requests ) ) {
+    pr->requests = r->next;
+    memFree( torrent, MEM_METADATA, r, sizeof( struct deferredRequest ) );
+  }
+  if ( pr->buffer && pr->cached ) {
+    finishCacheFill( torrent, pr->buffer, 0 );
+  }
+  else if ( pr->buffer ) {
+    BP_Release( torrent->piecePool, pr->buffer );
+  }
+  if ( ! pr->submitted ) {
+    torrent->numWaitingReads --;
+  }
+  if ( pr->prev ) {
+    pr->prev->next = pr->next;
+  }
+  else {
+    torrent->pieceReadList = pr->next;
+  }
+  if ( pr->next ) {
+    pr->next->prev = pr->prev;
+  }
+  torrent->pieceReads[ pr->job.tag ] = NULL;
+  memFree( torrent, MEM_METADATA, pr, sizeof( struct pieceRead ) );
+
+}
+
+/*
+  deferRequest - hold on to a request for a piece that we have not
+  checked yet, and start checking it if nobody else has asked for it.
+ */
+static void deferRequest( struct peerInfo * this, 
+			  struct torrentInfo * torrent,
+			  int idx, int begin, int len ) {
+
+  struct pieceRead * pr = torrent->pieceReads[idx];
+  struct deferredRequest * r;
+
+  if ( this->numDeferred >= MAX_DEFERRED_REQUESTS ) {
+    refuseRequest( this, torrent, "too many requests waiting" );
+    return;
+  }
+  if ( ! pr ) {
+    pr = startPieceRead( torrent, idx );
+  }
+
+  r = memAlloc( torrent, MEM_METADATA, sizeof( struct deferredRequest ) );
+  r->peer = peerHandleOf( this );
+  r->piece = idx;
+  r->begin = begin;
+  r->length = len;
+  r->next = pr->requests;
+  pr->requests = r;
+  this->numDeferred ++;
+
+}
+
+/*
+  dropDeferred - forget a peer's requests waiting on a piece read:
+  all of them, or only those for one block if begin is not negative.
+ */
+static void dropDeferred( struct torrentInfo * torrent, 
+			  struct pieceRead * pr, struct peerInfo * p,
+			  int begin, int len ) {
+
+  struct deferredRequest ** prev = &pr->requests;
+  struct deferredRequest * r;
+
+  while ( ( r = *prev ) ) {
+    if ( r->peer.slot != p->slot || r->peer.generation != p->generation ||
+	 ( begin >= 0 && ( r->begin != begin || r->length != len ) ) ) {
+      prev = &r->next;
+      continue;
+    }
+    *prev = r->next;
+    p->numDeferred --;
+    memFree( torrent, MEM_METADATA, r, sizeof( struct deferredRequest ) );
+  }
+
+}
+
+/*
+  pieceReadDone - act on the hash of a piece read for the requests
+  waiting on it. If it is good, answer them from what was read, and
+  keep it in the cache if it was read into it. If not, stop claiming
+  to have it, and download it instead.
+ */
+static void pieceReadDone( struct torrentInfo * torrent, HP_Job * job ) {
+
+  struct pieceRead * pr = (struct pieceRead *) job;
+  int idx = job->tag;
+  int valid = ! memcmp( job->digest, &torrent->chunkHashes[ 20 * idx ], 20 );
+  int assumed = torrent->unverified && 
+    Bitfield_IsSet( torrent->unverified, idx );
+  struct deferredRequest * r;
+
+  if ( assumed ) {
+    Bitfield_Clear( torrent->unverified, idx );
+  }
+  if ( pr->cached ) {
+    // The data stays where it is until the slot is next claimed
+    finishCacheFill( torrent, pr->buffer, valid );
+    pr->buffer = NULL;
+  }
+  if ( valid ) {
+    logToFile( torrent, "STATUS Piece %d checked\n", idx );
+  }
+  else if ( assumed ) {
+    logToFile( torrent, "WARNING Invalid SHA1 Hash for block %d, which we"
+	       " assumed we had. Downloading it.\n", idx );
+    forgetPiece( torrent, idx );
+  }
+  else if ( Bitfield_IsSet( torrent->ourBitfield, idx ) ) {
+    printf( "Piece %d of the save file is corrupt; downloading it again\n",
+	    idx );
+    logToFile( torrent, "WARNING Invalid SHA1 Hash for block %d, read to "
+	       "serve it. Downloading it again.\n", idx );
+    forgetPiece( torrent, idx );
+    // A restart must not trust the piece either
+    saveFastResume( torrent );
+  }
+
+  while ( ( r = pr->requests ) ) {
+    pr->requests = r->next;
+    // Peers that have gone or been choked since asking are skipped, 
+    // as they would have been had the piece been checked already
+    struct peerInfo * p = getPeer( torrent, r->peer );
+    if ( p ) {
+      p->numDeferred --;
+    }
+    if ( valid && p && ! ( p->type == BT_PEER && p->am_choking ) &&
+	 Bitfield_IsSet( torrent->ourBitfield, idx ) ) {
+      if ( memOverLimit( torrent, MEM_OUTGOING ) ) {
+	refuseRequest( p, torrent, "upload queues full" );
+      }
+      else {
+	sendBlock( p, torrent, idx, r->begin, r->length, 
+		   job->data + r->begin );
+      }
+    }
+    memFree( torrent, MEM_METADATA, r, sizeof( struct deferredRequest ) );
+  }
+  endPieceRead( torrent, pr );
+
+}
+
+void startWaitingReads( struct torrentInfo * t ) {
+
+  struct pieceRead * pr;
+
+  for ( pr = t->pieceReadList; pr && t->numWaitingReads > 0; 
+	pr = pr->next ) {
+    if ( ! pr->submitted ) {
+      if ( ! submitPieceRead( t, pr ) ) {
+	return; // Nor will there be a buffer for the rest
+      }
+      t->numWaitingReads --;
+    }
+  }
+
+}
+
+void dropDeferredRequests( struct peerInfo * p, struct torrentInfo * t ) {
+
+  struct pieceRead * pr;
+
+  for ( pr = t->pieceReadList; pr && p->numDeferred > 0; pr = pr->next ) {
+    dropDeferred( t, pr, p, -1, 0 );
+  }
+
+}
+
+void freePieceReads( struct torrentInfo * t ) {
+
+  while ( t->pieceReadList ) {
+    endPieceRead( t, t->pieceReadList );
+  }
+  memFree( t, MEM_METADATA, t->pieceReads, 
+	   t->numChunks * sizeof( struct pieceRead * ) );
+
+}
+
+/*
+  queueBlock - queue a PIECE message answering a request, with the
+  data straight out of the piece's buffer, or out of the piece cache
+  if there is one, or otherwise from the mapped file or read from it.
+  A request for a piece that is not in the cache waits for the piece
+  to be read into it on the hash pool, so that the main loop never
+  waits on the disk for it.
+ */
+static void queueBlock( struct peerInfo * this, struct torrentInfo * torrent,
+			int idx, int begin, int len ) {
+
+  long long offset = (long long) idx * torrent->chunkSize + begin;
+  char * data, * readBuf = NULL;
+  if ( torrent->chunkData[idx] ) {
+    data = torrent->chunkData[idx] + begin;
+  }
+  else if ( torrent->cache ) {
+    if ( ! ( data = cachedBlock( torrent, idx, begin, len ) ) ) {
+      deferRequest( this, torrent, idx, begin, len );
+      return;
+    }
+  }
+  else if ( torrent->storage->map ) {
+    data = torrent->storage->map + offset;
+  }
+  else {
+    // Without a cache or a mapping, each block is a small read on the
+    // main loop. That is the price of -C 0 with the pread and direct
+    // backends, for when no memory can be spared for whole pieces.
+    data = readBuf = Malloc( len );
+    if ( Storage_Read( torrent->storage, readBuf, offset, len ) ) {
+      logToFile( torrent, "WARNING Error reading block %d.%d: %s\n",
+		 idx, begin, strerror( errno ) );
+      free( readBuf );
+      return;
+    }
+  }
+
+  sendBlock( this, torrent, idx, begin, len, data );
+  free( readBuf );
+
+}
+
 int handleRequestMessage( struct peerInfo * this, 
 			  struct torrentInfo * torrent ) {
 
@@ -126,6 +519,12 @@ int handleRequestMessage( struct peerInfo * this,
   logToFile( torrent, "MESSAGE REQUEST BLOCK %d FROM %s:%d\n", 
 	     idx, this->ipString, this->portNum );
 
+  // Don't queue any more uploads while the queues are full
+  if ( memOverLimit( torrent, MEM_OUTGOING ) ) {
+    refuseRequest( this, torrent, "upload queues full" );
+    return 0;
+  }
+
   // If this is a peer and they are choked, then don't respond
   if( this->type == BT_PEER && this->am_choking ) {
     logToFile(torrent, 
@@ -135,44 +534,94 @@ int handleRequestMessage( struct peerInfo * this,
   }
 
 
-  if ( ! torrent->chunks[idx].have ) {
+  if ( idx < 0 || idx >= torrent->numChunks ) {
     logToFile( torrent, 
 	       "WARNING Request ffrom %s:%d for chunk %d, which I don't have.\n", 
 	       this->ipString, this->portNum, idx );
     return -1;
   }
 
-  // Check that the chunk is as large as the request says
-  if ( begin + len > torrent->chunks[idx].size ) {
+  // Check that the block lies within the chunk before anything looks
+  // at it: blocks are served from buffers as long as a piece, and
+  // copied into buffers as long as the block
+  if ( begin < 0 || len <= 0 || len > MAX_REQUEST_SIZE ||
+       begin > chunkLength( torrent, idx ) - len ) {
     logToFile(torrent, 
-	      "WARNING Request from %s:%d for chunk %d.%d-%d,"
+	      "WARNING Request from %s:%d for chunk %d.%d (%d bytes),"
 	      "is out of bounds.\n",
-	      this->ipString, this->portNum, idx, begin, begin + len );
+	      this->ipString, this->portNum, idx, begin, len );
     return -1;
   }
 
-  char header[ 13 ];
-  int respLen = 9 + len;
-  int nrespLen = htonl( respLen );
-  memcpy( &header[0], &nrespLen, 4 );
-  char id = 7;
-  memcpy( &header[4], &id, 1 );
-  memcpy( &header[5], &this->incomingMessageData[5], 8 );
-  SS_Push( this->outgoingData, header, 13 );
-  SS_Push( this->outgoingData, torrent->chunks[idx].data + begin, len );
-  torrent->numBytesUploaded += len;
+  // We may have told them we have a piece that has since failed a
+  // check (see forgetPiece), so this is not their fault. They will
+  // ask somebody else once the request times out.
+  if ( ! Bitfield_IsSet( torrent->ourBitfield, idx ) ) {
+    logToFile( torrent, 
+	       "WARNING Request from %s:%d for chunk %d, which I no longer "
+	       "have.\n", this->ipString, this->portNum, idx );
+    return 0;
+  }
 
-  // If the torrent is finished, then we use our own upload
-  // speed for choking purposes instead of our download speed
-  // from them
-  if ( torrent->completed ) {
-    this->downloadAmt += len ;
+  // In seed mode, a piece is checked before we first serve it
+  if ( torrent->unverified && Bitfield_IsSet( torrent->unverified, idx ) ) {
+    deferRequest( this, torrent, idx, begin, len );
+    return 0;
   }
 
+  queueBlock( this, torrent, idx, begin, len );
+
+  return 0;
+}
+
+int handleCancelMessage( struct peerInfo * this, 
+			 struct torrentInfo * torrent ) {
+
+  int idx, begin, len;
+  memcpy( &idx,   &this->incomingMessageData[5],  4 );
+  memcpy( &begin, &this->incomingMessageData[9],  4 );
+  memcpy( &len,   &this->incomingMessageData[13], 4 );
+  idx   = ntohl(  idx  );
+  begin = ntohl( begin );
+  len   = ntohl(  len  );
+
+  logToFile( torrent, "MESSAGE CANCEL BLOCK %d FROM %s:%d\n", 
+	     idx, this->ipString, this->portNum );
+
+  if ( idx < 0 || idx >= torrent->numChunks ) {
+    return -1;
+  }
+  // Requests already queued are sent anyway; only those still
+  // waiting for their piece can be dropped
+  if ( torrent->pieceReads[idx] && begin >= 0 ) {
+    dropDeferred( torrent, torrent->pieceReads[idx], this, begin, len );
+  }
   return 0;
+
 }
 
 
+/*
+  absorbReceivedBlocks - feed the blocks at the start of a piece that
+  have all arrived, and have not been hashed yet, into the piece's 
+  running SHA1 while they are still in cache.
+ */
+static void absorbReceivedBlocks( struct torrentInfo * torrent, int idx ) {
+
+  Sha1_Ctx * ctx = torrent->chunkHashState[idx];
+  int k = ctx->length / SUBCHUNK_SIZE;
+  int n = numSubChunks( torrent, idx );
+
+  while ( k < n && 
+	  Bitfield_IsSet( torrent->subChunksReceived, 
+			  subChunkIndex( torrent, idx, k ) ) ) {
+    Sha1_Update( ctx, &torrent->chunkData[idx][ k * SUBCHUNK_SIZE ],
+		 subChunkLength( torrent, idx, k ) );
+    k ++;
+  }
+
+}
+
 void handlePieceMessage( struct peerInfo * this, 
 			 struct torrentInfo * torrent ) {
 
@@ -190,7 +639,17 @@ void handlePieceMessage( struct peerInfo * this,
 
   int dataLen = messageLen - 9;
 
-  this->numPendingSubchunks --;
+  if ( idx < 0 || idx >= torrent->numChunks || offset < 0 ||
+       offset >= chunkLength( torrent, idx ) ) {
+    logToFile( torrent, 
+	       "WARNING Invalid Block Message %d.%d FROM %s:%d\n",
+	       idx, offset, this->ipString, this->portNum );
+    return ;
+  }
+
+  // This request has been answered
+  int k = offset / SUBCHUNK_SIZE;
+  completeRequest( this, idx, k );
 
 
   logToFile(torrent, "MESSAGE PIECE %d.%d-%d FROM %s:%d\n", 
@@ -202,7 +661,7 @@ void handlePieceMessage( struct peerInfo * this,
   torrent->numBytesDownloaded += dataLen ;
   this->downloadAmt += dataLen ;
   // This chunk is already finished. No need to continue.
-  if ( torrent->chunks[ idx ].have ) {
+  if ( Bitfield_IsSet( torrent->ourBitfield, idx ) ) {
     logToFile( torrent, 
 	       "WARNING Duplicate Block Message %d.%d-%d FROM %s:%d\n",
 	       idx, offset, offset+messageLen, 
@@ -210,83 +669,180 @@ void handlePieceMessage( struct peerInfo * this,
     return ;
   }
 
-  // Find the subchunk that we have just received
-  struct subChunk sc = torrent->chunks[idx].subChunks[ offset / (1 << 14) ];
+  // Nowhere to put a block of a piece we haven't started
+  if ( ! torrent->chunkData[idx] ) {
+    logToFile( torrent, 
+	       "WARNING Unrequested Block Message %d.%d-%d FROM %s:%d\n",
+	       idx, offset, offset+messageLen, 
+	       this->ipString, this->portNum );
+    return ;
+  }
 
   // Check that we didn't get the chunk from somewhere else in the mean
   // time
-  if ( ! torrent->chunks[idx].subChunks[ offset / (1 << 14) ].have ) {
-    // Check that this is the right subchunk
-    if ( sc.start == offset && sc.len == dataLen ) {
-      torrent->chunks[idx].subChunks[ offset / (1 << 14) ].have = 1;
-    }
-    
-    memcpy( & torrent->chunks[idx].data[ offset ], 
-	    & this->incomingMessageData[13], 
-	    dataLen );
-  } 
-  else {
+  if ( Bitfield_IsSet( torrent->subChunksReceived, 
+		       subChunkIndex( torrent, idx, k ) ) ) {
     logToFile( torrent, 
 	       "WARNING Duplicate Block Message %d.%d-%d FROM %s:%d\n",
 	       idx, offset, offset+messageLen, 
 	       this->ipString, this->portNum );
+    return ;
+  }
+
+  // Check that this is the right subchunk, so that we never write
+  // past the end of the piece buffer
+  if ( k * SUBCHUNK_SIZE != offset || 
+       subChunkLength( torrent, idx, k ) != dataLen ) {
+    return ;
+  }
+  Bitfield_Set( torrent->subChunksReceived, 
+		subChunkIndex( torrent, idx, k ) );
+  torrent->numSubChunksReceived[idx] ++;
+  memcpy( & torrent->chunkData[idx][ offset ], 
+	  & this->incomingMessageData[13], 
+	  dataLen );
+  recordBlockSource( torrent, this, idx, k );
+
+  // If this block extends the run at the start of the piece, hash
+  // the run now
+  if ( ! torrent->chunkHashState[idx] ) {
+    torrent->chunkHashState[idx] = Malloc( sizeof( Sha1_Ctx ) );
+    Sha1_Begin( torrent->chunkHashState[idx] );
+  }
+  if ( torrent->chunkHashState[idx]->length == k * SUBCHUNK_SIZE ) {
+    absorbReceivedBlocks( torrent, idx );
   }
 
   // Are we done downloading this chunk?
-  int i;
-  for ( i = 0; i < torrent->chunks[idx].numSubChunks; i ++ ) {
-    if ( torrent->chunks[idx].subChunks[i].have == 0 ) {
-      return ;
-    }
+  if ( torrent->numSubChunksReceived[idx] < numSubChunks( torrent, idx ) ) {
+    return ;
   }
 
-  // If we get here, then we have all of the subchunks
-  // Check the SHA1 hash of the block and if its good, 
-  // then broadcast a HAVE message to all our peers.
-  unsigned char * hash = computeSHA1( torrent->chunks[idx].data, 
-				      torrent->chunks[idx].size );
-  if ( memcmp( hash, torrent->chunks[idx].hash, 20 ) ) {
-    free( hash );
+  // If we get here, then we have all of the subchunks. If they came in
+  // order, they have all been hashed, and we can check the piece now.
+  Sha1_Ctx * ctx = torrent->chunkHashState[idx];
+  if ( ctx->length == chunkLength( torrent, idx ) ) {
+    HP_Job job;
+    job.tag = idx;
+    Sha1_Finish( ctx, job.digest );
+    pieceVerified( torrent, &job );
+    return ;
+  }
+
+  // Otherwise, hand the rest of the piece to the hash pool;
+  // collectVerifiedPieces() picks up the result.
+  HP_Job * job = Malloc( sizeof( HP_Job ) );
+  job->data = torrent->chunkData[idx] + ctx->length;
+  job->length = chunkLength( torrent, idx ) - ctx->length;
+  job->ctx = ctx;
+  job->load = NULL;
+  job->tag = idx;
+  job->arg = NULL;
+  HP_Submit( torrent->hashPool, job );
+
+  return ;
+}
+
+
+void pieceVerified( struct torrentInfo * torrent, HP_Job * job ) {
+
+  int k;
+  int idx = job->tag;
+
+  // The running hash is finished with, whatever the result
+  free( torrent->chunkHashState[idx] );
+  torrent->chunkHashState[idx] = NULL;
+
+  // If the hash is good, then broadcast a HAVE message to all our 
+  // peers; otherwise start the piece again.
+  if ( memcmp( job->digest, &torrent->chunkHashes[ 20 * idx ], 20 ) ) {
     logToFile( torrent, 
-	       "WARNING Invalid SHA1 Hash for block %d from %s:%d.\n", 
-	       idx, this->ipString, this->portNum);
-    for ( i = 0; i < torrent->chunks[idx].numSubChunks; i ++ ) {
-      torrent->chunks[idx].subChunks[i].have = 0;
+	       "WARNING Invalid SHA1 Hash for block %d.\n", idx );
+    blameFailedPiece( torrent, idx );
+    for ( k = 0; k < numSubChunks( torrent, idx ); k ++ ) {
+      Bitfield_Clear( torrent->subChunksReceived, 
+		      subChunkIndex( torrent, idx, k ) );
+      Bitfield_Clear( torrent->subChunksRequested, 
+		      subChunkIndex( torrent, idx, k ) );
     }
+    torrent->numSubChunksReceived[idx] = 0;
+    // Give the buffer back until we start over
+    BP_Release( torrent->piecePool, torrent->chunkData[idx] );
+    torrent->chunkData[idx] = NULL;
+    // And let the main loop hand the blocks out again
+    torrent->requestsReleased = 1;
   } 
   else {
-    free( hash );
     printf("Finished downloading block %d.\n", idx);
     logToFile( torrent, "STATUS Finished downloading block %d.\n", idx);
-    torrent->chunks[idx].have = 1;
-    broadcastHaveMessage( torrent, idx );
     Bitfield_Set( torrent->ourBitfield, idx );
+    broadcastHaveMessage( torrent, idx );
+    pieceAcquired( torrent, idx );
+    blameGoodPiece( torrent, idx );
 
 
-    // Copy the data to a file, reset our data pointer, and clean up
-    // any other state
-    memmove( &torrent->fileData[ idx * torrent->chunkSize ], 
-	     torrent->chunks[idx].data, torrent->chunks[idx].size );
-    msync( &torrent->fileData[ idx * torrent->chunkSize ], 
-	   torrent->chunks[idx].size, MS_SYNC );
-
-    free( torrent->chunks[idx].subChunks );
-    free( torrent->chunks[idx].data );
-    torrent->chunks[idx].data = &torrent->fileData[ idx * torrent->chunkSize ];
+    // Have the data copied to the file. Until it is, requests for
+    // the piece are served from its buffer.
+    writePiece( torrent, idx );
   
     // Are we done downloading the entire torrent?
-    int j;
-    for ( j = 0; j < torrent->numChunks; j ++ ) {
-      if ( ! torrent->chunks[j].have ) {
-	return ;
-      }
+    if ( Bitfield_AllSet( torrent->ourBitfield ) ) {
+      doTrackerCommunication( torrent, TRACKER_COMPLETED );
+      torrent->completed = 1;
     }
-    // Yes, we are!
-    doTrackerCommunication( torrent, TRACKER_COMPLETED );
-    torrent->completed = 1;
   }
 
-  return ;
+}
+
+
+void forgetPiece( struct torrentInfo * torrent, int idx ) {
+
+  int k;
+
+  // Every block must be asked for again, as when a hash fails
+  for ( k = 0; k < numSubChunks( torrent, idx ); k ++ ) {
+    Bitfield_Clear( torrent->subChunksReceived, 
+		    subChunkIndex( torrent, idx, k ) );
+    Bitfield_Clear( torrent->subChunksRequested, 
+		    subChunkIndex( torrent, idx, k ) );
+  }
+  torrent->numSubChunksReceived[idx] = 0;
+  Bitfield_Clear( torrent->chunksRequested, idx );
+  Bitfield_Clear( torrent->ourBitfield, idx );
+  torrent->chunkData[idx] = NULL;
+  dropCachedPiece( torrent, idx );
+  torrent->numBytesDownloaded -= chunkLength( torrent, idx );
+  torrent->completed = 0;
+  pieceLost( torrent, idx );
+  torrent->requestsReleased = 1;
+
+}
+
+
+void collectVerifiedPieces( struct torrentInfo * torrent ) {
+
+  HP_Job * job = HP_Completed( torrent->hashPool );
+  while ( job ) {
+    HP_Job * next = job->next;
+    if ( job->arg == torrent ) {
+      // Part of the check of the save file, which reuses its jobs
+      resumePieceVerified( torrent, job );
+    }
+    else if ( job == &torrent->scrubJob ) {
+      // A background check of a piece we have
+      scrubPieceVerified( torrent, job );
+    }
+    else if ( job->arg == torrent->pieceReads ) {
+      // A piece read for the requests waiting on it
+      pieceReadDone( torrent, job );
+    }
+    else {
+      pieceVerified( torrent, job );
+      free( job );
+    }
+    job = next;
+  }
+
 }
 
 
@@ -345,8 +901,10 @@ void handleFullMessage( struct peerInfo * this,
     this->status = BT_AWAIT_BITFIELD;
     
     // Set us up to get the bitfield
-    free( this->incomingMessageData );
-    this->incomingMessageData = Malloc( 4 );
+    memFree( torrent, MEM_RECEIVE, this->incomingMessageData, 
+	     this->incomingMessageCapacity );
+    this->incomingMessageData = memAlloc( torrent, MEM_RECEIVE, 4 );
+    this->incomingMessageCapacity = 4;
     this->incomingMessageOffset = 0;
     this->incomingMessageRemaining = 4;
 
@@ -368,8 +926,21 @@ void handleFullMessage( struct peerInfo * this,
       this->readingHeader = 1 ;
       this->status = BT_RUNNING;
     }
+    else if ( len < 0 || len > maxMessageLength( torrent ) ) {
+      // Nothing valid is this long; don't give it a buffer
+      logToFile( torrent, 
+		 "WARNING Message of %d bytes from %s:%d is too long\n",
+		 len, this->ipString, this->portNum );
+      destroyPeer( this, torrent );
+      return;
+    }
     else {
-      this->incomingMessageData = realloc( this->incomingMessageData, len + 4);
+      if ( len + 4 != this->incomingMessageCapacity ) {
+	this->incomingMessageData = 
+	  memRealloc( torrent, MEM_RECEIVE, this->incomingMessageData, 
+		      this->incomingMessageCapacity, len + 4 );
+	this->incomingMessageCapacity = len + 4;
+      }
       this->incomingMessageRemaining = len;
       this->incomingMessageOffset = 4;
       this->readingHeader = 0;
@@ -389,12 +960,15 @@ void handleFullMessage( struct peerInfo * this,
       logToFile( torrent, 
 		 "MESSAGE CHOKE FROM %s:%d\n", 
 		 this->ipString, this->portNum);
+      // They discard our pending requests when they choke us
+      releaseRequests( this, torrent );
       break; 
     case ( 1 ) :       // Unchoke
       this->peer_choking = 0; 
       logToFile( torrent, 
 		 "MESSAGE UNCHOKE FROM %s:%d\n", 
 		 this->ipString, this->portNum);
+      fillRequests( this, torrent );
       break; 
     case ( 2 ) :       // Interested
       this->peer_interested = 1; 
@@ -410,6 +984,9 @@ void handleFullMessage( struct peerInfo * this,
       break; 
     case ( 4 ) :
       error = handleHaveMessage( this, torrent );
+      if ( ! error ) {
+	fillRequests( this, torrent );
+      }
       break;
     case ( 5 ) :
       if ( this->status == BT_AWAIT_BITFIELD ) {
@@ -417,16 +994,20 @@ void handleFullMessage( struct peerInfo * this,
       } else {
 	error = 1;
       }
+      if ( ! error ) {
+	fillRequests( this, torrent );
+      }
       break;
     case ( 6 ) :
       error = handleRequestMessage( this, torrent );
       break;
     case ( 7 ) :
       handlePieceMessage( this, torrent );
+      // Keep their pipeline full
+      fillRequests( this, torrent );
       break;
-    case ( 8 ) : // Cancel
-      logToFile( torrent, "WARNING Received CANCEL from %s:%d. Ignoring.",
-		 this->ipString, this->portNum );
+    case ( 8 ) :
+      error = handleCancelMessage( this, torrent );
       break;
     case ( 9 ) : // DHT Port
       logToFile( torrent, "WARNING Received PORT from %s:%d. Ignoring.",
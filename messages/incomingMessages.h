@@ -10,11 +10,19 @@
 #include "../common.h"
 #include "outgoingMessages.h"
 #include "../utils/base.h"
+#include "../utils/requests.h"
+#include "../utils/memory.h"
+#include "../utils/blame.h"
+#include "../utils/scrub.h"
+#include "../utils/writeback.h"
+#include "../utils/pieceCache.h"
 
 //extern void logToFile( struct torrentInfo * torrent, const char * format, ... ) ;
 //extern unsigned char * computeSHA1( char * data, int size ) ;
 extern void destroyPeer( struct peerInfo * peer, struct torrentInfo * torrent ) ;
 extern int doTrackerCommunication( struct torrentInfo * t, int type );
+extern peerHandle peerHandleOf( struct peerInfo * peer );
+extern struct peerInfo * getPeer( struct torrentInfo * torrent, peerHandle h );
 
 /*
   handleFullMessage - takes any fully received message
@@ -82,7 +90,10 @@ int handleBitfieldMessage( struct peerInfo * this,
 /*
   handleRequestMessage - takes a fully received REQUEST header and,
   if the request is valid, constructs a PIECE message to send to
-  the connected peer. 
+  the connected peer. In seed mode, requests for pieces that have not
+  been checked yet wait until the hash pool has checked them, and
+  requests for pieces that are not in the piece cache wait until the
+  hash pool has read them into it.
 
   Parameters:
   => this - a peerInfo struct for the person who sent the message
@@ -96,17 +107,28 @@ int handleRequestMessage( struct peerInfo * this,
 			  struct torrentInfo * torrent );
 
 /*
-  handlePieceMessage - takes a fully received PIECE header and body
-  and updates our state accordingly. Copies the received data into
-  the memory mapped file in the right place. If we have finished downloading
-  the piece, then we check the validity with a SHA1 hash. 
+  handleCancelMessage - takes a fully received CANCEL header and drops
+  the request it names, if it is still waiting for its piece to be
+  checked. Requests already answered are not taken back.
 
-  If the piece is valid, then we send a HAVE message to all of our
-  connected peers, update our bitfield, and clean up the chunk
-  state so that all future requests will be served directly out
-  of the file.
+  Parameters:
+  => this - a peerInfo struct for the person who sent the message
+  => torrent - the torrentInfo struct for our current download
+
+  Returns 0 if operation was successful and nonzero on an error,
+  which will trigger destruction of the peer.
+ */
+int handleCancelMessage( struct peerInfo * this, 
+			 struct torrentInfo * torrent ) ;
 
-  If the torrent is completed, notifies the tracker server.
+/*
+  handlePieceMessage - takes a fully received PIECE header and body
+  and updates our state accordingly. Copies the received data into
+  the buffer for its piece, and adds it to the piece's running SHA1
+  hash as soon as every block before it has arrived. If we have 
+  finished downloading the piece, then we check the hash straight 
+  away if every block has been hashed, or queue the rest of the piece 
+  to be hashed on the hash pool if not.
 
   Parameters:
   => this - a peerInfo struct for the person who sent the message
@@ -119,4 +141,84 @@ int handleRequestMessage( struct peerInfo * this,
 void handlePieceMessage( struct peerInfo * this, 
 			 struct torrentInfo * torrent ) ;
 
+/*
+  pieceVerified - act on the SHA1 hash of a downloaded piece.
+
+  If the piece is valid, then we send a HAVE message to all of our
+  connected peers, update our bitfield, copy the piece into the 
+  memory mapped file, and clean up the chunk state so that all future
+  requests will be served directly out of the file. If the torrent
+  is completed, notifies the tracker server.
+
+  If the piece is not valid, it is discarded and requested again.
+
+  Parameters:
+  => torrent - the torrentInfo struct for our current download
+  => job - the finished hash pool job for the piece
+
+  Returns: Nothing.
+ */
+void pieceVerified( struct torrentInfo * torrent, HP_Job * job ) ;
+
+/*
+  forgetPiece - stop claiming to have a piece whose data on disk has
+  turned out to be bad, so that it is downloaded again. Peers we have
+  already told about it may still ask for it; those requests are
+  ignored.
+
+  Parameters:
+  => torrent - the torrentInfo struct for our current download
+  => idx - the piece number
+
+  Returns: Nothing.
+ */
+void forgetPiece( struct torrentInfo * torrent, int idx ) ;
+
+/*
+  collectVerifiedPieces - handle every piece whose hash has been
+  computed since we last checked. Called from the main loop when the
+  hash pool's wakeup descriptor is readable.
+
+  Parameters:
+  => torrent - the torrentInfo struct for our current download
+
+  Returns: Nothing.
+ */
+void collectVerifiedPieces( struct torrentInfo * torrent ) ;
+
+/*
+  startWaitingReads - submit the piece reads that were waiting for a
+  buffer from the piece pool, for as long as there are buffers free.
+  Called on every pass of the main loop.
+
+  Parameters:
+  => t - the torrentInfo struct for our current download
+
+  Returns: Nothing.
+ */
+void startWaitingReads( struct torrentInfo * t ) ;
+
+/*
+  dropDeferredRequests - forget every request of a peer's that is
+  waiting for its piece to be read, because the peer is going away.
+
+  Parameters:
+  => p - the peer
+  => t - the torrentInfo struct for our current download
+
+  Returns: Nothing.
+ */
+void dropDeferredRequests( struct peerInfo * p, struct torrentInfo * t ) ;
+
+/*
+  freePieceReads - free every piece read and the requests waiting on
+  them, at shutdown. The hash pool must have been stopped.
+
+  Parameters:
+  => t - the torrentInfo struct for our current download
+
+  Returns: Nothing.
+ */
+void freePieceReads( struct torrentInfo * t ) ;
+
 #endif
@@ -3,7 +3,8 @@
   outgoingMessages.c - function definitions for functions that generate
   and append different bittorrent protocol messages to our peers.
 
-  Messages: Have, Bitfield, Unchoke, Choke, Interested, Request
+  Messages: Have, Bitfield, Unchoke, Choke, Interested, Not Interested,
+  Request
 
   Piece messages are generated in handlePieceMessage function,
   declared in incomingMessages.h and implemented in incomingMessages.c
@@ -31,7 +32,7 @@ void broadcastHaveMessage( struct torrentInfo * torrent, int blockIdx ) {
   logToFile(torrent, "SEND BROADCAST HAVE %d\n", blockIdx);
 
   for ( i = 0; i < torrent->peerListLen; i ++ ) {
-    struct peerInfo * peerPtr = &torrent->peerList[i];
+    struct peerInfo * peerPtr = peerAt( torrent, i );
     if ( peerPtr->defined && 
 	 peerPtr->status != BT_AWAIT_INITIAL_HANDSHAKE &&
 	 peerPtr->status != BT_AWAIT_RESPONSE_HANDSHAKE ) 
@@ -88,6 +89,22 @@ void sendInterested( struct peerInfo * p, struct torrentInfo * t ) {
 
 }
 
+void sendNotInterested( struct peerInfo * p, struct torrentInfo * t ) {
+
+
+  int len = htonl(1);
+  char id = 3;
+  char msg[5];
+  memcpy( &msg[0], &len, 4 );
+  memcpy( &msg[4], &id, 1 );
+  logToFile( t, "SEND MESSAGE NOT INTERESTED to %s:%d\n", p->ipString,
+	     p->portNum);
+  SS_Push( p->outgoingData, msg, 5 );
+
+  return;
+
+}
+
 void sendUnchoke( struct peerInfo * this, struct torrentInfo * t ) {
 
 
@@ -127,24 +144,23 @@ void sendPieceRequest( struct peerInfo * p,
 
   char request[17];
 
-  struct subChunk sc = t->chunks[pieceNum].subChunks[ subChunkNum ];
+  int start = subChunkNum * SUBCHUNK_SIZE;
+  int len = subChunkLength( t, pieceNum, subChunkNum );
   int tmp = htonl(13);
   char tmpch = 6;
   memcpy( &request[0], &tmp, 4 );
   memcpy( &request[4], &tmpch, 1 );
   tmp = htonl( pieceNum );
   memcpy( &request[5], &tmp, 4 );
-  tmp = htonl( sc.start );
+  tmp = htonl( start );
   memcpy( &request[9], &tmp, 4 );
-  tmp = htonl( sc.len );
+  tmp = htonl( len );
   memcpy( &request[13], &tmp, 4 );
 
   logToFile( t, "SEND REQUEST %d.%d ( %d-%d ) FROM %s\n", 
-	     pieceNum, subChunkNum, sc.start, sc.end, p->ipString);
+	     pieceNum, subChunkNum, start, start + len, p->ipString);
 
   SS_Push( p->outgoingData, request, 17 );
 
-  p->numPendingSubchunks ++;
-  
 }
 
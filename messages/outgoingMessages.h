@@ -5,7 +5,8 @@
   outgoingMessages.h - function declarations for functions that generate
   and append different bittorrent protocol messages to our peers.
 
-  Messages: Have, Bitfield, Unchoke, Choke, Interested, Request
+  Messages: Have, Bitfield, Unchoke, Choke, Interested, Not Interested,
+  Request
 
   Piece messages are generated in handlePieceMessage function,
   declared in incomingMessages.h and implemented in incomingMessages.c
@@ -17,6 +18,8 @@
 
 #include "../common.h"
 extern void logToFile( struct torrentInfo *, const char *, ... );
+extern int subChunkLength( struct torrentInfo *, int, int );
+extern struct peerInfo * peerAt( struct torrentInfo *, int );
 
 /*
   broadcastHaveMessage - Send a HAVE message to all of our connected peers
@@ -63,6 +66,22 @@ void sendBitfield( struct peerInfo * this, struct torrentInfo * torrent ) ;
 void sendInterested( struct peerInfo * p, struct torrentInfo * t ) ;
 
 
+/*
+  sendNotInterested - Send a NOT INTERESTED message to one of our
+  connected clients notifying them that they have nothing left that
+  we want, so they can give their upload slot to somebody else.
+
+  Parameters:
+  => p - a peerInfo struct pointer to the peer we are sending
+            the message to.
+  => t - a torrentInfo struct pointer to the current torrent
+
+  Returns: Nothing, but modifies the outgoingData stream for the
+  peer that will receive the message.
+ */
+void sendNotInterested( struct peerInfo * p, struct torrentInfo * t ) ;
+
+
 /*
   sendUnchoke - Send a UNCHOKE message to one of our connected clients
   notifying them that we will satisfy requests if they send us
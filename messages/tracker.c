@@ -80,9 +80,9 @@ char * createTrackerMessage( struct torrentInfo * torrent, int msgType ) {
 
   char * infoHash = percentEncode( torrent->infoHash, 20 );
   char * peerID = percentEncode( torrent->peerID, 20 );
-  int uploaded = torrent->numBytesUploaded;
-  int downloaded = torrent->numBytesDownloaded;
-  int left = torrent->totalSize - torrent->numBytesDownloaded;
+  long long uploaded = torrent->numBytesUploaded;
+  long long downloaded = torrent->numBytesDownloaded;
+  long long left = torrent->totalSize - torrent->numBytesDownloaded;
   
   char event[32];
   if ( msgType == TRACKER_STARTED ) {
@@ -111,9 +111,9 @@ char * createTrackerMessage( struct torrentInfo * torrent, int msgType ) {
 	   "info_hash=%s&"
 	   "peer_id=%s&"
 	   "port=%d&"
-	   "uploaded=%d&"
-	   "downloaded=%d&"
-	   "left=%d&"
+	   "uploaded=%lld&"
+	   "downloaded=%lld&"
+	   "left=%lld&"
 	   "compact=1&"
 	   "no_peer_id=1&"
 	   "%s"          // Event string, if present
@@ -215,7 +215,7 @@ int parseTrackerResponse( struct torrentInfo * torrent,
 
   for ( i = 0; i < numBytes/6; i ++ ) {
     int newSlot = getFreeSlot( torrent );
-    struct peerInfo * this = &torrent->peerList[ newSlot ];
+    struct peerInfo * this = peerAt( torrent, newSlot );
 
     // Get IP and port data in the right place
     memcpy( ip, peerListPtr, 4 );
@@ -229,18 +229,23 @@ int parseTrackerResponse( struct torrentInfo * torrent,
     // connection with this host
     int exists = 0;
     for( j = 0; j < torrent->peerListLen; j ++ ) {
-      if ( j == newSlot || torrent->peerList[j].defined == 0 ) {
+      if ( j == newSlot || peerAt( torrent, j )->defined == 0 ) {
 	continue;
       }
-      if ( !strcmp( torrent->peerList[j].ipString, this->ipString ) ) {
+      if ( !strcmp( peerAt( torrent, j )->ipString, this->ipString ) ) {
 	exists = 1;
 	break;
       }
     }
     if ( exists ) {
-      this->defined = 0;
+      releaseSlot( torrent, newSlot );
       break;
     }
+    if ( isBanned( torrent, this->ipString ) ) {
+      releaseSlot( torrent, newSlot );
+      peerListPtr += 6;
+      continue;
+    }
 
 
     if ( connectToPeer( this, torrent, handshake ) ) {
@@ -9,8 +9,11 @@
 #include "../common.h"
 #include "../utils/percentEncode.h"
 #include "../utils/base.h"
+#include "../utils/blame.h"
 
 extern int getFreeSlot( struct torrentInfo * torrent ) ;
+extern void releaseSlot( struct torrentInfo * torrent, int slot ) ;
+extern struct peerInfo * peerAt( struct torrentInfo * torrent, int slot ) ;
 //extern int nonBlockingConnect( char * ip, unsigned short port, int sock ) ;
 //extern void logToFile( struct torrentInfo * torrent, const char * format, ... ) ;
 extern int connectToPeer( struct peerInfo * this, 
@@ -0,0 +1,473 @@
+/*
+  sha1.c - contains function definitions for computing SHA1 digests,
+  with the block function chosen at runtime from the fastest one this
+  CPU supports.
+
+  Every block function takes the five words of hash state and a run
+  of whole 64-byte blocks, so the padding and streaming logic here is
+  shared by all of them, and a digest may even be started with one
+  backend and finished with another.
+ */
+
+#include "sha1.h"
+
+// The block function is all we need from OpenSSL, and it is still
+// exported, if deprecated, in 3.0
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+typedef void (*compressFn)( uint32_t h[5], const unsigned char * data,
+			    size_t numBlocks );
+typedef void (*compressManyFn)( uint32_t h[5][SHA1_MAX_LANES],
+				const unsigned char ** data,
+				size_t numBlocks );
+
+struct backend {
+  const char * name;
+  int (*available)( );
+  compressFn compress;
+  compressManyFn compressMany; // NULL if buffers are hashed one by one
+};
+
+static const uint32_t initialState[5] =
+  { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+static uint32_t loadBig( const unsigned char * p ) {
+  return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 ) |
+    ( (uint32_t) p[2] << 8 ) | p[3];
+}
+
+static void storeBig( unsigned char * p, uint32_t v ) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+
+/*
+  compressOpenSSL - the portable block function. SHA1_Transform does
+  one block at a time, on a SHA_CTX whose state we load and store.
+ */
+static void compressOpenSSL( uint32_t h[5], const unsigned char * data,
+			     size_t numBlocks ) {
+
+  SHA_CTX c;
+  c.h0 = h[0];
+  c.h1 = h[1];
+  c.h2 = h[2];
+  c.h3 = h[3];
+  c.h4 = h[4];
+  while ( numBlocks -- ) {
+    SHA1_Transform( &c, data );
+    data += 64;
+  }
+  h[0] = c.h0;
+  h[1] = c.h1;
+  h[2] = c.h2;
+  h[3] = c.h3;
+  h[4] = c.h4;
+
+}
+
+static int alwaysAvailable( ) {
+  return 1;
+}
+
+
+#ifdef SHA1_X86
+
+static int hasSHANI( ) {
+  unsigned int a, b, c, d;
+  if ( ! __get_cpuid_count( 7, 0, &a, &b, &c, &d ) ) {
+    return 0;
+  }
+  return ( b & ( 1 << 29 ) ) && __builtin_cpu_supports( "sse4.1" );
+}
+
+static int hasAVX2( ) {
+  return __builtin_cpu_supports( "avx2" );
+}
+
+/*
+  Four rounds of SHA-NI, from the fifth group on. EA absorbs the
+  schedule words in MC and drives the rounds, EB saves the state for
+  the next group, and the schedule for later groups is advanced in M2,
+  M1 and MX while the rounds run, as far as it is still needed.
+ */
+#define NI_ROUNDS( EA, EB, MC, M2, M1, MX, F, DO2, DO1, DOX )	\
+  EA = _mm_sha1nexte_epu32( EA, MC );				\
+  EB = abcd;							\
+  if ( DO2 ) M2 = _mm_sha1msg2_epu32( M2, MC );			\
+  abcd = _mm_sha1rnds4_epu32( abcd, EA, F );			\
+  if ( DO1 ) M1 = _mm_sha1msg1_epu32( M1, MC );			\
+  if ( DOX ) MX = _mm_xor_si128( MX, MC );
+
+/*
+  compressSHANI - block function using the x86 SHA extensions,
+  following Intel's reference sequence.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void compressSHANI( uint32_t h[5], const unsigned char * data,
+			   size_t numBlocks ) {
+
+  __m128i abcd, abcdSave, e0, e0Save, e1;
+  __m128i m0, m1, m2, m3;
+  const __m128i mask = _mm_set_epi64x( 0x0001020304050607ULL,
+				       0x08090a0b0c0d0e0fULL );
+
+  abcd = _mm_loadu_si128( (const __m128i *) h );
+  abcd = _mm_shuffle_epi32( abcd, 0x1B );
+  e0 = _mm_set_epi32( h[4], 0, 0, 0 );
+
+  while ( numBlocks -- ) {
+
+    abcdSave = abcd;
+    e0Save = e0;
+
+    // Rounds 0-15 load the message
+    m0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) data ), mask );
+    e0 = _mm_add_epi32( e0, m0 );
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32( abcd, e0, 0 );
+
+    m1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( data + 16 ) ),
+			   mask );
+    e1 = _mm_sha1nexte_epu32( e1, m1 );
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32( abcd, e1, 0 );
+    m0 = _mm_sha1msg1_epu32( m0, m1 );
+
+    m2 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( data + 32 ) ),
+			   mask );
+    e0 = _mm_sha1nexte_epu32( e0, m2 );
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32( abcd, e0, 0 );
+    m1 = _mm_sha1msg1_epu32( m1, m2 );
+    m0 = _mm_xor_si128( m0, m2 );
+
+    m3 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( data + 48 ) ),
+			   mask );
+    NI_ROUNDS( e1, e0, m3, m0, m2, m1, 0, 1, 1, 1 );
+
+    // Rounds 16-79 run on the schedule
+    NI_ROUNDS( e0, e1, m0, m1, m3, m2, 0, 1, 1, 1 );
+    NI_ROUNDS( e1, e0, m1, m2, m0, m3, 1, 1, 1, 1 );
+    NI_ROUNDS( e0, e1, m2, m3, m1, m0, 1, 1, 1, 1 );
+    NI_ROUNDS( e1, e0, m3, m0, m2, m1, 1, 1, 1, 1 );
+    NI_ROUNDS( e0, e1, m0, m1, m3, m2, 1, 1, 1, 1 );
+    NI_ROUNDS( e1, e0, m1, m2, m0, m3, 1, 1, 1, 1 );
+    NI_ROUNDS( e0, e1, m2, m3, m1, m0, 2, 1, 1, 1 );
+    NI_ROUNDS( e1, e0, m3, m0, m2, m1, 2, 1, 1, 1 );
+    NI_ROUNDS( e0, e1, m0, m1, m3, m2, 2, 1, 1, 1 );
+    NI_ROUNDS( e1, e0, m1, m2, m0, m3, 2, 1, 1, 1 );
+    NI_ROUNDS( e0, e1, m2, m3, m1, m0, 2, 1, 1, 1 );
+    NI_ROUNDS( e1, e0, m3, m0, m2, m1, 3, 1, 1, 1 );
+    NI_ROUNDS( e0, e1, m0, m1, m3, m2, 3, 1, 1, 1 );
+    NI_ROUNDS( e1, e0, m1, m2, m0, m3, 3, 1, 0, 1 );
+    NI_ROUNDS( e0, e1, m2, m3, m1, m0, 3, 1, 0, 0 );
+    NI_ROUNDS( e1, e0, m3, m0, m2, m1, 3, 0, 0, 0 );
+
+    e0 = _mm_sha1nexte_epu32( e0, e0Save );
+    abcd = _mm_add_epi32( abcd, abcdSave );
+
+    data += 64;
+  }
+
+  abcd = _mm_shuffle_epi32( abcd, 0x1B );
+  _mm_storeu_si128( (__m128i *) h, abcd );
+  h[4] = _mm_extract_epi32( e0, 3 );
+
+}
+
+#define ROTL8( x, n ) \
+  _mm256_or_si256( _mm256_slli_epi32( x, n ), _mm256_srli_epi32( x, 32 - n ) )
+
+/*
+  compressAVX2 - block function for eight buffers at once, with word
+  j of every buffer's state in lane j of an AVX2 register. The message
+  words are gathered across the buffers one block at a time.
+ */
+__attribute__((target("avx2")))
+static void compressAVX2( uint32_t h[5][SHA1_MAX_LANES],
+			  const unsigned char ** data, size_t numBlocks ) {
+
+  int i, t;
+  __m256i w[16];
+  __m256i a, b, c, d, e, f, k, tmp;
+  __m256i s[5];
+  size_t offset = 0;
+
+  for ( i = 0; i < 5; i ++ ) {
+    s[i] = _mm256_loadu_si256( (const __m256i *) h[i] );
+  }
+
+  while ( numBlocks -- ) {
+
+    for ( t = 0; t < 16; t ++ ) {
+      w[t] = _mm256_set_epi32( loadBig( data[7] + offset + 4 * t ),
+			       loadBig( data[6] + offset + 4 * t ),
+			       loadBig( data[5] + offset + 4 * t ),
+			       loadBig( data[4] + offset + 4 * t ),
+			       loadBig( data[3] + offset + 4 * t ),
+			       loadBig( data[2] + offset + 4 * t ),
+			       loadBig( data[1] + offset + 4 * t ),
+			       loadBig( data[0] + offset + 4 * t ) );
+    }
+
+    a = s[0];
+    b = s[1];
+    c = s[2];
+    d = s[3];
+    e = s[4];
+
+    for ( t = 0; t < 80; t ++ ) {
+      if ( t >= 16 ) {
+	tmp = _mm256_xor_si256( _mm256_xor_si256( w[ ( t - 3 ) & 15 ],
+						  w[ ( t - 8 ) & 15 ] ),
+				_mm256_xor_si256( w[ ( t - 14 ) & 15 ],
+						  w[ t & 15 ] ) );
+	w[ t & 15 ] = ROTL8( tmp, 1 );
+      }
+      if ( t < 20 ) {
+	f = _mm256_xor_si256( d, _mm256_and_si256( b,
+						   _mm256_xor_si256( c, d ) ) );
+	k = _mm256_set1_epi32( 0x5A827999 );
+      }
+      else if ( t < 40 ) {
+	f = _mm256_xor_si256( _mm256_xor_si256( b, c ), d );
+	k = _mm256_set1_epi32( 0x6ED9EBA1 );
+      }
+      else if ( t < 60 ) {
+	f = _mm256_or_si256( _mm256_and_si256( b, c ),
+			     _mm256_and_si256( d, _mm256_or_si256( b, c ) ) );
+	k = _mm256_set1_epi32( 0x8F1BBCDC );
+      }
+      else {
+	f = _mm256_xor_si256( _mm256_xor_si256( b, c ), d );
+	k = _mm256_set1_epi32( 0xCA62C1D6 );
+      }
+      tmp = _mm256_add_epi32( _mm256_add_epi32( ROTL8( a, 5 ), f ),
+			      _mm256_add_epi32( _mm256_add_epi32( e, k ),
+						w[ t & 15 ] ) );
+      e = d;
+      d = c;
+      c = ROTL8( b, 30 );
+      b = a;
+      a = tmp;
+    }
+
+    s[0] = _mm256_add_epi32( s[0], a );
+    s[1] = _mm256_add_epi32( s[1], b );
+    s[2] = _mm256_add_epi32( s[2], c );
+    s[3] = _mm256_add_epi32( s[3], d );
+    s[4] = _mm256_add_epi32( s[4], e );
+
+    offset += 64;
+  }
+
+  for ( i = 0; i < 5; i ++ ) {
+    _mm256_storeu_si256( (__m256i *) h[i], s[i] );
+  }
+
+}
+
+#endif /* SHA1_X86 */
+
+
+// In order of preference
+static const struct backend backends[] = {
+#ifdef SHA1_X86
+  { "shani", hasSHANI, compressSHANI, NULL },
+  { "avx2", hasAVX2, compressOpenSSL, compressAVX2 },
+#endif
+  { "openssl", alwaysAvailable, compressOpenSSL, NULL },
+};
+
+#define NUM_BACKENDS ( sizeof( backends ) / sizeof( backends[0] ) )
+
+static const struct backend * current = NULL;
+static pthread_once_t chosen = PTHREAD_ONCE_INIT;
+
+/*
+  pickDefault - set current to the first backend this CPU supports.
+  Run once, by whichever thread hashes first.
+ */
+static void pickDefault( ) {
+
+  unsigned int i;
+  for ( i = 0; i < NUM_BACKENDS; i ++ ) {
+    if ( backends[i].available( ) ) {
+      current = &backends[i];
+      break;
+    }
+  }
+
+}
+
+/*
+  chooseBackend - the backend to hash with, picking the default the
+  first time. Hash pool workers get here concurrently, so the pick is
+  made under pthread_once rather than by testing current.
+ */
+static const struct backend * chooseBackend( ) {
+
+  pthread_once( &chosen, pickDefault );
+  return current;
+
+}
+
+const char * Sha1_Backend( ) {
+
+  return chooseBackend( )->name;
+
+}
+
+int Sha1_SetBackend( const char * name ) {
+
+  unsigned int i;
+  // Make the default pick now, so that it cannot replace this one
+  pthread_once( &chosen, pickDefault );
+  for ( i = 0; i < NUM_BACKENDS; i ++ ) {
+    if ( ! strcmp( backends[i].name, name ) && backends[i].available( ) ) {
+      current = &backends[i];
+      return 0;
+    }
+  }
+  return -1;
+
+}
+
+void Sha1_Begin( Sha1_Ctx * ctx ) {
+
+  memcpy( ctx->h, initialState, sizeof( initialState ) );
+  ctx->blockLen = 0;
+  ctx->length = 0;
+
+}
+
+void Sha1_Update( Sha1_Ctx * ctx, const void * data, size_t length ) {
+
+  const unsigned char * bytes = data;
+  compressFn compress = chooseBackend( )->compress;
+  size_t n;
+
+  ctx->length += length;
+
+  // Top up a partial block first
+  if ( ctx->blockLen > 0 ) {
+    n = 64 - ctx->blockLen;
+    if ( n > length ) {
+      n = length;
+    }
+    memcpy( ctx->block + ctx->blockLen, bytes, n );
+    ctx->blockLen += n;
+    bytes += n;
+    length -= n;
+    if ( ctx->blockLen < 64 ) {
+      return;
+    }
+    compress( ctx->h, ctx->block, 1 );
+    ctx->blockLen = 0;
+  }
+
+  n = length / 64;
+  if ( n > 0 ) {
+    compress( ctx->h, bytes, n );
+    bytes += 64 * n;
+    length -= 64 * n;
+  }
+
+  memcpy( ctx->block, bytes, length );
+  ctx->blockLen = length;
+
+}
+
+void Sha1_Finish( Sha1_Ctx * ctx, unsigned char * digest ) {
+
+  int i;
+  compressFn compress = chooseBackend( )->compress;
+  unsigned long long bits = ctx->length * 8;
+
+  ctx->block[ ctx->blockLen ++ ] = 0x80;
+  if ( ctx->blockLen > 56 ) {
+    memset( ctx->block + ctx->blockLen, 0, 64 - ctx->blockLen );
+    compress( ctx->h, ctx->block, 1 );
+    ctx->blockLen = 0;
+  }
+  memset( ctx->block + ctx->blockLen, 0, 56 - ctx->blockLen );
+  storeBig( ctx->block + 56, bits >> 32 );
+  storeBig( ctx->block + 60, bits );
+  compress( ctx->h, ctx->block, 1 );
+
+  for ( i = 0; i < 5; i ++ ) {
+    storeBig( digest + 4 * i, ctx->h[i] );
+  }
+
+}
+
+void Sha1_Digest( const void * data, size_t length, unsigned char * digest ) {
+
+  Sha1_Ctx ctx;
+  Sha1_Begin( &ctx );
+  Sha1_Update( &ctx, data, length );
+  Sha1_Finish( &ctx, digest );
+
+}
+
+void Sha1_DigestMany( int num, const void * const * data,
+		      const size_t * lengths, unsigned char ** digests ) {
+
+  int i, j, w, lanes;
+  size_t numBlocks;
+  const struct backend * b = chooseBackend( );
+  uint32_t h[5][SHA1_MAX_LANES];
+  const unsigned char * laneData[ SHA1_MAX_LANES ];
+  Sha1_Ctx ctx;
+
+  for ( i = 0; i < num; i += lanes ) {
+
+    lanes = num - i < SHA1_MAX_LANES ? num - i : SHA1_MAX_LANES;
+
+    if ( ! b->compressMany || lanes == 1 ) {
+      Sha1_Digest( data[i], lengths[i], digests[i] );
+      lanes = 1;
+      continue;
+    }
+
+    // Hash the blocks that every buffer has together. Unused lanes
+    // repeat the first buffer, and their results are ignored.
+    numBlocks = lengths[i] / 64;
+    for ( j = 0; j < SHA1_MAX_LANES; j ++ ) {
+      int src = j < lanes ? i + j : i;
+      laneData[j] = data[src];
+      if ( lengths[src] / 64 < numBlocks ) {
+	numBlocks = lengths[src] / 64;
+      }
+      for ( w = 0; w < 5; w ++ ) {
+	h[w][j] = initialState[w];
+      }
+    }
+    b->compressMany( h, laneData, numBlocks );
+
+    // And finish each of them off on its own
+    for ( j = 0; j < lanes; j ++ ) {
+      for ( w = 0; w < 5; w ++ ) {
+	ctx.h[w] = h[w][j];
+      }
+      ctx.blockLen = 0;
+      ctx.length = 64 * numBlocks;
+      Sha1_Update( &ctx, laneData[j] + 64 * numBlocks,
+		   lengths[i + j] - 64 * numBlocks );
+      Sha1_Finish( &ctx, digests[i + j] );
+    }
+  }
+
+}
@@ -0,0 +1,122 @@
+#ifndef SHA1_BM_H
+#define SHA1_BM_H
+
+/*
+  sha1.h - contains function declarations for computing SHA1 digests.
+  The block function is chosen once, at runtime, from the fastest one
+  this CPU supports:
+
+    shani   - the x86 SHA extensions, one buffer at a time
+    avx2    - eight buffers at once in the lanes of AVX2 registers,
+              for Sha1_DigestMany; single buffers use OpenSSL
+    openssl - OpenSSL's SHA1 block function, which works everywhere
+
+  Digests may be computed in one call, or streamed through a Sha1_Ctx
+  a piece at a time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define SHA1_DIGEST_LENGTH 20
+
+// Largest number of buffers the multi-buffer kernels hash at once
+#define SHA1_MAX_LANES 8
+
+
+typedef struct {
+
+  uint32_t h[5];              // Hash state so far
+  unsigned char block[64];    // Bytes waiting for a full block
+  int blockLen;               // How many bytes are in block?
+  unsigned long long length;  // Total bytes absorbed
+
+} Sha1_Ctx ;
+
+/*
+  Sha1_Begin - Start a new digest.
+
+  Parameters:
+  => ctx - the context to initialize
+
+  Returns: Nothing.
+ */
+void Sha1_Begin( Sha1_Ctx * ctx ) ;
+
+/*
+  Sha1_Update - Absorb more bytes into a digest. Whole blocks are
+  hashed straight out of data; only a partial block is copied.
+
+  Parameters:
+  => ctx - a context started with Sha1_Begin
+  => data - the bytes to absorb
+  => length - how many bytes
+
+  Returns: Nothing.
+ */
+void Sha1_Update( Sha1_Ctx * ctx, const void * data, size_t length ) ;
+
+/*
+  Sha1_Finish - Pad the message and write out its digest. The context
+  must be started again before it is reused.
+
+  Parameters:
+  => ctx - a context started with Sha1_Begin
+  => digest - SHA1_DIGEST_LENGTH bytes to write the digest to
+
+  Returns: Nothing.
+ */
+void Sha1_Finish( Sha1_Ctx * ctx, unsigned char * digest ) ;
+
+/*
+  Sha1_Digest - Compute the digest of one buffer.
+
+  Parameters:
+  => data - the bytes to hash
+  => length - how many bytes
+  => digest - SHA1_DIGEST_LENGTH bytes to write the digest to
+
+  Returns: Nothing.
+ */
+void Sha1_Digest( const void * data, size_t length, unsigned char * digest );
+
+/*
+  Sha1_DigestMany - Compute the digests of several buffers. With the
+  avx2 backend, up to SHA1_MAX_LANES of them are hashed together for as
+  many blocks as they all have; the rest are finished one at a time.
+  Other backends hash the buffers one after another.
+
+  Parameters:
+  => num - how many buffers
+  => data - the buffers
+  => lengths - the number of bytes in each buffer
+  => digests - where to write the digest of each buffer
+
+  Returns: Nothing.
+ */
+void Sha1_DigestMany( int num, const void * const * data,
+		      const size_t * lengths, unsigned char ** digests ) ;
+
+/*
+  Sha1_Backend - Which block function is in use? Chooses one if that
+  has not happened yet.
+
+  Returns: The name of the backend, as listed at the top of this file.
+ */
+const char * Sha1_Backend( ) ;
+
+/*
+  Sha1_SetBackend - Use a particular block function, for testing and
+  benchmarking. Not safe while other threads are hashing.
+
+  Parameters:
+  => name - the name of the backend, as listed at the top of this file
+
+  Returns: 0 on success, or -1 if the backend is unknown or this CPU
+  does not support it.
+ */
+int Sha1_SetBackend( const char * name ) ;
+
+#endif
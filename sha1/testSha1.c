@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <openssl/sha.h>
+
+#include "sha1.h"
+
+static const char * names[] = { "shani", "avx2", "openssl" };
+#define NUM_NAMES 3
+
+static double elapsed( struct timespec * start ) {
+  struct timespec end;
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( end.tv_sec - start->tv_sec ) * 1000.0 +
+    ( end.tv_nsec - start->tv_nsec ) / 1000000.0;
+}
+
+static void toHex( unsigned char * digest, char * out ) {
+  int i;
+  for ( i = 0; i < 20; i ++ ) {
+    sprintf( out + 2 * i, "%02x", digest[i] );
+  }
+}
+
+/*
+  testBackend - check one backend against OpenSSL's SHA1 and some
+  known digests, in one call, streamed, and many at a time.
+ */
+void testBackend( unsigned char * data, int size ) {
+
+  int i, j, len;
+  unsigned char expected[20], got[20];
+  char hex[41];
+
+  Sha1_Digest( "abc", 3, got );
+  toHex( got, hex );
+  assert( ! strcmp( hex, "a9993e364706816aba3e25717850c26c9cd0d89d" ) );
+  Sha1_Digest( "", 0, got );
+  toHex( got, hex );
+  assert( ! strcmp( hex, "da39a3ee5e6b4b0d3255bfef95601890afd80709" ) );
+
+  // Every length around the padding boundaries, and then some
+  for ( len = 0; len < 300; len ++ ) {
+    SHA1( data, len, expected );
+    Sha1_Digest( data, len, got );
+    assert( ! memcmp( expected, got, 20 ) );
+  }
+  SHA1( data, size, expected );
+  Sha1_Digest( data, size, got );
+  assert( ! memcmp( expected, got, 20 ) );
+
+  // Streamed in uneven pieces
+  for ( j = 0; j < 20; j ++ ) {
+    Sha1_Ctx ctx;
+    Sha1_Begin( &ctx );
+    for ( i = 0; i < size; ) {
+      int n = rand() % 5000;
+      if ( n > size - i ) {
+	n = size - i;
+      }
+      Sha1_Update( &ctx, data + i, n );
+      i += n;
+    }
+    Sha1_Finish( &ctx, got );
+    assert( ! memcmp( expected, got, 20 ) );
+  }
+
+  // Many at once, with equal and unequal lengths
+  for ( j = 1; j <= 2 * SHA1_MAX_LANES + 3; j ++ ) {
+    const void * bufs[ 2 * SHA1_MAX_LANES + 3 ];
+    size_t lens[ 2 * SHA1_MAX_LANES + 3 ];
+    unsigned char digests[ 2 * SHA1_MAX_LANES + 3 ][20];
+    unsigned char * outs[ 2 * SHA1_MAX_LANES + 3 ];
+    for ( i = 0; i < j; i ++ ) {
+      bufs[i] = data + 1000 * i;
+      lens[i] = ( j % 2 ) ? 65536 : rand() % 70000;
+      outs[i] = digests[i];
+    }
+    Sha1_DigestMany( j, bufs, lens, outs );
+    for ( i = 0; i < j; i ++ ) {
+      SHA1( bufs[i], lens[i], expected );
+      assert( ! memcmp( expected, digests[i], 20 ) );
+    }
+  }
+
+}
+
+/*
+  benchmark - hash a buffer in piece-sized chunks with each backend,
+  one piece at a time and eight at a time.
+ */
+void benchmark( unsigned char * data, int size ) {
+
+  int i, j, b;
+  int pieceSize = 256 * 1024;
+  int numPieces = size / pieceSize;
+  int reps = 4;
+  struct timespec start;
+  unsigned char digests[ SHA1_MAX_LANES ][20];
+  unsigned char * outs[ SHA1_MAX_LANES ];
+  const void * bufs[ SHA1_MAX_LANES ];
+  size_t lens[ SHA1_MAX_LANES ];
+  double ms;
+
+  for ( i = 0; i < SHA1_MAX_LANES; i ++ ) {
+    outs[i] = digests[i];
+    lens[i] = pieceSize;
+  }
+
+  printf("Benchmarking on %d pieces of %d kB (MB/s)\n",
+	 numPieces, pieceSize / 1024 );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( j = 0; j < reps; j ++ ) {
+    for ( i = 0; i < numPieces; i ++ ) {
+      SHA1( data + i * pieceSize, pieceSize, digests[0] );
+    }
+  }
+  ms = elapsed( &start );
+  printf("  OpenSSL SHA1(): %8.1f\n",
+	 (double) reps * numPieces * pieceSize / ms / 1000 );
+
+  for ( b = 0; b < NUM_NAMES; b ++ ) {
+    if ( Sha1_SetBackend( names[b] ) ) {
+      printf("  %-8s        not supported\n", names[b] );
+      continue;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( j = 0; j < reps; j ++ ) {
+      for ( i = 0; i < numPieces; i ++ ) {
+	Sha1_Digest( data + i * pieceSize, pieceSize, digests[0] );
+      }
+    }
+    ms = elapsed( &start );
+    printf("  %-8s single: %8.1f", names[b],
+	   (double) reps * numPieces * pieceSize / ms / 1000 );
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( j = 0; j < reps; j ++ ) {
+      for ( i = 0; i + SHA1_MAX_LANES <= numPieces; i += SHA1_MAX_LANES ) {
+	int k;
+	for ( k = 0; k < SHA1_MAX_LANES; k ++ ) {
+	  bufs[k] = data + ( i + k ) * pieceSize;
+	}
+	Sha1_DigestMany( SHA1_MAX_LANES, bufs, lens, outs );
+      }
+    }
+    ms = elapsed( &start );
+    printf(", many: %8.1f\n",
+	   (double) reps * ( numPieces / SHA1_MAX_LANES ) * SHA1_MAX_LANES *
+	   pieceSize / ms / 1000 );
+  }
+
+}
+
+int main( int argc, char ** argv ) {
+
+  int i;
+  int size = 32 * 1024 * 1024;
+  unsigned char * data = malloc( size );
+  for ( i = 0; i < size; i ++ ) {
+    data[i] = rand();
+  }
+
+  if ( argc > 1 && ! strcmp( argv[1], "bench" ) ) {
+    benchmark( data, size );
+    free( data );
+    return 0;
+  }
+
+  printf("Default backend is %s\n", Sha1_Backend() );
+  for ( i = 0; i < NUM_NAMES; i ++ ) {
+    if ( Sha1_SetBackend( names[i] ) ) {
+      printf("Skipping %s backend, not supported here\n", names[i] );
+      continue;
+    }
+    printf("Testing %s backend\n", names[i] );
+    testBackend( data, 1000000 + 17 );
+  }
+  assert( Sha1_SetBackend( "nonsense" ) == -1 );
+
+  printf("PASS\n\n");
+
+  free( data );
+  return 0;
+
+}
@@ -5,16 +5,116 @@
 
 #include "startup.h"
 
+/*
+  isPlainName - is a bencoded string a usable file or directory name:
+  not empty, with no NUL or '/' in it, and not "." or ".."?
+
+  Returns: 1 if it is, 0 if not.
+ */
+static int isPlainName( be_node * part ) {
+
+  return part->type == BE_STR && be_str_len( part ) > 0 &&
+    strlen( part->val.s ) == be_str_len( part ) &&
+    ! strchr( part->val.s, '/' ) &&
+    strcmp( part->val.s, "." ) && strcmp( part->val.s, ".." );
+
+}
+
+/*
+  readFileList - check the file list of a multi-file torrent and turn
+  it into paths under the torrent's directory. Each path component
+  must be a plain name, so that a torrent cannot write outside its
+  directory.
+
+  Parameters:
+  => t - the torrent, with its name (the directory) already set
+  => files - the "files" list from the info dictionary
+  => paths - set to an allocated array of allocated paths
+  => sizes - set to an allocated array of file sizes
+
+  Returns: The number of files. Exits if the list is malformed.
+ */
+static int readFileList( struct torrentInfo * t, be_node * files,
+			 char *** paths, long long ** sizes ) {
+
+  int i, j, k, numFiles, pathLen;
+  be_node * length, * path;
+
+  if ( files->type != BE_LIST || ! files->val.l[0] ) {
+    printf("Error - The torrent's file list is empty or malformed\n");
+    exit(1);
+  }
+  for ( numFiles = 0; files->val.l[numFiles]; numFiles ++ );
+  *paths = Malloc( numFiles * sizeof( char * ) );
+  *sizes = Malloc( numFiles * sizeof( long long ) );
+
+  t->totalSize = 0;
+  for ( i = 0; i < numFiles; i ++ ) {
+    be_node * file = files->val.l[i];
+    length = path = NULL;
+    for ( j = 0; file->type == BE_DICT && file->val.d[j].val; j ++ ) {
+      if ( 0 == strcmp( file->val.d[j].key, "length" ) ) {
+	length = file->val.d[j].val;
+      }
+      else if ( 0 == strcmp( file->val.d[j].key, "path" ) ) {
+	path = file->val.d[j].val;
+      }
+    }
+    if ( ! length || length->type != BE_INT || length->val.i < 0 ||
+	 ! path || path->type != BE_LIST || ! path->val.l[0] ) {
+      printf("Error - File %d of the torrent is malformed\n", i );
+      exit(1);
+    }
+
+    pathLen = strlen( t->name ) + 1;
+    for ( k = 0; path->val.l[k]; k ++ ) {
+      be_node * part = path->val.l[k];
+      if ( ! isPlainName( part ) ) {
+	printf("Error - File %d of the torrent has an unsafe path\n", i );
+	exit(1);
+      }
+      pathLen += be_str_len( part ) + 1;
+    }
+    (*paths)[i] = Malloc( pathLen );
+    strcpy( (*paths)[i], t->name );
+    for ( k = 0; path->val.l[k]; k ++ ) {
+      strcat( (*paths)[i], "/" );
+      strcat( (*paths)[i], path->val.l[k]->val.s );
+    }
+    (*sizes)[i] = length->val.i;
+    t->totalSize += length->val.i;
+    logToFile( t, "STARTUP File %d: %s (%lld bytes)\n", i, (*paths)[i],
+	       (*sizes)[i] );
+  }
+  printf("Torrent Files: %d\n", numFiles );
+  logToFile( t, "STARTUP Torrent Files: %d\n", numFiles );
+
+  return numFiles;
+
+}
+
 struct torrentInfo* processBencodedTorrent( be_node * data, 
 					    struct argsInfo * args ) {
 
   int i, j;
   int chunkHashesLen;
   char * chunkHashes;
+  be_node * files = NULL;  // File list, if there are several files
+  char ** paths = NULL;
+  long long * sizes = NULL;
+  int numFiles = 0;
 
 
   struct torrentInfo * toRet = Malloc( sizeof( struct torrentInfo ) );
 
+  // Nothing allocated yet. Pieces are limited by the piece pool, and
+  // upload queues by their own budget.
+  for ( i = 0; i < MEM_NUM_CATEGORIES; i ++ ) {
+    toRet->memUsed[i] = 0;
+    toRet->memLimit[i] = 0;
+  }
+  toRet->memLimit[ MEM_OUTGOING ] = (long long) args->queueBudget * 1024 * 1024;
+
   // Initialize our log file
   FILE * logFile = 
     fopen( args->logFile, "w+" ) ;
@@ -37,6 +137,9 @@ struct torrentInfo* processBencodedTorrent( be_node * data,
 
   logToFile( toRet, "BitTorrent Client Starting Up!\n");
 
+  // Optional fields, freed on shutdown whether or not they are set
+  toRet->comment = NULL;
+
   for ( i = 0; data->val.d[i].val != NULL; i ++ ) {
 
     // Keys can include: announce (string) and info (dict), among others
@@ -95,8 +198,11 @@ struct torrentInfo* processBencodedTorrent( be_node * data,
 	char * key = infoIter->val.d[j].key;
 	if ( 0 == strcmp( key, "length" ) ) {
 	  toRet->totalSize = infoIter->val.d[j].val->val.i;
-	  printf("Torrent Size: %d\n", toRet->totalSize );
-	  logToFile( toRet, "STARTUP Torrent Size: %d\n", toRet->totalSize );
+	  printf("Torrent Size: %lld\n", toRet->totalSize );
+	  logToFile( toRet, "STARTUP Torrent Size: %lld\n", toRet->totalSize );
+	}
+	else if ( 0 == strcmp( key, "files" ) ) {
+	  files = infoIter->val.d[j].val;
 	}
 	else if ( 0 == strcmp( key, "piece length" ) ) {
 	  toRet->chunkSize = infoIter->val.d[j].val->val.i;
@@ -104,6 +210,12 @@ struct torrentInfo* processBencodedTorrent( be_node * data,
 	  logToFile( toRet, "STARTUP Chunk Size: %d\n", toRet->chunkSize );
 	}
 	else if ( 0 == strcmp( key, "name" ) ) {
+	  // The name is the save file or the files' directory, under
+	  // the save directory, so it must not lead out of it
+	  if ( ! isPlainName( infoIter->val.d[j].val ) ) {
+	    printf("Error - The torrent's name is not a plain file name\n");
+	    exit(1);
+	  }
 	  int nameLen = strlen(infoIter->val.d[j].val->val.s ) + 
 	    strlen( args->saveFile ) + 3;
 	  toRet->name = Malloc( nameLen * sizeof(char) );
@@ -140,6 +252,14 @@ struct torrentInfo* processBencodedTorrent( be_node * data,
     }
   } /* Done iterating through .torrent file */
 
+  // A multi-file torrent has no length of its own; its name is the
+  // directory that the files go in
+  if ( files ) {
+    numFiles = readFileList( toRet, files, &paths, &sizes );
+    printf("Torrent Size: %lld\n", toRet->totalSize );
+    logToFile( toRet, "STARTUP Torrent Size: %lld\n", toRet->totalSize );
+  }
+
   /* Initialize our data strucures and data members */
 
   // Not done downloading yet!
@@ -149,45 +269,86 @@ struct torrentInfo* processBencodedTorrent( be_node * data,
   int numChunks = toRet->totalSize/toRet->chunkSize + 
     ( toRet->totalSize % toRet->chunkSize ? 1 : 0 );
   toRet->numChunks = numChunks;
-  toRet->chunks = Malloc( numChunks * sizeof(struct chunkInfo) );
-  toRet->chunkOrdering = Malloc( numChunks * sizeof( struct chunkInfo * ) );
+  toRet->prevalence = memAlloc( toRet, MEM_METADATA, numChunks * sizeof( int ) );
+  toRet->chunksRequested = Bitfield_Init( numChunks );
+  memCharge( toRet, MEM_BITFIELDS, toRet->chunksRequested->numBytes );
+  toRet->chunkHashes = (unsigned char *) chunkHashes;
+  memCharge( toRet, MEM_METADATA, chunkHashesLen );
+  toRet->chunkData = memAlloc( toRet, MEM_METADATA, 
+			       numChunks * sizeof( char * ) );
+  toRet->numSubChunksReceived = 
+    memAlloc( toRet, MEM_METADATA, numChunks * sizeof( unsigned short ) );
+  toRet->chunkHashState = memAlloc( toRet, MEM_METADATA,
+				    numChunks * sizeof( Sha1_Ctx * ) );
+  toRet->chunkSources = memAlloc( toRet, MEM_METADATA,
+				  numChunks * sizeof( struct pieceSources * ) );
+  toRet->chunkOrdering = memAlloc( toRet, MEM_METADATA, 
+				   numChunks * sizeof( int ) );
   toRet->numPrevalenceChanges = 0;
+  toRet->nextRequestDeadline = ~0ULL; // Nothing outstanding yet
+  toRet->requestsReleased = 0;
+  toRet->sourcesLost = 0;
   for ( i = 0; i < numChunks ; i ++ ) {
-    toRet->chunkOrdering[i] = &toRet->chunks[i];
-    memcpy( toRet->chunks[i].hash, chunkHashes + 20*i, 20 );
-    toRet->chunks[i].size = ( i == numChunks - 1 ? 
-			      toRet-> totalSize % toRet->chunkSize 
-			      : toRet->chunkSize ) ;
-    toRet->chunks[i].prevalence = 0;
-    toRet->chunks[i].have = 0;
-    toRet->chunks[i].requested = 0;
-    toRet->chunks[i].data = Malloc( toRet->chunks[i].size ) ;
-
-
-    int subChunkSize = 1 << 14;
-    int numSubChunks = 
-      ( toRet->chunks[i].size + subChunkSize - 1 ) / subChunkSize;
-    toRet->chunks[i].numSubChunks = numSubChunks;
-    toRet->chunks[i].subChunks = 
-      Malloc( numSubChunks * sizeof( struct subChunk ) );
-    for ( j = 0; j < numSubChunks; j ++ ) {
-      toRet->chunks[i].subChunks[j].start = j * subChunkSize;
-      toRet->chunks[i].subChunks[j].end   = 
-	min( (j+1) * subChunkSize, toRet->chunks[i].size );
-      toRet->chunks[i].subChunks[j].len   = 
-	toRet->chunks[i].subChunks[j].end - toRet->chunks[i].subChunks[j].start ;
-      toRet->chunks[i].subChunks[j].have       = 0;
-      toRet->chunks[i].subChunks[j].requested  = 0; 
-      toRet->chunks[i].subChunks[j].requestTime  = 0; 
-    }
-
+    toRet->chunkOrdering[i] = i;
+    toRet->prevalence[i] = 0;
+    toRet->chunkData[i] = NULL; // Allocated when first requested
+    toRet->numSubChunksReceived[i] = 0;
+    toRet->chunkHashState[i] = NULL; // Begun with the first block
+    toRet->chunkSources[i] = NULL;   // Likewise
   }
-  free( chunkHashes );
+
+  toRet->subChunksPerChunk = 
+    ( toRet->chunkSize + SUBCHUNK_SIZE - 1 ) / SUBCHUNK_SIZE;
+  toRet->subChunksRequested = 
+    Bitfield_Init( numChunks * toRet->subChunksPerChunk );
+  toRet->subChunksReceived = 
+    Bitfield_Init( numChunks * toRet->subChunksPerChunk );
+  memCharge( toRet, MEM_BITFIELDS, 2 * toRet->subChunksReceived->numBytes );
 
   logToFile( toRet, "STARTUP Initialized chunk and subchunk data structures\n");
 
+  // Pieces are only held in memory while they are being downloaded,
+  // and never more of them than fit in our budget.
+  long long numBuffers = 
+    (long long) args->pieceBudget * 1024 * 1024 / toRet->chunkSize;
+  if ( numBuffers < 1 ) {
+    numBuffers = 1;
+  }
+  if ( numBuffers > numChunks ) {
+    numBuffers = numChunks;
+  }
+  toRet->piecePool = BP_Init( toRet->chunkSize, numBuffers );
+  toRet->memLimit[ MEM_PIECES ] = numBuffers * toRet->chunkSize;
+
+  // Pieces are checked off the main loop, so that it never waits
+  int hashThreads = args->hashThreads;
+  if ( hashThreads <= 0 ) {
+    hashThreads = sysconf( _SC_NPROCESSORS_ONLN );
+  }
+  toRet->hashPool = HP_Init( hashThreads );
+  logToFile( toRet, "STARTUP Hash pool has %d threads, using %s SHA1\n", 
+	     hashThreads, Sha1_Backend() );
+  logToFile( toRet, "STARTUP Piece pool holds %lld pieces (%d MB)\n",
+	     numBuffers, args->pieceBudget );
+
   // Initialize our bitfield
   toRet->ourBitfield = Bitfield_Init( toRet->numChunks );
+  memCharge( toRet, MEM_BITFIELDS, toRet->ourBitfield->numBytes );
+  toRet->seedBitfield = Bitfield_Init( toRet->numChunks );
+  for ( i = 0; i < toRet->numChunks; i ++ ) {
+    Bitfield_Set( toRet->seedBitfield, i );
+  }
+  memCharge( toRet, MEM_BITFIELDS, toRet->seedBitfield->numBytes );
+  toRet->unverified = NULL;
+  toRet->pieceReads = memAlloc( toRet, MEM_METADATA, 
+				numChunks * sizeof( struct pieceRead * ) );
+  memset( toRet->pieceReads, 0, numChunks * sizeof( struct pieceRead * ) );
+  toRet->pieceReadList = NULL;
+  toRet->numWaitingReads = 0;
+  if ( args->seedMode ) {
+    toRet->unverified = Bitfield_Init( toRet->numChunks );
+    memCharge( toRet, MEM_BITFIELDS, toRet->unverified->numBytes );
+  }
   logToFile( toRet, "STARTUP Initialized bitfield data structure\n");
 
 
@@ -240,24 +401,55 @@ struct torrentInfo* processBencodedTorrent( be_node * data,
   // Set our print timer
   toRet->lastPrint = 0;
 
-  // Initialize the memory mapped file where we will store results
-  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-  int saveFile = open(toRet->name,
-		      O_RDWR | O_CREAT , mode);
-  if ( saveFile < 0 ) {
-    perror("open");
+  // Open the file or files where we will store results. An existing
+  // file of the right size is left as it is, for loadPartialResults().
+  if ( files ) {
+    toRet->storage = Storage_OpenFiles( numFiles, paths, sizes, 
+					args->storage );
+    for ( i = 0; i < numFiles; i ++ ) {
+      free( paths[i] );
+    }
+    free( paths );
+    free( sizes );
+  }
+  else {
+    toRet->storage = Storage_Open( toRet->name, toRet->totalSize, 
+				   args->storage );
+  }
+  if ( ! toRet->storage ) {
+    fprintf( stderr, "ERROR: Cannot open %s with the '%s' backend: %s\n",
+	     toRet->name, args->storage, strerror( errno ) );
     exit(1);
   }
-  if ( ftruncate( saveFile, toRet->totalSize ) ) {
-    perror("ftruncate");
+  logToFile( toRet, "STARTUP Storage backend: %s\n", 
+	     Storage_Backend( toRet->storage ) );
+
+  // Uploads read whole pieces into the cache
+  initPieceCache( toRet, args->cacheSize );
+
+  // Finished pieces are written out off the main loop
+  startWriteback( toRet, args->writeback );
+
+  // Nothing is known about its contents until loadPartialResults()
+  toRet->resumeJobs = NULL;
+  toRet->numResumeJobs = 0;
+  toRet->resumeChecked = 0;
+  toRet->fastResumeSaved = 0;
+  toRet->lastFastResume = getTimeMs();
+
+  toRet->scrubRate = (long long) args->scrubRate * 1000;
+  toRet->scrubCredit = 0;
+  toRet->scrubLastTick = getTimeMs();
+  toRet->scrubBusy = 0;
+  toRet->scrubNext = 0;
+  toRet->scrubPasses = 0;
+  toRet->scrubBad = 0;
+  toRet->scrubBytes = 0;
+  toRet->scrubLastReport = toRet->scrubLastTick;
+  if ( toRet->scrubRate ) {
+    logToFile( toRet, "STARTUP Scrubbing pieces on disk at %d kB/s\n",
+	       args->scrubRate );
   }
-
-  toRet->fileData = mmap( NULL,             // Kernel chooses placement
-			  toRet->totalSize, // Length of mapping
-			  PROT_READ | PROT_WRITE, // Permissions,
-			  MAP_SHARED, // Updates visible on system
-			  saveFile, 
-			  0 );
 			  
 
   logToFile( toRet, "STARTUP Initialized save file memory mapping\n");
@@ -268,12 +460,17 @@ struct torrentInfo* processBencodedTorrent( be_node * data,
   toRet->timerChokeID = 0;
 
   // Initialize our peer list and peer data structures.
-  toRet->peerList = Malloc( 30 * sizeof( struct peerInfo ) );
-  toRet->peerListLen = 30;
-  for ( i = 0; i < 30; i ++ ) {
-    toRet->peerList[i].defined = 0;
-  }
-  toRet->optimisticUnchoke = NULL;
+  // Slots are allocated as they are needed
+  toRet->peerSlabs = NULL;
+  toRet->numPeerSlabs = 0;
+  toRet->peerListLen = 0;
+  toRet->freeSlot = -1;
+  toRet->blame = NULL;
+  toRet->numBlame = 0;
+  toRet->blameCapacity = 0;
+  toRet->bansPending = 0;
+  toRet->optimisticUnchoke.slot = -1;
+  toRet->optimisticUnchoke.generation = 0;
   toRet->chokingIter = 0;
 
   logToFile( toRet, "STARTUP Initialized peerInfo data structures\n");
@@ -357,10 +554,18 @@ struct argsInfo * parseArgs( int argc, char ** argv ) {
   toRet->fileName = NULL;
 
   toRet->maxPeers = 30;
+  toRet->pieceBudget = DEFAULT_PIECE_BUDGET_MB;
+  toRet->queueBudget = DEFAULT_QUEUE_BUDGET_MB;
+  toRet->cacheSize = DEFAULT_CACHE_MB;
+  toRet->hashThreads = 0; // One per CPU
+  toRet->seedMode = 0;
+  toRet->scrubRate = 0;
+  toRet->writeback = WRITEBACK_BATCH;
+  toRet->storage = strdup("mmap");
   toRet->bindAddress = INADDR_ANY;
   toRet->bindPort = 6881;
 
-  while ((ch = getopt(argc, argv, "ht:p:s:l:I:m:b:")) != -1) {
+  while ((ch = getopt(argc, argv, "ht:p:s:l:I:m:b:M:Q:C:H:SR:W:D:")) != -1) {
     switch (ch) {
     case 'h': //help                                                                     
       usage(stdout);
@@ -385,6 +590,44 @@ struct argsInfo * parseArgs( int argc, char ** argv ) {
     case 'm' : // Max peers
       toRet->maxPeers = atoi(optarg);
       break;
+    case 'M' : // Memory budget for in-flight pieces
+      toRet->pieceBudget = atoi(optarg);
+      break;
+    case 'Q' : // Memory budget for queued uploads
+      toRet->queueBudget = atoi(optarg);
+      break;
+    case 'C' : // Memory for pieces cached for uploads
+      toRet->cacheSize = atoi(optarg);
+      break;
+    case 'H' : // Threads for checking pieces
+      toRet->hashThreads = atoi(optarg);
+      break;
+    case 'S' : // Seed mode; check pieces when first requested
+      toRet->seedMode = 1;
+      break;
+    case 'R' : // Rate for re-checking the pieces we have
+      toRet->scrubRate = atoi(optarg);
+      break;
+    case 'W' : // How to make finished pieces durable
+      if ( ! strcmp( optarg, "sync" ) ) {
+	toRet->writeback = WRITEBACK_SYNC;
+      }
+      else if ( ! strcmp( optarg, "async" ) ) {
+	toRet->writeback = WRITEBACK_ASYNC;
+      }
+      else if ( ! strcmp( optarg, "batch" ) ) {
+	toRet->writeback = WRITEBACK_BATCH;
+      }
+      else {
+	fprintf(stderr,"ERROR: Unknown writeback policy '%s'\n", optarg);
+	usage(stdout);
+	exit(1);
+      }
+      break;
+    case 'D' : // How to read and write the save file
+      free( toRet->storage );
+      toRet->storage = strdup( optarg );
+      break;
     case 'b' :
       if ( inet_aton( optarg, &in ) == 0 ) {
 	toRet->bindAddress = in.s_addr;
@@ -431,6 +674,14 @@ void usage(FILE * file){
           "  -l log_file \t Save logs to log_file (dflt: bt-client.log)\n"
           "  -I id       \t Set the node identifier to id (dflt: random)\n"
           "  -m max_num  \t Max number of peers to connect to at once (dflt:25)\n"
+          "  -M mbytes   \t Memory for pieces being downloaded (dflt: 64)\n"
+          "  -Q mbytes   \t Memory for data queued for upload (dflt: 16)\n"
+          "  -C mbytes   \t Memory for pieces cached for upload (dflt: 16)\n"
+          "  -H threads  \t Threads for checking pieces (dflt: one per CPU)\n"
+          "  -S          \t Seed mode: assume the save file is complete\n"
+          "  -R kbytes   \t Re-check pieces on disk at kbytes/s (dflt: off)\n"
+          "  -W policy   \t Flush pieces to disk: sync, async or batch (dflt: batch)\n"
+          "  -D backend  \t Save file I/O: mmap, pread or direct (dflt: mmap)\n"
 	  );
 
 }
@@ -494,31 +745,215 @@ char * generateID() {
 }
 
 
+void adviseRange( struct torrentInfo * t, int piece, int advice ) {
+
+  Storage_Advise( t->storage, (long long) piece * t->chunkSize,
+		  chunkLength( t, piece ), advice );
+
+}
+
+/*
+  loadPiece - read a piece in from the save file, on a hash pool
+  worker.
+ */
+static void loadPiece( HP_Job * job ) {
+
+  if ( Storage_Read( job->source, job->data, job->offset, job->length ) ) {
+    // The hash will not match, so the piece is treated as missing
+    perror("Storage_Read");
+    memset( job->data, 0, job->length );
+  }
+
+}
+
+void readPieceJob( struct torrentInfo * t, HP_Job * job, int piece,
+		   char * buffer ) {
+
+  job->length = chunkLength( t, piece );
+  job->ctx = NULL;
+  job->tag = piece;
+  job->offset = (long long) piece * t->chunkSize;
+  if ( ! buffer ) {
+    // Hash it where it is; the worker faults it in
+    job->data = t->storage->map + job->offset;
+    job->load = NULL;
+  }
+  else {
+    job->data = buffer;
+    job->load = loadPiece;
+    job->source = t->storage;
+  }
+
+}
+
+/*
+  moreToCheck - move on past the pieces that the fast-resume file
+  vouched for. Are there any pieces left to submit?
+ */
+static int moreToCheck( struct torrentInfo * t ) {
+
+  while ( Bitfield_IsSet( t->ourBitfield, t->resumeNext ) ) {
+    t->resumeNext ++;
+  }
+  return t->resumeNext < t->numChunks;
+
+}
+
+/*
+  submitResumeJob - queue the next unchecked piece of the save file
+  to be hashed, reusing a finished job and its buffer.
+ */
+static void submitResumeJob( struct torrentInfo * t, HP_Job * job,
+			     char * buffer ) {
+
+  int piece = t->resumeNext ++;
+
+  readPieceJob( t, job, piece, buffer );
+  job->arg = t; // Tells collectVerifiedPieces that it is ours
+  adviseRange( t, piece, STORAGE_WILLNEED );
+  HP_Submit( t->hashPool, job );
+
+}
+
+/*
+  reportResumeProgress - print how far the check of the save file 
+  has got, and how fast it is going.
+ */
+static void reportResumeProgress( struct torrentInfo * t, 
+				  unsigned long long now ) {
+
+  double seconds = ( now - t->resumeStart ) / 1000.0;
+  double rate = seconds > 0 ? t->resumeBytes / seconds / 1000000 : 0;
+
+  printf( "Checked %d/%d pieces of the save file (%.1f MB/s)\n",
+	  t->resumeChecked, t->numChunks, rate );
+  logToFile( t, "INIT Checked %d/%d pieces, %d valid, "
+	     "%.1f s (%.1f MB/s)\n", t->resumeChecked, t->numChunks,
+	     t->resumeValid, seconds, rate );
+  t->resumeLastReport = now;
+
+}
+
+/*
+  finishResumeCheck - tidy up once every piece of the save file has
+  been checked, or vouched for by the fast-resume file.
+ */
+static void finishResumeCheck( struct torrentInfo * t ) {
+
+  reportResumeProgress( t, getTimeMs() );
+  logToFile(t, "INIT Validated %d/%d blocks from the torrent.\n",
+	    t->resumeValid, t->numChunks );
+  Storage_Advise( t->storage, 0, 0, STORAGE_NORMAL );
+  if ( t->resumeJobs ) {
+    memFree( t, MEM_METADATA, t->resumeJobs, 
+	     t->numResumeJobs * sizeof( HP_Job ) );
+    t->resumeJobs = NULL;
+  }
+  if ( Bitfield_AllSet( t->ourBitfield ) ) {
+    t->completed = 1;
+  }
+  // Start downloading whatever is missing
+  t->requestsReleased = 1;
+
+}
+
 void loadPartialResults( struct torrentInfo * t ) {
+
   int i;
-  int numExisting = 0;
-
-  for( i = 0; i < t->numChunks; i ++ ) {
-    unsigned char * hash = computeSHA1( &t->fileData[ i * t->chunkSize ],
-					t->chunks[i].size );
-    if ( ! memcmp( hash, t->chunks[i].hash, 20 ) ) {
-      // Final file contents are valid for this block
-      t->chunks[i].have = 1;
-      Bitfield_Set( t->ourBitfield, i );
-      
-      free( t->chunks[i].subChunks );
-      free( t->chunks[i].data );
-      t->chunks[i].data = 
-	&t->fileData[ i * t->chunkSize ];
-      numExisting ++;
-      t->numBytesDownloaded += t->chunks[i].size;
+
+  t->resumeNext = 0;
+  t->resumeValid = loadFastResume( t );
+  t->resumeChecked = t->resumeValid;
+  t->resumeBytes = 0;
+  t->resumeStart = getTimeMs();
+  t->resumeLastReport = t->resumeStart;
+
+  // In seed mode, whatever the fast-resume file did not vouch for is
+  // assumed to be there, and checked when it is first requested
+  if ( t->unverified ) {
+    for ( i = 0; i < t->numChunks; i ++ ) {
+      if ( ! Bitfield_IsSet( t->ourBitfield, i ) ) {
+	Bitfield_Set( t->ourBitfield, i );
+	Bitfield_Set( t->unverified, i );
+	t->numBytesDownloaded += chunkLength( t, i );
+      }
     }
-    free( hash );
+    logToFile( t, "INIT Seed mode: assuming %d pieces without checking\n",
+	       Bitfield_Count( t->unverified ) );
+    t->resumeChecked = t->numChunks;
+  }
+
+  if ( t->resumeChecked == t->numChunks ) {
+    finishResumeCheck( t );
+    return;
+  }
+
+  // Enough jobs to keep every thread busy, and the disk reading ahead
+  t->numResumeJobs = 
+    (long long) RESUME_READAHEAD_MB * 1024 * 1024 / t->chunkSize;
+  if ( t->numResumeJobs < 2 * t->hashPool->numThreads ) {
+    t->numResumeJobs = 2 * t->hashPool->numThreads;
+  }
+  if ( t->numResumeJobs > t->numChunks - t->resumeChecked ) {
+    t->numResumeJobs = t->numChunks - t->resumeChecked;
+  }
+  // Unless the file is mapped, each reads into a piece buffer, which
+  // nothing else needs until downloading starts
+  if ( ! t->storage->map && 
+       t->numResumeJobs > BP_Available( t->piecePool ) ) {
+    t->numResumeJobs = BP_Available( t->piecePool );
+  }
+  t->resumeJobs = memAlloc( t, MEM_METADATA, 
+			    t->numResumeJobs * sizeof( HP_Job ) );
+
+  // We read the file once, front to back
+  Storage_Advise( t->storage, 0, 0, STORAGE_SEQUENTIAL );
+
+  for ( i = 0; i < t->numResumeJobs; i ++ ) {
+    moreToCheck( t );
+    submitResumeJob( t, &t->resumeJobs[i], 
+		     t->storage->map ? NULL : BP_Acquire( t->piecePool ) );
   }
-  
-  logToFile(t, "INIT Validated %d/%d blocks from the torrent.\n",
-	    numExisting, t->numChunks );
 
   return;
 
 }
+
+void resumePieceVerified( struct torrentInfo * t, HP_Job * job ) {
+
+  int piece = job->tag;
+  unsigned long long now;
+
+  t->resumeChecked ++;
+  t->resumeBytes += job->length;
+
+  if ( ! memcmp( job->digest, &t->chunkHashes[ 20 * piece ], 20 ) ) {
+    // Final file contents are valid for this block. Tell everyone we
+    // are already connected to, so that we can start seeding it.
+    Bitfield_Set( t->ourBitfield, piece );
+    t->numBytesDownloaded += job->length;
+    t->resumeValid ++;
+    broadcastHaveMessage( t, piece );
+    pieceAcquired( t, piece );
+  }
+
+  // Whatever we serve later will be read back in on demand
+  adviseRange( t, piece, STORAGE_DONTNEED );
+
+  if ( moreToCheck( t ) ) {
+    submitResumeJob( t, job, job->data );
+  }
+  else if ( job->load ) {
+    BP_Release( t->piecePool, job->data );
+    job->load = NULL; // So that shutdown knows it has been given back
+  }
+
+  now = getTimeMs();
+  if ( t->resumeChecked == t->numChunks ) {
+    finishResumeCheck( t );
+  }
+  else if ( now - t->resumeLastReport >= 1000 ) {
+    reportResumeProgress( t, now );
+  }
+
+}
@@ -8,6 +8,11 @@
 #include "common.h"
 #include "utils/base.h"
 #include "utils/bencode.h"
+#include "utils/requests.h"
+#include "utils/memory.h"
+#include "utils/fastResume.h"
+#include "utils/writeback.h"
+#include "utils/pieceCache.h"
 
 /*
   processBencodedTorrent - isolates the messiness of the bencode
@@ -83,9 +88,12 @@ char * generateID() ;
 
 
 /*
-  loadPartialResults - check if any of the blocks in the file have already
-  been downloaded by comparing a SHA1 hash of the file data to what we 
-  expect to get. Mark any downloaded blocks as complete.
+  loadPartialResults - start checking if any of the blocks in the file 
+  have already been downloaded by comparing a SHA1 hash of the file 
+  data to what we expect to get. The pieces are hashed on the hash 
+  pool, a window of them at a time, while the main loop runs; see
+  resumePieceVerified(). Pieces listed in the fast-resume file are not
+  hashed, and in seed mode nothing is: every piece is assumed present.
 
   Arguments:
   => t - torrentInfo struct for current download
@@ -94,6 +102,54 @@ char * generateID() ;
  */
 void loadPartialResults( struct torrentInfo * t ) ;
 
+/*
+  resumePieceVerified - act on the hash of one piece of the existing
+  save file. Marks the piece complete and announces it to our peers if
+  it is valid, so that it can be served before the check finishes, and
+  submits the next piece. Downloading starts once every piece has been
+  checked.
+
+  Arguments:
+  => t - torrentInfo struct for current download
+  => job - the finished hash pool job for the piece
+
+  Returns: Nothing.
+ */
+void resumePieceVerified( struct torrentInfo * t, HP_Job * job ) ;
+
+/*
+  adviseRange - pass advice about the part of the save file holding
+  one piece to the kernel. Giving up a range never drops our
+  neighbours' pages, and drops the piece from the page cache if it is
+  clean.
+
+  Arguments:
+  => t - torrentInfo struct for current download
+  => piece - the piece number
+  => advice - STORAGE_WILLNEED or STORAGE_DONTNEED
+
+  Returns: Nothing.
+ */
+void adviseRange( struct torrentInfo * t, int piece, int advice ) ;
+
+/*
+  readPieceJob - fill in a hash pool job to check a piece we have in
+  the save file. If there is a buffer, the worker reads the piece into
+  it first; otherwise the file must be mapped, and the piece is hashed
+  where it is. Leaves arg for the caller.
+
+  Arguments:
+  => t - torrentInfo struct for current download
+  => job - the job to fill in
+  => piece - the piece number
+  => buffer - a piece-sized buffer to read it into, or NULL to hash
+     it in the mapped file
+
+  Returns: Nothing.
+ */
+void readPieceJob( struct torrentInfo * t, HP_Job * job, int piece,
+		   char * buffer ) ;
+
 
 
 #endif
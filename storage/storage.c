@@ -0,0 +1,827 @@
+/*
+  storage.c - Function definitions for the Storage interface, which
+  reads and writes a list of files, laid end to end, through an
+  mmap(), pread() or O_DIRECT backend. See storage.h.
+*/
+
+#define _GNU_SOURCE // For O_DIRECT and sync_file_range()
+#include "storage.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char * names[] = { "mmap", "pread", "direct" };
+#define NUM_NAMES 3
+
+static const int madvice[] = { MADV_NORMAL, MADV_SEQUENTIAL,
+			       MADV_WILLNEED, MADV_DONTNEED };
+static const int fadvice[] = { POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL,
+			       POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED };
+
+static void * Malloc( size_t size ) {
+  void * toRet = malloc( size );
+  if ( ! toRet ) {
+    perror("malloc");
+    exit(1);
+  }
+  return toRet;
+
+}
+
+void * Storage_Alloc( size_t size ) {
+
+  void * toRet;
+  if ( posix_memalign( &toRet, STORAGE_ALIGN, size ) ) {
+    perror("posix_memalign");
+    exit(1);
+  }
+  return toRet;
+
+}
+
+/*
+  transfer - read or write through a list of buffers until at least
+  minimum bytes have been moved, carrying on after short transfers.
+  Reads may stop early at the end of the file, once minimum is
+  reached. The list is used up as we go.
+
+  Returns: 0 on success, or -1 with errno set.
+ */
+static int transfer( int fd, struct iovec * iov, int iovcnt,
+		     long long offset, long long minimum, int writing ) {
+
+  long long done = 0;
+  ssize_t ret;
+
+  while ( iovcnt > 0 ) {
+    int num = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+    if ( writing ) {
+      ret = pwritev( fd, iov, num, offset + done );
+    }
+    else {
+      ret = preadv( fd, iov, num, offset + done );
+    }
+    if ( ret < 0 && errno == EINTR ) {
+      continue;
+    }
+    if ( ret < 0 ) {
+      return -1;
+    }
+    if ( ret == 0 && iov->iov_len ) {
+      break;
+    }
+    done += ret;
+    // Move past what has been done
+    while ( iovcnt > 0 && (size_t) ret >= iov->iov_len ) {
+      ret -= iov->iov_len;
+      iov ++;
+      iovcnt --;
+    }
+    if ( iovcnt > 0 ) {
+      iov->iov_base = (char *) iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+  if ( done < minimum ) {
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+
+}
+
+static int transferOne( int fd, char * buf, long long offset, int length,
+			int minimum, int writing ) {
+
+  struct iovec iov = { buf, length };
+  return transfer( fd, &iov, 1, offset, minimum, writing );
+
+}
+
+static int isAligned( const void * buf, long long offset, int length ) {
+
+  return ! ( (unsigned long) buf % STORAGE_ALIGN ) &&
+    ! ( offset % STORAGE_ALIGN ) && ! ( length % STORAGE_ALIGN );
+
+}
+
+/*
+  directRead - read from a file with O_DIRECT, through a bounce buffer
+  covering the whole blocks around the range if it is not aligned.
+ */
+static int directRead( Storage_File * f, char * buf, long long offset,
+		       int length ) {
+
+  long long start, end;
+  char * bounce;
+  int ret;
+
+  if ( isAligned( buf, offset, length ) ) {
+    return transferOne( f->directFD, buf, offset, length, length, 0 );
+  }
+
+  start = offset - offset % STORAGE_ALIGN;
+  end = offset + length + STORAGE_ALIGN - 1;
+  end -= end % STORAGE_ALIGN;
+  bounce = Storage_Alloc( end - start );
+  // The last block of the file comes back short
+  ret = transferOne( f->directFD, bounce, start, end - start,
+		     offset + length - start, 0 );
+  if ( ! ret ) {
+    memcpy( buf, bounce + ( offset - start ), length );
+  }
+  free( bounce );
+  return ret;
+
+}
+
+/*
+  directWrite - write to a file with O_DIRECT. An unaligned range is
+  merged into the whole blocks around it, which are read, patched and
+  written back; so writes sharing a block must not run at the same
+  time. The part of the range in the file's last, partial block is
+  written through the page cache, as O_DIRECT cannot write less than a
+  block without making the file longer.
+ */
+static int directWrite( Storage_File * f, const char * buf, long long offset,
+			int length ) {
+
+  long long tail = f->size - f->size % STORAGE_ALIGN;
+  long long start, end;
+  char * bounce;
+  int ret;
+
+  if ( isAligned( buf, offset, length ) ) {
+    return transferOne( f->directFD, (char *) buf, offset, length,
+			length, 1 );
+  }
+
+  if ( offset + length > tail ) {
+    long long from = offset > tail ? offset : tail;
+    if ( transferOne( f->fd, (char *) buf + ( from - offset ), from,
+		      offset + length - from, offset + length - from, 1 ) ) {
+      return -1;
+    }
+    // Keep it out of the cache, like everything else
+    sync_file_range( f->fd, from, offset + length - from,
+		     SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+		     SYNC_FILE_RANGE_WAIT_AFTER );
+    posix_fadvise( f->fd, tail, f->size - tail, POSIX_FADV_DONTNEED );
+    if ( offset >= tail ) {
+      return 0;
+    }
+    length = tail - offset;
+  }
+
+  start = offset - offset % STORAGE_ALIGN;
+  end = offset + length + STORAGE_ALIGN - 1;
+  end -= end % STORAGE_ALIGN;
+  bounce = Storage_Alloc( end - start );
+  ret = 0;
+  // Only the first and last blocks hold anything we are keeping
+  if ( start != offset ) {
+    ret = transferOne( f->directFD, bounce, start, STORAGE_ALIGN,
+		       STORAGE_ALIGN, 0 );
+  }
+  if ( ! ret && ( offset + length ) % STORAGE_ALIGN &&
+       ( end - start > STORAGE_ALIGN || start == offset ) ) {
+    ret = transferOne( f->directFD,
+		       bounce + ( end - start - STORAGE_ALIGN ),
+		       end - STORAGE_ALIGN, STORAGE_ALIGN, STORAGE_ALIGN, 0 );
+  }
+  if ( ! ret ) {
+    memcpy( bounce + ( offset - start ), buf, length );
+    ret = transferOne( f->directFD, bounce, start, end - start,
+		       end - start, 1 );
+  }
+  free( bounce );
+  return ret;
+
+}
+
+/*
+  openFile - open a file's descriptors, and pass on the access pattern
+  last advised. Called with the lock held.
+ */
+static int openFile( Storage * s, Storage_File * f ) {
+
+  f->fd = open( f->path, O_RDWR );
+  if ( f->fd < 0 ) {
+    return -1;
+  }
+  if ( s->backend == STORAGE_DIRECT ) {
+    f->directFD = open( f->path, O_RDWR | O_DIRECT );
+    if ( f->directFD < 0 ) {
+      int saved = errno;
+      close( f->fd );
+      f->fd = -1;
+      errno = saved;
+      return -1;
+    }
+  }
+  if ( s->pattern != STORAGE_NORMAL ) {
+    posix_fadvise( f->fd, 0, 0, fadvice[ s->pattern ] );
+  }
+  return 0;
+
+}
+
+static void closeFile( Storage_File * f ) {
+
+  if ( f->directFD >= 0 ) {
+    close( f->directFD );
+    f->directFD = -1;
+  }
+  if ( f->fd >= 0 ) {
+    close( f->fd );
+    f->fd = -1;
+  }
+
+}
+
+/*
+  acquireFile - make sure that a file's descriptors are open, and mark
+  it in use so that they stay open until releaseFile(). If too many
+  files are open, the least recently used idle one is closed first.
+
+  Returns: The file, or NULL if it cannot be opened, with errno set.
+ */
+static Storage_File * acquireFile( Storage * s, int i ) {
+
+  Storage_File * f = &s->files[i];
+  int j, victim = -1;
+
+  pthread_mutex_lock( &s->lock );
+  if ( f->fd < 0 ) {
+    if ( s->numOpen >= STORAGE_MAX_OPEN ) {
+      for ( j = 0; j < s->numOpen; j ++ ) {
+	Storage_File * g = &s->files[ s->open[j] ];
+	if ( ! g->users && ( victim < 0 ||
+			     g->lastUse < s->files[ s->open[victim] ].lastUse ) ) {
+	  victim = j;
+	}
+      }
+      if ( victim >= 0 ) {
+	closeFile( &s->files[ s->open[victim] ] );
+	s->open[victim] = s->open[ -- s->numOpen ];
+      }
+    }
+    if ( openFile( s, f ) ) {
+      pthread_mutex_unlock( &s->lock );
+      return NULL;
+    }
+    s->open[ s->numOpen ++ ] = i;
+  }
+  f->users ++;
+  f->lastUse = ++ s->useClock;
+  pthread_mutex_unlock( &s->lock );
+  return f;
+
+}
+
+static void releaseFile( Storage * s, Storage_File * f, int written ) {
+
+  pthread_mutex_lock( &s->lock );
+  f->users --;
+  if ( written ) {
+    f->dirty = 1;
+  }
+  pthread_mutex_unlock( &s->lock );
+
+}
+
+/*
+  findFile - binary search for the file holding a byte of the storage:
+  the last one starting at or before it. Empty files start where the
+  next one does, so are never chosen.
+ */
+static int findFile( Storage * s, long long offset ) {
+
+  int lo = 0, hi = s->numFiles - 1, mid;
+
+  while ( lo < hi ) {
+    mid = ( lo + hi + 1 ) / 2;
+    if ( s->files[mid].start <= offset ) {
+      lo = mid;
+    }
+    else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+
+}
+
+/*
+  fileIO - read or write a range of one file, into or out of a list of
+  buffers.
+ */
+static int fileIO( Storage * s, Storage_File * f, struct iovec * iov,
+		   int iovcnt, long long offset, long long length,
+		   int writing ) {
+
+  int i, ret;
+  char * bounce;
+
+  switch ( s->backend ) {
+  case STORAGE_MMAP:
+    for ( i = 0; i < iovcnt; i ++ ) {
+      if ( writing ) {
+	memcpy( f->map + offset, iov[i].iov_base, iov[i].iov_len );
+      }
+      else {
+	memcpy( iov[i].iov_base, f->map + offset, iov[i].iov_len );
+      }
+      offset += iov[i].iov_len;
+    }
+    return 0;
+  case STORAGE_PREAD:
+    return transfer( f->fd, iov, iovcnt, offset, length, writing );
+  }
+
+  if ( iovcnt == 1 ) {
+    if ( writing ) {
+      return directWrite( f, iov->iov_base, offset, length );
+    }
+    return directRead( f, iov->iov_base, offset, length );
+  }
+
+  // O_DIRECT works a block at a time, so gather the pieces into one
+  bounce = Storage_Alloc( length );
+  if ( writing ) {
+    char * p = bounce;
+    for ( i = 0; i < iovcnt; i ++ ) {
+      memcpy( p, iov[i].iov_base, iov[i].iov_len );
+      p += iov[i].iov_len;
+    }
+    ret = directWrite( f, bounce, offset, length );
+  }
+  else if ( ! ( ret = directRead( f, bounce, offset, length ) ) ) {
+    char * p = bounce;
+    for ( i = 0; i < iovcnt; i ++ ) {
+      memcpy( iov[i].iov_base, p, iov[i].iov_len );
+      p += iov[i].iov_len;
+    }
+  }
+  free( bounce );
+  return ret;
+
+}
+
+/*
+  storageIO - read or write a range of the storage, one vectored call
+  for each file it crosses.
+ */
+static int storageIO( Storage * s, const struct iovec * iov, int iovcnt,
+		      long long offset, int writing ) {
+
+  long long length = 0, n, left;
+  int i, num, first = 0, ret = 0;
+  size_t skip = 0, take;
+  struct iovec * part;
+  Storage_File * f;
+
+  for ( i = 0; i < iovcnt; i ++ ) {
+    length += iov[i].iov_len;
+  }
+  if ( offset < 0 || offset + length > s->size ) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ( ! length ) {
+    return 0;
+  }
+
+  part = Malloc( iovcnt * sizeof( struct iovec ) );
+  for ( i = findFile( s, offset ); length > 0; i ++ ) {
+    n = s->files[i].start + s->files[i].size - offset;
+    if ( n <= 0 ) {
+      continue;
+    }
+    if ( n > length ) {
+      n = length;
+    }
+
+    // The buffers, or the parts of them, that belong in this file
+    for ( num = 0, left = n; left > 0; num ++ ) {
+      take = iov[first].iov_len - skip;
+      if ( take > left ) {
+	take = left;
+      }
+      part[num].iov_base = (char *) iov[first].iov_base + skip;
+      part[num].iov_len = take;
+      left -= take;
+      skip += take;
+      if ( skip == iov[first].iov_len ) {
+	first ++;
+	skip = 0;
+      }
+    }
+
+    // Mappings need no descriptors
+    if ( s->backend == STORAGE_MMAP ) {
+      f = &s->files[i];
+      pthread_mutex_lock( &s->lock );
+      f->users ++;
+      pthread_mutex_unlock( &s->lock );
+    }
+    else if ( ! ( f = acquireFile( s, i ) ) ) {
+      ret = -1;
+      break;
+    }
+    ret = fileIO( s, f, part, num, offset - f->start, n, writing );
+    releaseFile( s, f, writing );
+    if ( ret ) {
+      break;
+    }
+    offset += n;
+    length -= n;
+  }
+  free( part );
+  return ret;
+
+}
+
+/*
+  makeParents - create the directories a file is to go in, as needed.
+ */
+static void makeParents( const char * path ) {
+
+  char * copy = strdup( path ), * p;
+
+  for ( p = strchr( copy + 1, '/' ); p; p = strchr( p + 1, '/' ) ) {
+    *p = '\0';
+    // Fails harmlessly if it is already there
+    mkdir( copy, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH );
+    *p = '/';
+  }
+  free( copy );
+
+}
+
+/*
+  prepareFile - create a file at the right size, map it for the mmap
+  backend, and keep it open if there is room.
+ */
+static int prepareFile( Storage * s, int i ) {
+
+  Storage_File * f = &s->files[i];
+  struct stat st;
+  int fd;
+
+  makeParents( f->path );
+  fd = open( f->path, O_RDWR | O_CREAT,
+	     S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+  if ( fd < 0 ) {
+    return -1;
+  }
+  // Truncating touches the modification time even if the size is
+  // unchanged, which would make the file look changed
+  if ( fstat( fd, &st ) ||
+       ( st.st_size != f->size && ftruncate( fd, f->size ) ) ) {
+    close( fd );
+    return -1;
+  }
+
+  if ( s->backend == STORAGE_MMAP && f->size > 0 ) {
+    f->map = mmap( NULL, f->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0 );
+    if ( f->map == MAP_FAILED ) {
+      f->map = NULL;
+      close( fd );
+      return -1;
+    }
+  }
+  close( fd );
+
+  // Opening it now also tells us whether the backend works here
+  if ( ! acquireFile( s, i ) ) {
+    return -1;
+  }
+  releaseFile( s, f, 0 );
+  return 0;
+
+}
+
+Storage * Storage_Open( const char * path, long long size,
+			const char * backend ) {
+
+  char * paths[1] = { (char *) path };
+  return Storage_OpenFiles( 1, paths, &size, backend );
+
+}
+
+Storage * Storage_OpenFiles( int numFiles, char * const * paths,
+			     const long long * sizes, const char * backend ) {
+
+  int i, b;
+  long long start = 0;
+  Storage * toRet;
+
+  for ( b = 0; b < NUM_NAMES; b ++ ) {
+    if ( ! strcmp( backend, names[b] ) ) {
+      break;
+    }
+  }
+  if ( b == NUM_NAMES || numFiles < 1 ) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  toRet = Malloc( sizeof( Storage ) );
+  toRet->backend = b;
+  toRet->numFiles = numFiles;
+  toRet->files = Malloc( numFiles * sizeof( Storage_File ) );
+  toRet->map = NULL;
+  pthread_mutex_init( &toRet->lock, NULL );
+  toRet->open = Malloc( numFiles * sizeof( int ) );
+  toRet->numOpen = 0;
+  toRet->useClock = 0;
+  toRet->pattern = STORAGE_NORMAL;
+
+  for ( i = 0; i < numFiles; i ++ ) {
+    Storage_File * f = &toRet->files[i];
+    f->path = strdup( paths[i] );
+    f->start = start;
+    f->size = sizes[i];
+    f->map = NULL;
+    f->fd = -1;
+    f->directFD = -1;
+    f->users = 0;
+    f->lastUse = 0;
+    f->dirty = 0;
+    start += sizes[i];
+  }
+  toRet->size = start;
+
+  for ( i = 0; i < numFiles; i ++ ) {
+    if ( prepareFile( toRet, i ) ) {
+      Storage_Close( toRet );
+      return NULL;
+    }
+  }
+  if ( numFiles == 1 ) {
+    toRet->map = toRet->files[0].map;
+  }
+
+  return toRet;
+
+}
+
+void Storage_Close( Storage * s ) {
+
+  int i, saved = errno;
+
+  for ( i = 0; i < s->numFiles; i ++ ) {
+    if ( s->files[i].map ) {
+      munmap( s->files[i].map, s->files[i].size );
+    }
+    closeFile( &s->files[i] );
+    free( s->files[i].path );
+  }
+  pthread_mutex_destroy( &s->lock );
+  free( s->files );
+  free( s->open );
+  free( s );
+  errno = saved;
+
+}
+
+int Storage_Read( Storage * s, void * buf, long long offset, int length ) {
+
+  struct iovec iov = { buf, length };
+  return storageIO( s, &iov, 1, offset, 0 );
+
+}
+
+int Storage_Readv( Storage * s, const struct iovec * iov, int iovcnt,
+		   long long offset ) {
+
+  return storageIO( s, iov, iovcnt, offset, 0 );
+
+}
+
+int Storage_Write( Storage * s, const void * buf, long long offset,
+		   int length ) {
+
+  struct iovec iov = { (void *) buf, length };
+  return storageIO( s, &iov, 1, offset, 1 );
+
+}
+
+int Storage_Writev( Storage * s, const struct iovec * iov, int iovcnt,
+		    long long offset ) {
+
+  return storageIO( s, iov, iovcnt, offset, 1 );
+
+}
+
+void Storage_StartSync( Storage * s, long long offset, long long length ) {
+
+  int i;
+  long long n;
+  Storage_File * f;
+
+  // Direct writes are already on their way
+  if ( s->backend == STORAGE_DIRECT ) {
+    return;
+  }
+
+  for ( i = findFile( s, offset ); length > 0 && i < s->numFiles; i ++ ) {
+    n = s->files[i].start + s->files[i].size - offset;
+    if ( n <= 0 ) {
+      continue;
+    }
+    if ( n > length ) {
+      n = length;
+    }
+    if ( ( f = acquireFile( s, i ) ) ) {
+      sync_file_range( f->fd, offset - f->start, n, SYNC_FILE_RANGE_WRITE );
+      releaseFile( s, f, 0 );
+    }
+    offset += n;
+    length -= n;
+  }
+
+}
+
+/*
+  syncFile - flush a range of one file, or all of it if length is 0.
+ */
+static int syncFile( Storage * s, int i, long long offset,
+		     long long length ) {
+
+  long pageSize = sysconf( _SC_PAGESIZE );
+  long long start = offset - offset % pageSize;
+  Storage_File * f = &s->files[i];
+  int ret;
+
+  // Only a mapping can be flushed a range at a time and still bring
+  // the file's metadata along
+  if ( f->map ) {
+    return msync( f->map + start,
+		  length ? length + offset - start : f->size, MS_SYNC );
+  }
+  if ( ! acquireFile( s, i ) ) {
+    return -1;
+  }
+  ret = fdatasync( f->fd );
+  releaseFile( s, f, 0 );
+  return ret;
+
+}
+
+int Storage_Sync( Storage * s, long long offset, long long length ) {
+
+  int i, dirty, ret = 0;
+  long long n;
+
+  if ( ! length ) {
+    // Only what has been written since the last time
+    for ( i = 0; i < s->numFiles; i ++ ) {
+      pthread_mutex_lock( &s->lock );
+      dirty = s->files[i].dirty;
+      s->files[i].dirty = 0;
+      pthread_mutex_unlock( &s->lock );
+      if ( dirty && syncFile( s, i, 0, 0 ) ) {
+	ret = -1;
+      }
+    }
+    return ret;
+  }
+
+  for ( i = findFile( s, offset ); length > 0 && i < s->numFiles; i ++ ) {
+    n = s->files[i].start + s->files[i].size - offset;
+    if ( n <= 0 ) {
+      continue;
+    }
+    if ( n > length ) {
+      n = length;
+    }
+    if ( syncFile( s, i, offset - s->files[i].start, n ) ) {
+      ret = -1;
+    }
+    offset += n;
+    length -= n;
+  }
+  return ret;
+
+}
+
+/*
+  adviseFile - pass advice about a range of one file to the kernel.
+ */
+static void adviseFile( Storage * s, int i, long long offset,
+			long long length, int advice ) {
+
+  long pageSize = sysconf( _SC_PAGESIZE );
+  long long start = offset, end = offset + length;
+  Storage_File * f = &s->files[i];
+
+  if ( advice == STORAGE_DONTNEED ) {
+    start += ( pageSize - start % pageSize ) % pageSize;
+    if ( end != f->size ) {
+      end -= end % pageSize;
+    }
+  }
+  else {
+    start -= start % pageSize;
+  }
+  if ( end <= start ) {
+    return;
+  }
+
+  // Advice is only a hint, so failures are not worth reporting
+  if ( f->map ) {
+    madvise( f->map + start, end - start, madvice[ advice ] );
+    // For DONTNEED, unmapping the pages lets the kernel evict them
+    if ( advice != STORAGE_DONTNEED ) {
+      return;
+    }
+  }
+  if ( ( f = acquireFile( s, i ) ) ) {
+    posix_fadvise( f->fd, start, end - start, fadvice[ advice ] );
+    releaseFile( s, f, 0 );
+  }
+
+}
+
+void Storage_Advise( Storage * s, long long offset, long long length,
+		     int advice ) {
+
+  int i;
+  long long n;
+
+  // Nothing of ours is in the cache
+  if ( s->backend == STORAGE_DIRECT ) {
+    return;
+  }
+
+  // Access patterns belong to the descriptors and mappings, so apply
+  // to every file, and to files opened later
+  if ( advice == STORAGE_NORMAL || advice == STORAGE_SEQUENTIAL ) {
+    pthread_mutex_lock( &s->lock );
+    s->pattern = advice;
+    for ( i = 0; i < s->numOpen; i ++ ) {
+      posix_fadvise( s->files[ s->open[i] ].fd, 0, 0, fadvice[ advice ] );
+    }
+    pthread_mutex_unlock( &s->lock );
+    for ( i = 0; i < s->numFiles; i ++ ) {
+      if ( s->files[i].map ) {
+	madvise( s->files[i].map, s->files[i].size, madvice[ advice ] );
+      }
+    }
+    return;
+  }
+
+  if ( ! length ) {
+    offset = 0;
+    length = s->size;
+  }
+  for ( i = findFile( s, offset ); length > 0 && i < s->numFiles; i ++ ) {
+    n = s->files[i].start + s->files[i].size - offset;
+    if ( n <= 0 ) {
+      continue;
+    }
+    if ( n > length ) {
+      n = length;
+    }
+    adviseFile( s, i, offset - s->files[i].start, n, advice );
+    offset += n;
+    length -= n;
+  }
+
+}
+
+int Storage_Stat( Storage * s, long long * size, struct timespec * mtime ) {
+
+  int i;
+  struct stat st;
+
+  *size = 0;
+  mtime->tv_sec = 0;
+  mtime->tv_nsec = 0;
+  for ( i = 0; i < s->numFiles; i ++ ) {
+    if ( stat( s->files[i].path, &st ) ) {
+      return -1;
+    }
+    *size += st.st_size;
+    if ( st.st_mtim.tv_sec > mtime->tv_sec ||
+	 ( st.st_mtim.tv_sec == mtime->tv_sec &&
+	   st.st_mtim.tv_nsec > mtime->tv_nsec ) ) {
+      *mtime = st.st_mtim;
+    }
+  }
+  return 0;
+
+}
+
+const char * Storage_Backend( Storage * s ) {
+
+  return names[ s->backend ];
+
+}
@@ -0,0 +1,273 @@
+#ifndef STORAGE_BM_H
+#define STORAGE_BM_H
+
+/*
+  storage.h - contains function declarations for reading and writing
+  a list of files of fixed size, laid end to end as if they were one,
+  through one of several backends:
+
+    mmap   - each file is mapped into memory, and reads and writes are
+             copies to and from the mappings. Pages are read in by
+             page faults on whichever thread touches them.
+    pread  - reads and writes are preadv() and pwritev() calls through
+             the page cache, which is steered with posix_fadvise().
+    direct - reads and writes go straight to the disk with O_DIRECT,
+             bypassing the page cache. They are fastest when buffer,
+             offset within the file and length are all multiples of
+             STORAGE_ALIGN; anything else goes through an aligned
+             bounce buffer.
+
+  A range that crosses from one file into the next is split at the
+  boundary, and each part is one vectored call on its file. The file
+  holding an offset is found with a binary search. At most
+  STORAGE_MAX_OPEN files are kept open at once, least recently used
+  first out, so that a torrent of thousands of files does not use up
+  our descriptors.
+
+  Reads and writes may be made from several threads at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+
+// Alignment wanted by O_DIRECT, and what Storage_Alloc returns
+#define STORAGE_ALIGN 4096
+
+// Most files kept open at once, unless more are in use
+#define STORAGE_MAX_OPEN 64
+
+// Advice for Storage_Advise
+#define STORAGE_NORMAL 0     // No special treatment
+#define STORAGE_SEQUENTIAL 1 // The range will be read front to back
+#define STORAGE_WILLNEED 2   // The range will be read soon
+#define STORAGE_DONTNEED 3   // The range will not be read again soon
+
+#define STORAGE_MMAP 0
+#define STORAGE_PREAD 1
+#define STORAGE_DIRECT 2
+
+
+typedef struct {
+
+  char * path;
+  long long start; // Where the file begins in the storage
+  long long size;  // Size of the file in bytes
+  char * map;      // Mapping of the file (mmap backend), or NULL
+
+  // Guarded by the storage's lock
+  int fd;          // Opened for buffered I/O, or -1 if closed
+  int directFD;    // Opened with O_DIRECT (direct backend), or -1
+  int users;       // Threads using the descriptors right now
+  unsigned long long lastUse; // For choosing which file to close
+  int dirty;       // Written since it was last flushed?
+
+} Storage_File ;
+
+
+typedef struct {
+
+  int backend;          // One of the STORAGE_* backends above
+  long long size;       // Total size of the files in bytes
+  Storage_File * files; // In order
+  int numFiles;
+  char * map;           // The mapping, if there is only one file and
+                        // it is mapped; NULL otherwise
+
+  pthread_mutex_t lock; // Guards the descriptors and the fields below
+  int * open;           // Which files have descriptors?
+  int numOpen;
+  unsigned long long useClock;
+  int pattern;          // STORAGE_NORMAL or STORAGE_SEQUENTIAL, as
+                        // last advised
+
+} Storage ;
+
+
+/*
+  Storage_Open - Open a single file for reading and writing; see
+  Storage_OpenFiles.
+
+  Parameters:
+  => path - the file to open
+  => size - size of the file in bytes
+  => backend - the name of the backend, as listed at the top of this
+     file
+
+  Returns: As for Storage_OpenFiles.
+ */
+Storage * Storage_Open( const char * path, long long size,
+			const char * backend ) ;
+
+/*
+  Storage_OpenFiles - Open a list of files for reading and writing,
+  creating them and their directories if need be, and make each the
+  size given. A file is only truncated if its size is wrong, so that
+  an unchanged file keeps its modification time.
+
+  Parameters:
+  => numFiles - how many files (at least 1)
+  => paths - the files, in the order they are laid out
+  => sizes - size of each file in bytes; any may be 0
+  => backend - the name of the backend, as listed at the top of this
+     file
+
+  Returns: A pointer to an initialized Storage structure, or NULL if
+  the backend is unknown or a file cannot be opened with it, with
+  errno set.
+ */
+Storage * Storage_OpenFiles( int numFiles, char * const * paths,
+			     const long long * sizes, const char * backend ) ;
+
+/*
+  Storage_Close - close the files and free the Storage structure. Does
+  not flush anything; see Storage_Sync.
+
+  Parameters:
+  => s - Storage object pointer to close
+
+  Returns: Nothing.
+ */
+void Storage_Close( Storage * s ) ;
+
+/*
+  Storage_Read - read part of the storage.
+
+  Parameters:
+  => s - the Storage to read from
+  => buf - where to put the data
+  => offset - where in the storage to start
+  => length - how many bytes; the range must lie within the storage
+
+  Returns: 0 on success, or -1 on an I/O error, with errno set.
+ */
+int Storage_Read( Storage * s, void * buf, long long offset, int length ) ;
+
+/*
+  Storage_Readv - read part of the storage into several buffers, in
+  the manner of preadv().
+
+  Parameters:
+  => s - the Storage to read from
+  => iov - the buffers, filled in order
+  => iovcnt - how many buffers
+  => offset - where in the storage to start; the range must lie
+     within the storage
+
+  Returns: 0 on success, or -1 on an I/O error, with errno set.
+ */
+int Storage_Readv( Storage * s, const struct iovec * iov, int iovcnt,
+		   long long offset ) ;
+
+/*
+  Storage_Write - write part of the storage. The data is not
+  necessarily on the disk until Storage_Sync has been called for it.
+
+  Parameters:
+  => s - the Storage to write to
+  => buf - the data to write
+  => offset - where in the storage to start
+  => length - how many bytes; the range must lie within the storage
+
+  Returns: 0 on success, or -1 on an I/O error, with errno set.
+ */
+int Storage_Write( Storage * s, const void * buf, long long offset,
+		   int length ) ;
+
+/*
+  Storage_Writev - write several buffers to consecutive parts of the
+  storage, in the manner of pwritev().
+
+  Parameters:
+  => s - the Storage to write to
+  => iov - the buffers, written in order
+  => iovcnt - how many buffers
+  => offset - where in the storage to start; the range must lie
+     within the storage
+
+  Returns: 0 on success, or -1 on an I/O error, with errno set.
+ */
+int Storage_Writev( Storage * s, const struct iovec * iov, int iovcnt,
+		    long long offset ) ;
+
+/*
+  Storage_StartSync - start writing a range of the storage out to the
+  disk, without waiting for it to get there.
+
+  Parameters:
+  => s - the Storage to write out
+  => offset - where in the storage to start
+  => length - how many bytes
+
+  Returns: Nothing; this is only a hint.
+ */
+void Storage_StartSync( Storage * s, long long offset, long long length ) ;
+
+/*
+  Storage_Sync - make what has been written durable, and wait for it.
+
+  Parameters:
+  => s - the Storage to flush
+  => offset - where in the storage to start
+  => length - how many bytes, or 0 for everything
+
+  Returns: 0 on success, or -1 on an I/O error, with errno set.
+ */
+int Storage_Sync( Storage * s, long long offset, long long length ) ;
+
+/*
+  Storage_Advise - tell the kernel how a range of the storage is about
+  to be used. For STORAGE_DONTNEED, only the pages entirely inside
+  the range are dropped, so that neighbouring data stays cached.
+  STORAGE_NORMAL and STORAGE_SEQUENTIAL describe how the storage will
+  be read from now on, and apply to all of it whatever the range.
+
+  Parameters:
+  => s - the Storage the range is in
+  => offset - where in the storage to start
+  => length - how many bytes, or 0 for everything
+  => advice - one of the STORAGE_* advice values above
+
+  Returns: Nothing; this is only a hint.
+ */
+void Storage_Advise( Storage * s, long long offset, long long length,
+		     int advice ) ;
+
+/*
+  Storage_Stat - describe the files as they are on disk now.
+
+  Parameters:
+  => s - the Storage to describe
+  => size - set to the total size of the files
+  => mtime - set to the latest modification time of any of them
+
+  Returns: 0 on success, or -1 if a file cannot be examined, with
+  errno set.
+ */
+int Storage_Stat( Storage * s, long long * size, struct timespec * mtime ) ;
+
+/*
+  Storage_Alloc - allocate a buffer aligned for the direct backend.
+  Exits if there is no memory.
+
+  Parameters:
+  => size - size of the buffer in bytes
+
+  Returns: A pointer to the buffer, to be given back with free().
+ */
+void * Storage_Alloc( size_t size ) ;
+
+/*
+  Storage_Backend - the name of the backend in use.
+
+  Parameters:
+  => s - the Storage to query
+
+  Returns: The name of the backend, as listed at the top of this file.
+ */
+const char * Storage_Backend( Storage * s ) ;
+
+#endif
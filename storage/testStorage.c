@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "storage.h"
+
+static const char * names[] = { "mmap", "pread", "direct" };
+#define NUM_NAMES 3
+
+#define TEST_FILE "testStorage.dat"
+
+static double elapsed( struct timespec * start ) {
+  struct timespec end;
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( end.tv_sec - start->tv_sec ) * 1000.0 +
+    ( end.tv_nsec - start->tv_nsec ) / 1000000.0;
+}
+
+/*
+  checkContents - read the whole file back in uneven pieces and
+  compare it with what should be there.
+ */
+void checkContents( Storage * s, char * expected, int size ) {
+
+  int i, n;
+  char * buf = malloc( size + 1 );
+
+  for ( i = 0; i < size; i += n ) {
+    n = rand() % 100000;
+    if ( n > size - i ) {
+      n = size - i;
+    }
+    // Deliberately misaligned buffer
+    assert( ! Storage_Read( s, buf + 1, i, n ) );
+    assert( ! memcmp( buf + 1, expected + i, n ) );
+  }
+  free( buf );
+
+}
+
+/*
+  testBackend - write a file of awkward size with one backend, in
+  aligned pieces and in random patches, and read it back.
+ */
+void testBackend( const char * name, char * expected, int size ) {
+
+  int i, off, len;
+  int pieceSize = 65536;
+  char * piece = Storage_Alloc( pieceSize );
+  char * patch = malloc( 20000 );
+  struct stat before, after;
+
+  remove( TEST_FILE );
+  Storage * s = Storage_Open( TEST_FILE, size, name );
+  assert( s );
+  assert( ! strcmp( Storage_Backend( s ), name ) );
+
+  // Whole pieces from an aligned buffer, the last one short
+  for ( off = 0; off < size; off += pieceSize ) {
+    len = size - off < pieceSize ? size - off : pieceSize;
+    memcpy( piece, expected + off, len );
+    assert( ! Storage_Write( s, piece, off, len ) );
+  }
+  Storage_StartSync( s, 0, size );
+  checkContents( s, expected, size );
+
+  // Patches anywhere, including around the end of the file
+  for ( i = 0; i < 300; i ++ ) {
+    len = rand() % 20000;
+    off = i % 10 ? rand() % ( size - len ) : size - len;
+    for ( int j = 0; j < len; j ++ ) {
+      patch[j] = rand();
+    }
+    assert( ! Storage_Write( s, patch, off, len ) );
+    memcpy( expected + off, patch, len );
+  }
+  assert( ! Storage_Sync( s, 4096 + 17, 70000 ) );
+  assert( ! Storage_Sync( s, 0, 0 ) );
+  checkContents( s, expected, size );
+
+  // Advice must never change the contents
+  Storage_Advise( s, 0, 0, STORAGE_SEQUENTIAL );
+  Storage_Advise( s, 1000, 200000, STORAGE_WILLNEED );
+  Storage_Advise( s, 1000, 200000, STORAGE_DONTNEED );
+  Storage_Advise( s, 0, 0, STORAGE_DONTNEED );
+  Storage_Advise( s, 0, 0, STORAGE_NORMAL );
+  checkContents( s, expected, size );
+  Storage_Close( s );
+
+  // Reopening at the same size leaves the file alone
+  assert( ! stat( TEST_FILE, &before ) );
+  s = Storage_Open( TEST_FILE, size, name );
+  assert( s );
+  assert( ! stat( TEST_FILE, &after ) );
+  assert( before.st_size == size && after.st_size == size );
+  assert( before.st_mtim.tv_sec == after.st_mtim.tv_sec &&
+	  before.st_mtim.tv_nsec == after.st_mtim.tv_nsec );
+  checkContents( s, expected, size );
+  Storage_Close( s );
+
+  free( piece );
+  free( patch );
+
+}
+
+/*
+  testFiles - lay a list of awkwardly sized files end to end, more of
+  them than may be open at once, and check that vectored reads and
+  writes across their boundaries land in the right places.
+ */
+void testFiles( const char * name, char * data ) {
+
+  int i, j, numFiles = 3 * STORAGE_MAX_OPEN;
+  char * paths[ 3 * STORAGE_MAX_OPEN ];
+  long long sizes[ 3 * STORAGE_MAX_OPEN ];
+  long long total = 0, start, off, len, size;
+  char path[64];
+  struct iovec iov[3];
+  struct timespec mtime;
+  struct stat st;
+
+  assert( ! system( "rm -rf testStorage.d" ) );
+  for ( i = 0; i < numFiles; i ++ ) {
+    snprintf( path, sizeof( path ), "testStorage.d/%d/%d", i % 7, i );
+    paths[i] = strdup( path );
+    sizes[i] = i % 5 == 0 ? 0 : i % 5 == 1 ? 4096 : rand() % 20000;
+    total += sizes[i];
+  }
+
+  Storage * s = Storage_OpenFiles( numFiles, paths, sizes, name );
+  assert( s );
+  assert( s->size == total && ! s->map );
+  assert( s->numOpen <= STORAGE_MAX_OPEN );
+
+  // Three buffers at a time, crossing files as they come
+  for ( off = 0; off < total; off += len ) {
+    len = rand() % 50000;
+    if ( len > total - off ) {
+      len = total - off;
+    }
+    iov[0].iov_base = data + off;
+    iov[0].iov_len = rand() % ( len + 1 );
+    iov[1].iov_base = data + off + iov[0].iov_len;
+    iov[1].iov_len = rand() % ( len - iov[0].iov_len + 1 );
+    iov[2].iov_base = data + off + iov[0].iov_len + iov[1].iov_len;
+    iov[2].iov_len = len - iov[0].iov_len - iov[1].iov_len;
+    assert( ! Storage_Writev( s, iov, 3, off ) );
+  }
+  Storage_StartSync( s, 0, total );
+  assert( ! Storage_Sync( s, 1000, 100000 ) );
+  assert( ! Storage_Sync( s, 0, 0 ) );
+  checkContents( s, data, total );
+  assert( s->numOpen <= STORAGE_MAX_OPEN );
+
+  for ( i = 0; i < 200; i ++ ) {
+    char a[3000], b[40000];
+    off = rand() % ( total - sizeof( a ) - sizeof( b ) );
+    iov[0].iov_base = a;
+    iov[0].iov_len = sizeof( a );
+    iov[1].iov_base = b;
+    iov[1].iov_len = sizeof( b );
+    assert( ! Storage_Readv( s, iov, 2, off ) );
+    assert( ! memcmp( a, data + off, sizeof( a ) ) );
+    assert( ! memcmp( b, data + off + sizeof( a ), sizeof( b ) ) );
+  }
+  Storage_Advise( s, 0, 0, STORAGE_SEQUENTIAL );
+  Storage_Advise( s, 5000, 300000, STORAGE_WILLNEED );
+  Storage_Advise( s, 0, 0, STORAGE_DONTNEED );
+  Storage_Advise( s, 0, 0, STORAGE_NORMAL );
+  checkContents( s, data, total );
+
+  // Nothing may be read or written past the end
+  assert( Storage_Read( s, path, total - 10, 20 ) == -1 && errno == EINVAL );
+
+  // Each file holds its own part of the data
+  for ( i = 0, start = 0; i < numFiles; start += sizes[i ++] ) {
+    char * contents = malloc( sizes[i] + 1 );
+    FILE * f = fopen( paths[i], "rb" );
+    assert( f );
+    assert( fread( contents, 1, sizes[i] + 1, f ) == sizes[i] );
+    assert( ! memcmp( contents, data + start, sizes[i] ) );
+    fclose( f );
+    free( contents );
+  }
+
+  assert( ! Storage_Stat( s, &size, &mtime ) );
+  assert( size == total );
+  for ( i = 0; i < numFiles; i ++ ) {
+    assert( ! stat( paths[i], &st ) );
+    assert( st.st_mtim.tv_sec < mtime.tv_sec ||
+	    ( st.st_mtim.tv_sec == mtime.tv_sec &&
+	      st.st_mtim.tv_nsec <= mtime.tv_nsec ) );
+  }
+  Storage_Close( s );
+
+  // And the files are all still there when opened again
+  s = Storage_OpenFiles( numFiles, paths, sizes, name );
+  assert( s );
+  checkContents( s, data, total );
+  Storage_Close( s );
+
+  assert( ! system( "rm -rf testStorage.d" ) );
+  for ( j = 0; j < numFiles; j ++ ) {
+    free( paths[j] );
+  }
+
+}
+
+/*
+  benchmark - write a file in piece-sized chunks with each backend,
+  then read it back with the page cache dropped and again with
+  whatever the backend left cached.
+ */
+void benchmark( char * data, int size ) {
+
+  int i, b;
+  int pieceSize = 256 * 1024;
+  int numPieces = size / pieceSize;
+  char * buf = Storage_Alloc( pieceSize );
+  struct timespec start;
+  double write, cold, warm;
+
+  printf("Benchmarking on %d pieces of %d kB (MB/s)\n",
+	 numPieces, pieceSize / 1024 );
+
+  for ( b = 0; b < NUM_NAMES; b ++ ) {
+    remove( TEST_FILE );
+    Storage * s = Storage_Open( TEST_FILE, size, names[b] );
+    if ( ! s ) {
+      printf("  %-8s not supported here\n", names[b] );
+      continue;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < numPieces; i ++ ) {
+      memcpy( buf, data + (long long) i * pieceSize, pieceSize );
+      assert( ! Storage_Write( s, buf, (long long) i * pieceSize,
+			       pieceSize ) );
+    }
+    assert( ! Storage_Sync( s, 0, 0 ) );
+    write = elapsed( &start );
+
+    Storage_Advise( s, 0, 0, STORAGE_DONTNEED );
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < numPieces; i ++ ) {
+      assert( ! Storage_Read( s, buf, (long long) i * pieceSize,
+			      pieceSize ) );
+    }
+    cold = elapsed( &start );
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < numPieces; i ++ ) {
+      assert( ! Storage_Read( s, buf, (long long) i * pieceSize,
+			      pieceSize ) );
+    }
+    warm = elapsed( &start );
+
+    printf("  %-8s write: %8.1f, cold read: %8.1f, warm read: %8.1f\n",
+	   names[b], (double) size / write / 1000,
+	   (double) size / cold / 1000, (double) size / warm / 1000 );
+    Storage_Close( s );
+  }
+
+  remove( TEST_FILE );
+  free( buf );
+
+}
+
+int main( int argc, char ** argv ) {
+
+  int i;
+  int size = 128 * 1024 * 1024;
+  char * data = malloc( size );
+  for ( i = 0; i < size; i ++ ) {
+    data[i] = rand();
+  }
+
+  if ( argc > 1 && ! strcmp( argv[1], "bench" ) ) {
+    benchmark( data, size );
+    free( data );
+    return 0;
+  }
+
+  for ( i = 0; i < NUM_NAMES; i ++ ) {
+    Storage * s = Storage_Open( TEST_FILE, 4096, names[i] );
+    if ( ! s ) {
+      printf("Skipping %s backend, not supported here\n", names[i] );
+      continue;
+    }
+    Storage_Close( s );
+    printf("Testing %s backend\n", names[i] );
+    testBackend( names[i], data, 1000000 + 17 );
+    printf("Testing %s backend with %d files\n", names[i],
+	   3 * STORAGE_MAX_OPEN );
+    testFiles( names[i], data );
+  }
+
+  // Every backend sees what the others wrote
+  Storage * s = Storage_Open( TEST_FILE, 1000000 + 17, "pread" );
+  for ( i = 0; i < NUM_NAMES; i ++ ) {
+    Storage * other = Storage_Open( TEST_FILE, 1000000 + 17, names[i] );
+    if ( other ) {
+      checkContents( other, data, 1000000 + 17 );
+      Storage_Close( other );
+    }
+  }
+  Storage_Close( s );
+
+  assert( ! Storage_Open( TEST_FILE, 4096, "nonsense" ) && errno == EINVAL );
+  remove( TEST_FILE );
+
+  printf("PASS\n\n");
+
+  free( data );
+  return 0;
+
+}
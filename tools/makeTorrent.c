@@ -0,0 +1,503 @@
+
+/*
+  makeTorrent.c - create a .torrent file for a single file, or for a
+  directory of files. The input is read sequentially, several pieces
+  at a time into large buffers, while the pieces already read are
+  hashed on a HashPool, so that hashing scales with the number of
+  cores and the disk is never left idle.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+
+#include "../utils/bencode.h"
+#include "../HashPool/HashPool.h"
+#include "../sha1/sha1.h"
+
+// Default piece length (kB)
+#define DEFAULT_PIECE_KB 256
+
+// How much to read at a time (MB). Each buffer holds a whole number
+// of pieces, so that no piece is split between two of them.
+#define READ_BUFFER_MB 4
+
+/*
+  One file of the torrent, in the order its bytes are hashed.
+ */
+struct inputFile {
+  char * path;        // Path to open
+  char * relPath;     // Path within the torrent's directory
+  long long length;
+};
+
+/*
+  A buffer of pieces being hashed. It is refilled once every piece
+  in it has come back from the hash pool.
+ */
+struct readBuffer {
+  char * data;
+  HP_Job * jobs;      // One per piece the buffer can hold
+  int numPending;     // Jobs still on the hash pool
+};
+
+/*
+  State of the sequential read through every input file.
+ */
+struct reader {
+  struct inputFile * files;
+  int numFiles;
+  int current;        // File being read
+  int fd;             // Its descriptor, or -1 if not open yet
+  long long left;     // Bytes of it still to read
+};
+
+
+void * Malloc( size_t size ) {
+
+  void * toRet = malloc( size );
+  if ( ! toRet ) {
+    perror("malloc");
+    exit(1);
+  }
+  return toRet;
+
+}
+
+static double elapsed( struct timespec * start ) {
+
+  struct timespec end;
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( end.tv_sec - start->tv_sec ) +
+    ( end.tv_nsec - start->tv_nsec ) / 1000000000.0;
+
+}
+
+void usage( FILE * file ) {
+
+  fprintf( file,
+	   "makeTorrent [OPTIONS] path\n"
+	   "  -h          \t Print this help screen\n"
+	   "  -a url      \t Tracker announce URL (required)\n"
+	   "  -o file     \t Where to write the torrent (dflt: <name>.torrent)\n"
+	   "  -l kbytes   \t Piece length (dflt: %d)\n"
+	   "  -H threads  \t Threads for hashing (dflt: one per CPU)\n"
+	   "  -c comment  \t Comment to store in the torrent\n",
+	   DEFAULT_PIECE_KB );
+
+}
+
+/*
+  compareFiles - order files by their path within the torrent, so that
+  the same directory always makes the same torrent.
+ */
+static int compareFiles( const void * a, const void * b ) {
+
+  return strcmp( ( (struct inputFile *) a )->relPath,
+		 ( (struct inputFile *) b )->relPath );
+
+}
+
+/*
+  addFiles - add every regular file under a directory to the list,
+  with paths relative to the top of the torrent.
+ */
+static void addFiles( const char * dir, const char * relDir,
+		      struct inputFile ** files, int * numFiles,
+		      int * capacity ) {
+
+  DIR * d = opendir( dir );
+  struct dirent * ent;
+  struct stat st;
+
+  if ( ! d ) {
+    perror( dir );
+    exit(1);
+  }
+
+  while ( ( ent = readdir( d ) ) ) {
+    if ( ! strcmp( ent->d_name, "." ) || ! strcmp( ent->d_name, ".." ) ) {
+      continue;
+    }
+    char * path = Malloc( strlen( dir ) + strlen( ent->d_name ) + 2 );
+    char * relPath = Malloc( strlen( relDir ) + strlen( ent->d_name ) + 2 );
+    sprintf( path, "%s/%s", dir, ent->d_name );
+    sprintf( relPath, "%s%s%s", relDir, *relDir ? "/" : "", ent->d_name );
+    if ( stat( path, &st ) ) {
+      perror( path );
+      exit(1);
+    }
+
+    if ( S_ISDIR( st.st_mode ) ) {
+      addFiles( path, relPath, files, numFiles, capacity );
+      free( path );
+      free( relPath );
+    }
+    else if ( S_ISREG( st.st_mode ) ) {
+      if ( *numFiles == *capacity ) {
+	*capacity = *capacity ? 2 * *capacity : 16;
+	*files = realloc( *files, *capacity * sizeof( struct inputFile ) );
+	if ( ! *files ) {
+	  perror("realloc");
+	  exit(1);
+	}
+      }
+      (*files)[ *numFiles ].path = path;
+      (*files)[ *numFiles ].relPath = relPath;
+      (*files)[ *numFiles ].length = st.st_size;
+      (*numFiles) ++;
+    }
+    else {
+      free( path );
+      free( relPath );
+    }
+  }
+  closedir( d );
+
+}
+
+/*
+  fillBuffer - read the next size bytes of the torrent, moving from one
+  file to the next as each runs out. Each file is read for the length
+  it had when we listed it; if it has since shrunk, we give up.
+
+  Returns: The number of bytes read, which is only less than size at
+  the end of the last file.
+ */
+static long long fillBuffer( struct reader * r, char * buf, long long size ) {
+
+  long long got = 0;
+
+  while ( got < size && r->current < r->numFiles ) {
+    if ( r->fd < 0 ) {
+      r->fd = open( r->files[ r->current ].path, O_RDONLY );
+      if ( r->fd < 0 ) {
+	perror( r->files[ r->current ].path );
+	exit(1);
+      }
+      posix_fadvise( r->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+      r->left = r->files[ r->current ].length;
+    }
+    if ( r->left == 0 ) {
+      close( r->fd );
+      r->fd = -1;
+      r->current ++;
+      continue;
+    }
+    ssize_t n = read( r->fd, buf + got, 
+		      size - got < r->left ? size - got : r->left );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+	continue;
+      }
+      perror( r->files[ r->current ].path );
+      exit(1);
+    }
+    if ( n == 0 ) {
+      fprintf( stderr, "ERROR: %s shrank while being read\n",
+	       r->files[ r->current ].path );
+      exit(1);
+    }
+    r->left -= n;
+    got += n;
+  }
+  return got;
+
+}
+
+/*
+  hashPieces - compute the SHA1 of every piece of the input.
+
+  Returns: The concatenated digests, which the caller frees.
+ */
+static char * hashPieces( struct inputFile * files, int numFiles,
+			  long long totalSize, int pieceLength,
+			  int numThreads ) {
+
+  int numPieces = ( totalSize + pieceLength - 1 ) / pieceLength;
+  char * digests = Malloc( 20 * (long long) numPieces );
+  int piecesPerBuffer = (long long) READ_BUFFER_MB * 1024 * 1024 / pieceLength;
+  int numBuffers = numThreads + 2;
+  int i, nextPiece = 0, numDone = 0, more = 1;
+  long long hashed = 0;
+  struct reader r = { files, numFiles, 0, -1, 0 };
+  struct timespec start;
+  double lastReport = 0;
+
+  if ( piecesPerBuffer < 1 ) {
+    piecesPerBuffer = 1;
+  }
+  // No more buffers than there is data to fill
+  if ( numBuffers > ( numPieces + piecesPerBuffer - 1 ) / piecesPerBuffer ) {
+    numBuffers = ( numPieces + piecesPerBuffer - 1 ) / piecesPerBuffer;
+  }
+
+  struct readBuffer * bufs = Malloc( numBuffers * sizeof( struct readBuffer ) );
+  for ( i = 0; i < numBuffers; i ++ ) {
+    bufs[i].data = Malloc( (long long) piecesPerBuffer * pieceLength );
+    bufs[i].jobs = Malloc( piecesPerBuffer * sizeof( HP_Job ) );
+    bufs[i].numPending = 0;
+  }
+
+  HashPool * pool = HP_Init( numThreads );
+  clock_gettime( CLOCK_MONOTONIC, &start );
+
+  while ( numDone < numPieces ) {
+
+    // Keep every free buffer full, so the workers always have work
+    for ( i = 0; more && i < numBuffers; i ++ ) {
+      struct readBuffer * b = &bufs[i];
+      int k;
+      if ( b->numPending ) {
+	continue;
+      }
+      long long got = fillBuffer( &r, b->data,
+				  (long long) piecesPerBuffer * pieceLength );
+      if ( got < (long long) piecesPerBuffer * pieceLength ) {
+	more = 0;
+      }
+      for ( k = 0; k * (long long) pieceLength < got; k ++ ) {
+	HP_Job * job = &b->jobs[k];
+	job->data = b->data + (long long) k * pieceLength;
+	job->length = got - (long long) k * pieceLength < pieceLength ?
+	  got - (long long) k * pieceLength : pieceLength;
+	job->ctx = NULL;
+	job->load = NULL;
+	job->tag = nextPiece ++;
+	job->arg = b;
+	b->numPending ++;
+	HP_Submit( pool, job );
+      }
+    }
+
+    // Wait for some of them to come back
+    fd_set readFDs;
+    FD_ZERO( &readFDs );
+    FD_SET( HP_WaitFD( pool ), &readFDs );
+    if ( select( HP_WaitFD( pool ) + 1, &readFDs, NULL, NULL, NULL ) < 0 ) {
+      if ( errno == EINTR ) {
+	continue;
+      }
+      perror("select");
+      exit(1);
+    }
+    HP_Job * job = HP_Completed( pool );
+    while ( job ) {
+      memcpy( &digests[ 20 * (long long) job->tag ], job->digest, 20 );
+      ( (struct readBuffer *) job->arg )->numPending --;
+      hashed += job->length;
+      numDone ++;
+      job = job->next;
+    }
+
+    double seconds = elapsed( &start );
+    if ( seconds - lastReport >= 1 ) {
+      printf( "\rHashed %d/%d pieces (%.1f MB/s)", numDone, numPieces,
+	      hashed / seconds / 1000000 );
+      fflush( stdout );
+      lastReport = seconds;
+    }
+  }
+
+  double seconds = elapsed( &start );
+  printf( "\rHashed %d pieces, %.1f MB in %.2f s (%.1f MB/s) with "
+	  "%d threads, using %s SHA1\n", numPieces, hashed / 1000000.0,
+	  seconds, seconds > 0 ? hashed / seconds / 1000000 : 0,
+	  numThreads, Sha1_Backend() );
+
+  HP_Destroy( pool );
+  for ( i = 0; i < numBuffers; i ++ ) {
+    free( bufs[i].data );
+    free( bufs[i].jobs );
+  }
+  free( bufs );
+
+  return digests;
+
+}
+
+/*
+  pathList - split a relative path into the list of components the
+  multi-file info dictionary wants.
+ */
+static be_node * pathList( const char * relPath ) {
+
+  be_node * list = be_create_list();
+  const char * start = relPath;
+  const char * slash;
+
+  while ( ( slash = strchr( start, '/' ) ) ) {
+    be_list_add( list, be_create_str( start, slash - start ) );
+    start = slash + 1;
+  }
+  be_list_add( list, be_create_str( start, strlen( start ) ) );
+  return list;
+
+}
+
+int main( int argc, char ** argv ) {
+
+  int ch, i;
+  char * announce = NULL;
+  char * output = NULL;
+  char * comment = NULL;
+  int pieceLength = DEFAULT_PIECE_KB * 1024;
+  int numThreads = 0;
+  struct stat st;
+
+  while ( ( ch = getopt( argc, argv, "ha:o:l:H:c:" ) ) != -1 ) {
+    switch ( ch ) {
+    case 'h':
+      usage( stdout );
+      exit(0);
+    case 'a':
+      announce = optarg;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'l':
+      pieceLength = atoi( optarg ) * 1024;
+      break;
+    case 'H':
+      numThreads = atoi( optarg );
+      break;
+    case 'c':
+      comment = optarg;
+      break;
+    default:
+      usage( stderr );
+      exit(1);
+    }
+  }
+  if ( ! announce || optind != argc - 1 || pieceLength <= 0 ) {
+    usage( stderr );
+    exit(1);
+  }
+  if ( numThreads <= 0 ) {
+    numThreads = sysconf( _SC_NPROCESSORS_ONLN );
+  }
+
+  // The torrent is named after the last part of the path
+  char * path = strdup( argv[ optind ] );
+  while ( strlen( path ) > 1 && path[ strlen( path ) - 1 ] == '/' ) {
+    path[ strlen( path ) - 1 ] = '\0';
+  }
+  char * name = strrchr( path, '/' ) ? strrchr( path, '/' ) + 1 : path;
+
+  if ( stat( path, &st ) ) {
+    perror( path );
+    exit(1);
+  }
+
+  struct inputFile * files = NULL;
+  int numFiles = 0, capacity = 0;
+  int multiFile = S_ISDIR( st.st_mode );
+  if ( multiFile ) {
+    addFiles( path, "", &files, &numFiles, &capacity );
+    qsort( files, numFiles, sizeof( struct inputFile ), compareFiles );
+  }
+  else {
+    files = Malloc( sizeof( struct inputFile ) );
+    files[0].path = strdup( path );
+    files[0].relPath = strdup( name );
+    files[0].length = st.st_size;
+    numFiles = 1;
+  }
+
+  long long totalSize = 0;
+  for ( i = 0; i < numFiles; i ++ ) {
+    totalSize += files[i].length;
+  }
+  if ( totalSize == 0 ) {
+    fprintf( stderr, "ERROR: %s has no data to share\n", path );
+    exit(1);
+  }
+
+  char * digests = hashPieces( files, numFiles, totalSize, pieceLength,
+			       numThreads );
+  int numPieces = ( totalSize + pieceLength - 1 ) / pieceLength;
+
+  // Build the info dictionary, and the torrent around it
+  be_node * info = be_create_dict();
+  be_dict_add( info, "name", be_create_str( name, strlen( name ) ) );
+  be_dict_add( info, "piece length", be_create_int( pieceLength ) );
+  be_dict_add( info, "pieces",
+	       be_create_str( digests, 20 * (long long) numPieces ) );
+  if ( multiFile ) {
+    be_node * list = be_create_list();
+    for ( i = 0; i < numFiles; i ++ ) {
+      be_node * file = be_create_dict();
+      be_dict_add( file, "length", be_create_int( files[i].length ) );
+      be_dict_add( file, "path", pathList( files[i].relPath ) );
+      be_list_add( list, file );
+    }
+    be_dict_add( info, "files", list );
+  }
+  else {
+    be_dict_add( info, "length", be_create_int( totalSize ) );
+  }
+
+  long long infoLen;
+  char * infoData = be_encode( info, &infoLen );
+  unsigned char infoHash[20];
+  Sha1_Digest( infoData, infoLen, infoHash );
+  free( infoData );
+
+  be_node * torrent = be_create_dict();
+  be_dict_add( torrent, "announce",
+	       be_create_str( announce, strlen( announce ) ) );
+  if ( comment ) {
+    be_dict_add( torrent, "comment",
+		 be_create_str( comment, strlen( comment ) ) );
+  }
+  be_dict_add( torrent, "created by", be_create_str( "makeTorrent", 11 ) );
+  be_dict_add( torrent, "creation date", be_create_int( time( NULL ) ) );
+  be_dict_add( torrent, "info", info );
+
+  long long len;
+  char * data = be_encode( torrent, &len );
+
+  if ( ! output ) {
+    output = Malloc( strlen( name ) + strlen( ".torrent" ) + 1 );
+    sprintf( output, "%s.torrent", name );
+  }
+  FILE * out = fopen( output, "wb" );
+  if ( ! out ) {
+    perror( output );
+    exit(1);
+  }
+  if ( fwrite( data, 1, len, out ) != len || fclose( out ) ) {
+    perror( output );
+    exit(1);
+  }
+
+  printf( "Wrote %s: %d file%s, %lld bytes, %d pieces of %d kB\n",
+	  output, numFiles, numFiles == 1 ? "" : "s", totalSize,
+	  numPieces, pieceLength / 1024 );
+  printf( "Info hash: " );
+  for ( i = 0; i < 20; i ++ ) {
+    printf( "%02x", infoHash[i] );
+  }
+  printf( "\n" );
+
+  be_free( torrent );
+  free( data );
+  free( digests );
+  for ( i = 0; i < numFiles; i ++ ) {
+    free( files[i].path );
+    free( files[i].relPath );
+  }
+  free( files );
+  free( path );
+
+  return 0;
+
+}
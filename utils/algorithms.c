@@ -8,23 +8,42 @@
 
 #include "algorithms.h"
 
-int sortChunksComparator( const void * a, const void * b ) {
-  struct chunkInfo * ca = (struct chunkInfo *) a;
-  struct chunkInfo * cb = (struct chunkInfo *) b;
-  
-  return ca->prevalence - cb->prevalence  ;
-  
-}
+void sortChunks( struct torrentInfo * t ) {
 
+  int i, maxPrevalence, sum, count;
+  int * starts;
 
-void sortChunks( struct torrentInfo * t ) {
+  if ( t->numPrevalenceChanges <= 5 ) {
+    return;
+  }
+
+  maxPrevalence = 0;
+  for ( i = 0; i < t->numChunks; i ++ ) {
+    if ( t->prevalence[i] > maxPrevalence ) {
+      maxPrevalence = t->prevalence[i];
+    }
+  }
+
+  // Count the pieces at each prevalence, then turn the counts into
+  // the position where pieces of that prevalence start.
+  starts = Malloc( ( maxPrevalence + 1 ) * sizeof( int ) );
+  memset( starts, 0, ( maxPrevalence + 1 ) * sizeof( int ) );
+  for ( i = 0; i < t->numChunks; i ++ ) {
+    starts[ t->prevalence[i] ] ++;
+  }
+  sum = 0;
+  for ( i = 0; i <= maxPrevalence; i ++ ) {
+    count = starts[i];
+    starts[i] = sum;
+    sum += count;
+  }
+  for ( i = 0; i < t->numChunks; i ++ ) {
+    t->chunkOrdering[ starts[ t->prevalence[i] ] ++ ] = i;
+  }
+
+  free( starts );
+  t->numPrevalenceChanges = 0;
 
-  if ( t->numPrevalenceChanges > 5 ) {
-    qsort( t->chunkOrdering, t->numChunks, 
-	   sizeof( struct chunkInfo * ), 
-	   sortChunksComparator );
-    t->numPrevalenceChanges = 0;
-  } 
 }
 
 
@@ -43,16 +62,17 @@ void timeoutDetection( int sig, siginfo_t * si, void * uc ) {
 
 
   for ( i = 0; i < t->peerListLen; i ++ ) {
-    if ( t->peerList[i].defined &&
-	 tv.tv_sec - t->peerList[i].lastWrite > 3 &&
-	 tv.tv_sec - t->peerList[i].lastMessage > MAX_TIMEOUT_WAIT ) {
+    if ( peerAt( t, i )->defined &&
+	 tv.tv_sec - peerAt( t, i )->lastWrite > 3 &&
+	 tv.tv_sec - peerAt( t, i )->lastMessage > 
+	 idleTimeout( peerAt( t, i ) ) ) {
       /*
 	Stop talking to people who we've sent stuff to a while ago and
 	they haven't responded to us in a reasonable amount of time.
        */
       logToFile( t, "STATUS TIMEOUT %s:%d\n", 
-		 t->peerList[i].ipString, t->peerList[i].portNum );
-      destroyPeer( &t->peerList[i], t );
+		 peerAt( t, i )->ipString, peerAt( t, i )->portNum );
+      destroyPeer( peerAt( t, i ), t );
     }
   }
 
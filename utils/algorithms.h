@@ -14,17 +14,10 @@
 #include "../StringStream/StringStream.h"
 
 /*
-  sortChunksComparator - comparison function used to compare two chunks
-  by their prevalence. Returns less than zero, zero, or more than zero
-  if the first chunk is less than, equal to, or greater than the
-  second chunk.
- */
-int sortChunksComparator( const void * a, const void * b );
-
-
-/*
-  sortChunks - a wrapper around qsort for sorting chunks in the torrent
-  based on their prevalence (so that we request the rarest chunks first.
+  sortChunks - sort the chunks in the torrent based on their prevalence
+  (so that we request the rarest chunks first). Prevalence can be no
+  more than the number of peers, so this is a counting sort over the
+  prevalence array rather than a comparison sort.
 
   Parameters:
   => t - torrentInfo struct for current download
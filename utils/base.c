@@ -10,6 +10,17 @@
 // Minimum of two numbers
 int min( int a, int b ) { return a > b ? b : a; }
 
+unsigned long long getTimeMs( ) {
+
+  struct timespec ts;
+  if ( clock_gettime( CLOCK_MONOTONIC, &ts ) ) {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+}
+
 void * Malloc( size_t size ) {
 
   void * toRet = malloc( size );
@@ -57,8 +68,8 @@ void lookupIP( char * hostname, char * IP, int len ) {
 
 unsigned char * computeSHA1( char * data, int size ) {
 
-  unsigned char * toRet = Malloc( 20 ); // SHA_DIGEST_LENGTH
-  SHA1( (unsigned char*) data, size, toRet );
+  unsigned char * toRet = Malloc( SHA1_DIGEST_LENGTH );
+  Sha1_Digest( data, size, toRet );
   return toRet;
 
 }
@@ -93,6 +93,16 @@ handler_t * setupSignals(int signum, handler_t * handler) ;
  */
 void lookupIP( char * hostname, char * IP, int len ) ;
 
+/*
+  getTimeMs - read a monotonic clock, for measuring intervals that
+  must not jump when the wall clock is adjusted.
+
+  Parameters: None.
+
+  Returns: Milliseconds since some unspecified starting point.
+ */
+unsigned long long getTimeMs( ) ;
+
 /* Compute the minimum of a and b */
 int min( int a, int b );
 
@@ -281,6 +281,176 @@ void be_free(be_node *node)
 
 
 
+//copies a string into the layout the decoder uses, with its length
+//stored just before it
+ char *_be_alloc_str(const char *str, long long len)
+{
+	char *_ret = malloc(sizeof(len) + len + 1);
+	char *ret;
+	if (!_ret)
+		return NULL;
+	memcpy(_ret, &len, sizeof(len));
+	ret = _ret + sizeof(len);
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+	return ret;
+}
+
+ long long _be_raw_str_len(const char *str)
+{
+	long long ret;
+	memcpy(&ret, str - sizeof(ret), sizeof(ret));
+	return ret;
+}
+
+be_node *be_create_str(const char *str, long long len)
+{
+	be_node *ret = be_alloc(BE_STR);
+	if (ret)
+		ret->val.s = _be_alloc_str(str, len);
+	return ret;
+}
+
+be_node *be_create_int(long long i)
+{
+	be_node *ret = be_alloc(BE_INT);
+	if (ret)
+		ret->val.i = i;
+	return ret;
+}
+
+be_node *be_create_list(void)
+{
+	be_node *ret = be_alloc(BE_LIST);
+	if (ret)
+		ret->val.l = calloc(1, sizeof(*ret->val.l));
+	return ret;
+}
+
+be_node *be_create_dict(void)
+{
+	be_node *ret = be_alloc(BE_DICT);
+	if (ret)
+		ret->val.d = calloc(1, sizeof(*ret->val.d));
+	return ret;
+}
+
+void be_list_add(be_node *list, be_node *val)
+{
+	unsigned int i = 0;
+	while (list->val.l[i])
+		++i;
+	list->val.l = realloc(list->val.l, (i + 2) * sizeof(*list->val.l));
+	list->val.l[i] = val;
+	list->val.l[i + 1] = NULL;
+}
+
+/* keys are compared as raw bytes, as the specification requires */
+ int _be_key_cmp(const char *a, long long alen, const char *b, long long blen)
+{
+	int ret = memcmp(a, b, alen < blen ? alen : blen);
+	if (ret)
+		return ret;
+	return alen < blen ? -1 : alen > blen;
+}
+
+void be_dict_add(be_node *dict, const char *key, be_node *val)
+{
+	unsigned int i = 0, n = 0;
+	long long klen = strlen(key);
+
+	while (dict->val.d[n].val)
+		++n;
+	while (i < n && _be_key_cmp(dict->val.d[i].key,
+				    _be_raw_str_len(dict->val.d[i].key),
+				    key, klen) < 0)
+		++i;
+
+	dict->val.d = realloc(dict->val.d, (n + 2) * sizeof(*dict->val.d));
+	memmove(&dict->val.d[i + 1], &dict->val.d[i],
+		(n + 1 - i) * sizeof(*dict->val.d));
+	dict->val.d[i].key = _be_alloc_str(key, klen);
+	dict->val.d[i].val = val;
+}
+
+ long long _be_encoded_len(be_node *node)
+{
+	char buf[32];
+	long long ret = 0;
+	size_t i;
+
+	switch (node->type) {
+		case BE_STR:
+			ret = be_str_len(node);
+			return ret + sprintf(buf, "%lli:", ret);
+
+		case BE_INT:
+			return sprintf(buf, "i%llie", node->val.i);
+
+		case BE_LIST:
+			for (i = 0; node->val.l[i]; ++i)
+				ret += _be_encoded_len(node->val.l[i]);
+			return ret + 2;
+
+		case BE_DICT:
+			for (i = 0; node->val.d[i].val; ++i) {
+				long long klen = _be_raw_str_len(node->val.d[i].key);
+				ret += klen + sprintf(buf, "%lli:", klen);
+				ret += _be_encoded_len(node->val.d[i].val);
+			}
+			return ret + 2;
+	}
+	return ret;
+}
+
+ char *_be_encode_str(char *out, const char *str, long long len)
+{
+	out += sprintf(out, "%lli:", len);
+	memcpy(out, str, len);
+	return out + len;
+}
+
+ char *_be_encode(be_node *node, char *out)
+{
+	size_t i;
+
+	switch (node->type) {
+		case BE_STR:
+			return _be_encode_str(out, node->val.s, be_str_len(node));
+
+		case BE_INT:
+			return out + sprintf(out, "i%llie", node->val.i);
+
+		case BE_LIST:
+			*out++ = 'l';
+			for (i = 0; node->val.l[i]; ++i)
+				out = _be_encode(node->val.l[i], out);
+			*out++ = 'e';
+			return out;
+
+		case BE_DICT:
+			*out++ = 'd';
+			for (i = 0; node->val.d[i].val; ++i) {
+				out = _be_encode_str(out, node->val.d[i].key,
+						     _be_raw_str_len(node->val.d[i].key));
+				out = _be_encode(node->val.d[i].val, out);
+			}
+			*out++ = 'e';
+			return out;
+	}
+	return out;
+}
+
+char *be_encode(be_node *node, long long *len)
+{
+	/* one spare byte, for the terminator sprintf() writes last */
+	char *ret = malloc(_be_encoded_len(node) + 1);
+	if (!ret)
+		return NULL;
+	*len = _be_encode(node, ret) - ret;
+	return ret;
+}
+
  void _be_dump_indent(ssize_t indent)
 {
 	while (indent-- > 0)
@@ -17,6 +17,12 @@
  *  - pass the string full of the bencoded data to be_decode()
  *  - parse the resulting tree however you like
  *  - call be_free() on the tree to release resources
+ *
+ * To encode:
+ *  - build a tree with the be_create_*() functions, be_list_add() and
+ *    be_dict_add()
+ *  - pass it to be_encode() for the bencoded bytes
+ *  - call be_free() on the tree, and free() on the bytes
  */
 
 #ifndef _BENCODE_H
@@ -64,5 +70,21 @@ void be_free(be_node *node);
 //dump out the be_node encoding starting from the top
 void be_dump(be_node *node);
 
+//create nodes to encode; strings are copied, and may hold any bytes
+be_node *be_create_str(const char *str, long long len);
+be_node *be_create_int(long long i);
+be_node *be_create_list(void);
+be_node *be_create_dict(void);
+
+//append a node to a list; the list takes ownership of it
+void be_list_add(be_node *list, be_node *val);
+
+//add a key to a dictionary, keeping the keys sorted as the
+//specification requires; the dictionary takes ownership of val
+void be_dict_add(be_node *dict, const char *key, be_node *val);
+
+//encode a tree; returns a malloc()ed buffer and sets *len
+char *be_encode(be_node *node, long long *len);
+
 be_node * load_be_node(char * torrent_file);
 #endif
@@ -0,0 +1,300 @@
+
+/*
+  blame.c - function definitions for working out who sent us bad
+  data. Every block of a piece being downloaded is tagged with the
+  address it came from. When a piece fails its hash check, a lone
+  contributor takes the blame outright. Either way the digest of each
+  block is kept, and once a good copy of the piece arrives, whoever 
+  sent a block that differs from it is banned. A block that differs
+  between two failed copies proves nothing by itself, as one of them
+  may be the good one. A piece that failed after coming from several
+  peers is fetched from one address at a time after that, so the next
+  failure has somebody to blame.
+ */
+
+#include "blame.h"
+
+extern void destroyPeer( struct peerInfo * peer, struct torrentInfo * t );
+
+/*
+  blameRecordFor - find the record for an address, adding one if 
+  there is none yet.
+
+  Returns: Index of the record in t->blame.
+ */
+static int blameRecordFor( struct torrentInfo * t, const char * ip ) {
+
+  int i;
+  for ( i = 0; i < t->numBlame; i ++ ) {
+    if ( ! strcmp( t->blame[i].ip, ip ) ) {
+      return i;
+    }
+  }
+
+  if ( t->numBlame == t->blameCapacity ) {
+    int newCapacity = t->blameCapacity ? 2 * t->blameCapacity : 16;
+    t->blame = memRealloc( t, MEM_METADATA, t->blame,
+			   t->blameCapacity * sizeof( struct blameRecord ),
+			   newCapacity * sizeof( struct blameRecord ) );
+    t->blameCapacity = newCapacity;
+  }
+
+  strncpy( t->blame[ t->numBlame ].ip, ip, 16 );
+  t->blame[ t->numBlame ].strikes = 0;
+  t->blame[ t->numBlame ].banned = 0;
+  return t->numBlame ++;
+
+}
+
+static void ban( struct torrentInfo * t, int record, const char * why ) {
+
+  if ( t->blame[ record ].banned ) {
+    return;
+  }
+  t->blame[ record ].banned = 1;
+  t->bansPending = 1;
+  logToFile( t, "WARNING Banning %s: %s\n", t->blame[ record ].ip, why );
+
+}
+
+static void strike( struct torrentInfo * t, int record ) {
+
+  t->blame[ record ].strikes ++;
+  logToFile( t, "WARNING %s sent a bad piece (%d of %d allowed)\n",
+	     t->blame[ record ].ip, t->blame[ record ].strikes,
+	     MAX_HASH_STRIKES );
+  if ( t->blame[ record ].strikes >= MAX_HASH_STRIKES ) {
+    ban( t, record, "too many bad pieces" );
+  }
+
+}
+
+void recordBlockSource( struct torrentInfo * t, struct peerInfo * p,
+			int piece, int subChunk ) {
+
+  int k, n;
+  struct pieceSources * s = t->chunkSources[ piece ];
+
+  if ( ! s ) {
+    n = numSubChunks( t, piece );
+    s = memAlloc( t, MEM_METADATA, sizeof( struct pieceSources ) );
+    s->source = memAlloc( t, MEM_METADATA, n * sizeof( int ) );
+    for ( k = 0; k < n; k ++ ) {
+      s->source[k] = -1;
+    }
+    s->numSuspect = 0;
+    s->suspectSource = NULL;
+    s->suspect = NULL;
+    s->singleSource = 0;
+    s->owner = -1;
+    t->chunkSources[ piece ] = s;
+  }
+
+  if ( p->blameRecord < 0 ) {
+    p->blameRecord = blameRecordFor( t, p->ipString );
+  }
+  s->source[ subChunk ] = p->blameRecord;
+
+}
+
+void blameFailedPiece( struct torrentInfo * t, int piece ) {
+
+  int k, n = numSubChunks( t, piece );
+  int only = -1, several = 0;
+  struct pieceSources * s = t->chunkSources[ piece ];
+
+  if ( ! s ) {
+    return;
+  }
+
+  for ( k = 0; k < n; k ++ ) {
+    if ( only < 0 ) {
+      only = s->source[k];
+    }
+    else if ( s->source[k] != only ) {
+      several = 1;
+    }
+  }
+
+  if ( only < 0 ) {
+    return;
+  }
+
+  // Keep a fingerprint of every block, to compare against the good
+  // copy, making room by forgetting the oldest copy if need be
+  if ( s->numSuspect == MAX_FAILED_COPIES ) {
+    s->numSuspect --;
+    memmove( s->suspect, &s->suspect[ n * SHA1_DIGEST_LENGTH ],
+	     s->numSuspect * n * SHA1_DIGEST_LENGTH );
+    memmove( s->suspectSource, &s->suspectSource[ n ],
+	     s->numSuspect * n * sizeof( int ) );
+  }
+  else {
+    s->suspect = memRealloc( t, MEM_METADATA, s->suspect,
+			     s->numSuspect * n * SHA1_DIGEST_LENGTH,
+			     ( s->numSuspect + 1 ) * n * SHA1_DIGEST_LENGTH );
+    s->suspectSource = memRealloc( t, MEM_METADATA, s->suspectSource,
+				   s->numSuspect * n * sizeof( int ),
+				   ( s->numSuspect + 1 ) * n * sizeof( int ) );
+  }
+  unsigned char * digests = &s->suspect[ s->numSuspect * n *
+					 SHA1_DIGEST_LENGTH ];
+  int * sources = &s->suspectSource[ s->numSuspect * n ];
+  for ( k = 0; k < n; k ++ ) {
+    Sha1_Digest( &t->chunkData[piece][ k * SUBCHUNK_SIZE ],
+		 subChunkLength( t, piece, k ),
+		 &digests[ k * SHA1_DIGEST_LENGTH ] );
+    sources[k] = s->source[k];
+  }
+
+  s->numSuspect ++;
+
+  // A lone contributor is to blame outright. Otherwise we cannot tell
+  // which block was bad until a copy passes: one that differs from a
+  // failed copy may as well be the good one.
+  if ( ! several ) {
+    strike( t, only );
+  }
+
+  // Without a lone contributor we may not find out who was at fault,
+  // so have the next copy come from one address
+  if ( several && ! s->singleSource ) {
+    logToFile( t, "STATUS Piece %d came from several peers; fetching "
+	       "it from one at a time\n", piece );
+    s->singleSource = 1;
+  }
+  s->owner = -1;
+
+  for ( k = 0; k < n; k ++ ) {
+    s->source[k] = -1;
+  }
+
+}
+
+void blameGoodPiece( struct torrentInfo * t, int piece ) {
+
+  int c, k, n = numSubChunks( t, piece );
+  unsigned char digest[ SHA1_DIGEST_LENGTH ];
+  struct pieceSources * s = t->chunkSources[ piece ];
+
+  if ( s && s->numSuspect ) {
+    for ( k = 0; k < n; k ++ ) {
+      Sha1_Digest( &t->chunkData[piece][ k * SUBCHUNK_SIZE ],
+		   subChunkLength( t, piece, k ), digest );
+      for ( c = 0; c < s->numSuspect; c ++ ) {
+	if ( s->suspectSource[ c * n + k ] >= 0 &&
+	     memcmp( digest, 
+		     &s->suspect[ ( c * n + k ) * SHA1_DIGEST_LENGTH ],
+		     SHA1_DIGEST_LENGTH ) ) {
+	  ban( t, s->suspectSource[ c * n + k ], "sent a corrupt block" );
+	}
+      }
+    }
+  }
+
+  freePieceSources( t, piece );
+
+}
+
+int mayRequestPiece( struct torrentInfo * t, struct peerInfo * p,
+		     int piece ) {
+
+  struct pieceSources * s = t->chunkSources[ piece ];
+
+  if ( ! s || s->owner < 0 ) {
+    return 1;
+  }
+  if ( p->blameRecord < 0 ) {
+    p->blameRecord = blameRecordFor( t, p->ipString );
+  }
+  return s->owner == p->blameRecord;
+
+}
+
+void claimPiece( struct torrentInfo * t, struct peerInfo * p, int piece ) {
+
+  struct pieceSources * s = t->chunkSources[ piece ];
+
+  if ( ! s || ! s->singleSource || s->owner >= 0 ) {
+    return;
+  }
+  if ( p->blameRecord < 0 ) {
+    p->blameRecord = blameRecordFor( t, p->ipString );
+  }
+  logToFile( t, "STATUS Fetching piece %d from %s alone\n", piece,
+	     p->ipString );
+  s->owner = p->blameRecord;
+
+}
+
+void releasePieceClaim( struct torrentInfo * t, struct peerInfo * p,
+			int piece ) {
+
+  struct pieceSources * s = t->chunkSources[ piece ];
+
+  if ( s && s->owner >= 0 && s->owner == p->blameRecord ) {
+    s->owner = -1;
+    t->requestsReleased = 1;
+  }
+
+}
+
+void releasePieceClaims( struct peerInfo * p, struct torrentInfo * t ) {
+
+  int i;
+  if ( p->blameRecord < 0 ) {
+    return;
+  }
+  for ( i = 0; i < t->numChunks; i ++ ) {
+    releasePieceClaim( t, p, i );
+  }
+
+}
+
+int isBanned( struct torrentInfo * t, const char * ip ) {
+
+  int i;
+  for ( i = 0; i < t->numBlame; i ++ ) {
+    if ( t->blame[i].banned && ! strcmp( t->blame[i].ip, ip ) ) {
+      return 1;
+    }
+  }
+  return 0;
+
+}
+
+void dropBannedPeers( struct torrentInfo * t ) {
+
+  int i;
+
+  t->bansPending = 0;
+  for ( i = 0; i < t->peerListLen; i ++ ) {
+    struct peerInfo * p = peerAt( t, i );
+    if ( p->defined && isBanned( t, p->ipString ) ) {
+      logToFile( t, "STATUS Disconnecting banned peer %s:%d\n",
+		 p->ipString, p->portNum );
+      destroyPeer( p, t );
+    }
+  }
+
+}
+
+void freePieceSources( struct torrentInfo * t, int piece ) {
+
+  int n = numSubChunks( t, piece );
+  struct pieceSources * s = t->chunkSources[ piece ];
+
+  if ( ! s ) {
+    return;
+  }
+  memFree( t, MEM_METADATA, s->source, n * sizeof( int ) );
+  if ( s->suspect ) {
+    memFree( t, MEM_METADATA, s->suspect, 
+	     s->numSuspect * n * SHA1_DIGEST_LENGTH );
+    memFree( t, MEM_METADATA, s->suspectSource, 
+	     s->numSuspect * n * sizeof( int ) );
+  }
+  memFree( t, MEM_METADATA, s, sizeof( struct pieceSources ) );
+  t->chunkSources[ piece ] = NULL;
+
+}
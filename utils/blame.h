@@ -0,0 +1,150 @@
+#ifndef _BM_BT_BLAME
+#define _BM_BT_BLAME
+
+/*
+  blame.h - function declarations for working out who sent us bad
+  data. Every block of a piece being downloaded is tagged with the
+  address it came from. When a piece fails its hash check, a lone
+  contributor takes the blame outright. Either way the digest of each
+  block is kept, and once a good copy of the piece arrives, whoever 
+  sent a block that differs from it is banned. A block that differs
+  between two failed copies proves nothing by itself, as one of them
+  may be the good one. A piece that failed after coming from several
+  peers is fetched from one address at a time after that, so the next
+  failure has somebody to blame.
+ */
+
+#include "../common.h"
+#include "base.h"
+#include "requests.h"
+
+/*
+  recordBlockSource - note which peer sent a block of a piece.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => p - peerInfo struct for the peer that sent the block
+  => piece - piece number
+  => subChunk - subchunk number within the piece
+
+  Returns: Nothing.
+ */
+void recordBlockSource( struct torrentInfo * t, struct peerInfo * p,
+			int piece, int subChunk ) ;
+
+/*
+  blameFailedPiece - a piece has failed its hash check. Must be called
+  while its data is still in its buffer.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - piece number
+
+  Returns: Nothing.
+ */
+void blameFailedPiece( struct torrentInfo * t, int piece ) ;
+
+/*
+  blameGoodPiece - a piece has passed its hash check. If an earlier
+  copy failed, ban whoever sent blocks that differ from this one. Must
+  be called while the data is still where chunkData points.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - piece number
+
+  Returns: Nothing.
+ */
+void blameGoodPiece( struct torrentInfo * t, int piece ) ;
+
+/*
+  mayRequestPiece - may we ask a peer for blocks of a piece? After a
+  copy from several peers has failed, only one address may supply the
+  piece once it has been claimed with claimPiece().
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => p - peerInfo struct for the peer we would ask
+  => piece - piece number
+
+  Returns: 1 if we may ask them, 0 if not.
+ */
+int mayRequestPiece( struct torrentInfo * t, struct peerInfo * p,
+		     int piece ) ;
+
+/*
+  claimPiece - we have just asked a peer for a block of a piece. If
+  the piece must come from one address and nobody has claimed it, it
+  is theirs until the claim is released.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => p - peerInfo struct for the peer we asked
+  => piece - piece number
+
+  Returns: Nothing.
+ */
+void claimPiece( struct torrentInfo * t, struct peerInfo * p, int piece ) ;
+
+/*
+  releasePieceClaim - let other addresses supply a piece, if a peer
+  held the claim on it, because a request for it to them timed out.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => p - peerInfo struct for the peer
+  => piece - piece number
+
+  Returns: Nothing.
+ */
+void releasePieceClaim( struct torrentInfo * t, struct peerInfo * p,
+			int piece ) ;
+
+/*
+  releasePieceClaims - let other addresses supply the pieces a peer
+  was the only one allowed to, because they have choked us or gone.
+
+  Parameters:
+  => p - peerInfo struct for the peer
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void releasePieceClaims( struct peerInfo * p, struct torrentInfo * t ) ;
+
+/*
+  isBanned - have we banned an address?
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => ip - the address, as a dotted quad
+
+  Returns: 1 if it is banned, 0 if not.
+ */
+int isBanned( struct torrentInfo * t, const char * ip ) ;
+
+/*
+  dropBannedPeers - close every connection to a banned address. Bans
+  can be handed out while we are in the middle of handling a message
+  from the peer concerned, so connections are closed from the main 
+  loop instead. Only needs to be called when t->bansPending is set.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void dropBannedPeers( struct torrentInfo * t ) ;
+
+/*
+  freePieceSources - forget the sources of a piece's blocks.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - piece number
+
+  Returns: Nothing.
+ */
+void freePieceSources( struct torrentInfo * t, int piece ) ;
+
+#endif
@@ -12,6 +12,9 @@
 extern void * Malloc( size_t );
 extern void sendChoke( struct peerInfo *, struct torrentInfo * );
 extern void sendUnchoke( struct peerInfo *, struct torrentInfo * );
+extern struct peerInfo * peerAt( struct torrentInfo *, int );
+extern struct peerInfo * getPeer( struct torrentInfo *, peerHandle );
+extern peerHandle peerHandleOf( struct peerInfo * );
 
 int optimisticUnchoke( struct torrentInfo * t ) {
   /*
@@ -30,15 +33,15 @@ int optimisticUnchoke( struct torrentInfo * t ) {
 
   numInLottery = 0;
   for ( i = 0; i < t->peerListLen; i ++ ) {
-    if (! t->peerList[i].defined ) {
+    if (! peerAt( t, i )->defined ) {
       continue;
     }
-    if ( t->peerList[i].type == BT_PEER ) {
-      lottery[ numInLottery++ ] = &t->peerList[i];
-      if ( t->peerList[i].firstChokePass ) {
-	t->peerList[i].firstChokePass = 0;
-	lottery[ numInLottery++ ] = &t->peerList[i];
-	lottery[ numInLottery++ ] = &t->peerList[i];
+    if ( peerAt( t, i )->type == BT_PEER ) {
+      lottery[ numInLottery++ ] = peerAt( t, i );
+      if ( peerAt( t, i )->firstChokePass ) {
+	peerAt( t, i )->firstChokePass = 0;
+	lottery[ numInLottery++ ] = peerAt( t, i );
+	lottery[ numInLottery++ ] = peerAt( t, i );
       }
     }
   }
@@ -55,7 +58,12 @@ int optimisticUnchoke( struct torrentInfo * t ) {
     ret = 0;
   }
 
-  t->optimisticUnchoke = chosen;
+  if ( chosen ) {
+    t->optimisticUnchoke = peerHandleOf( chosen );
+  }
+  else {
+    t->optimisticUnchoke.slot = -1;
+  }
   free( lottery );
   return ret;
 
@@ -64,16 +72,16 @@ int optimisticUnchoke( struct torrentInfo * t ) {
 void unchokePeers( struct torrentInfo * t, int num ) {
 
   int i, j;
+  struct peerInfo * optimistic = getPeer( t, t->optimisticUnchoke );
 
   // Set willUnchoke to zero for all peers except the
   // optimisticllly unchoked one.
   for ( i = 0; i < t->peerListLen; i ++ ) {
-    if ( ! t->peerList[i].defined ) {
+    if ( ! peerAt( t, i )->defined ) {
       continue;
     }
-    if ( t->optimisticUnchoke &&
-	 ( t->optimisticUnchoke != &t->peerList[i] ) ) {
-      t->peerList[i].willUnchoke = 0;
+    if ( optimistic && optimistic != peerAt( t, i ) ) {
+      peerAt( t, i )->willUnchoke = 0;
     }
   }
   
@@ -83,23 +91,23 @@ void unchokePeers( struct torrentInfo * t, int num ) {
   for ( i = 0; i < num; i ++ ) {
     maxSpeed = maxIdx = -1;
     for ( j = 0; j < t->peerListLen; j ++ ) {
-      if ( ! t->peerList[j].defined ) {
+      if ( ! peerAt( t, j )->defined ) {
 	continue;
       }
-      if ( t->peerList[j].willUnchoke ) {
+      if ( peerAt( t, j )->willUnchoke ) {
 	continue;
       }
-      if ( ! t->peerList[j].peer_interested ) {
+      if ( ! peerAt( t, j )->peer_interested ) {
 	// Peer is not interested
 	continue;
       }
-      if ( t->peerList[j].downloadAmt > maxSpeed ) {
-	maxSpeed = t->peerList[j].downloadAmt ;
+      if ( peerAt( t, j )->downloadAmt > maxSpeed ) {
+	maxSpeed = peerAt( t, j )->downloadAmt ;
 	maxIdx = j;
       }
     }
     if ( maxIdx >= 0 ) {
-      t->peerList[ maxIdx ].willUnchoke = 1;
+      peerAt( t, maxIdx )->willUnchoke = 1;
     }
     else {
       // No more viable unchoking candidates.
@@ -110,17 +118,17 @@ void unchokePeers( struct torrentInfo * t, int num ) {
   /* Unchoke anybody who is uninterested but has sent
      us a lot of data */
   for ( i = 0; i < t->peerListLen; i ++ ) { 
-    if ( ! t->peerList[i].defined ) {
+    if ( ! peerAt( t, i )->defined ) {
       continue;
     }
-    if ( t->peerList[i].peer_interested ) {
+    if ( peerAt( t, i )->peer_interested ) {
       // Peer is interested - we've already
       // considered unchoking them
       continue;
     }
 
-    if ( t->peerList[i].downloadAmt > maxSpeed ) {
-      t->peerList[i].willUnchoke = 1;
+    if ( peerAt( t, i )->downloadAmt > maxSpeed ) {
+      peerAt( t, i )->willUnchoke = 1;
     }
   }
 
@@ -145,19 +153,19 @@ void sendChokeUnchokeMessages( struct torrentInfo * t ) {
   */
   int i;
   for ( i = 0; i < t->peerListLen; i ++ ) {
-    if ( t->peerList[i].defined == 0 ) {
+    if ( peerAt( t, i )->defined == 0 ) {
       continue;
     }
-    if ( t->peerList[i].willUnchoke &&
-	 t->peerList[i].am_choking == 1 ) {
-      sendUnchoke( &t->peerList[i], t );
-      t->peerList[i].am_choking = 0;
+    if ( peerAt( t, i )->willUnchoke &&
+	 peerAt( t, i )->am_choking == 1 ) {
+      sendUnchoke( peerAt( t, i ), t );
+      peerAt( t, i )->am_choking = 0;
     }
-    else if ( t->peerList[i].am_choking == 0 &&
-	      t->peerList[i].willUnchoke == 0 ) {
+    else if ( peerAt( t, i )->am_choking == 0 &&
+	      peerAt( t, i )->willUnchoke == 0 ) {
       // They were unchoked, now they are not
-      t->peerList[i].am_choking = 1;
-      sendChoke( &t->peerList[i], t );
+      peerAt( t, i )->am_choking = 1;
+      sendChoke( peerAt( t, i ), t );
     }
     else { 
       // Status was unchanged; do nothing
@@ -174,10 +182,9 @@ void manageChoking( struct torrentInfo * t ) {
     optimisticUnchoke ( t );
   }
 
+  struct peerInfo * optimistic = getPeer( t, t->optimisticUnchoke );
   int numRemainingUnchokes = 
-    4 - ( ( t->optimisticUnchoke &&
-	    t->optimisticUnchoke->defined &&
-	    t->optimisticUnchoke->peer_interested ) ? 1 : 0 );
+    4 - ( ( optimistic && optimistic->peer_interested ) ? 1 : 0 );
 
   // If this peer is interested, then choose 3 other interested peers
   // to also be unchoked. Otherwise, choose 4 interested peers to be
@@ -189,8 +196,8 @@ void manageChoking( struct torrentInfo * t ) {
   // Zero out download amounts for then ext round
   int i;
   for ( i = 0; i < t->peerListLen; i ++ ) {
-    if ( t->peerList[i].defined ) {
-      t->peerList[i].downloadAmt = 0;
+    if ( peerAt( t, i )->defined ) {
+      peerAt( t, i )->downloadAmt = 0;
     }
   }
 
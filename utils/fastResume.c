@@ -0,0 +1,192 @@
+
+/*
+  fastResume.c - function definitions for the fast-resume file, which
+  records which pieces of the save file we have already checked, so
+  that a restart does not have to hash them all again. It is kept next
+  to the save file, as <save file>.fastresume, and is only trusted if
+  the save file has not been touched since it was written. For a
+  torrent of several files, it is kept next to their directory, and
+  records their total size and the latest of their modification times.
+
+  The file holds, in host byte order:
+    "BTFR" | version | info hash (20) | save file size (8) |
+    mtime seconds (8) | mtime nanoseconds (8) | number of pieces (4) |
+    our bitfield in wire format
+ */
+
+#include "fastResume.h"
+
+#define FAST_RESUME_MAGIC "BTFR"
+#define FAST_RESUME_VERSION 1
+
+struct fastResumeHeader {
+  char magic[4];
+  int version;
+  unsigned char infoHash[20];
+  long long size;
+  long long mtimeSec;
+  long long mtimeNsec;
+  int numChunks;
+};
+
+/*
+  resumePath - name of the fast-resume file, with an optional suffix.
+  The caller frees it.
+ */
+static char * resumePath( struct torrentInfo * t, const char * suffix ) {
+
+  int len = strlen( t->name ) + strlen( ".fastresume" ) + 
+    strlen( suffix ) + 1;
+  char * path = Malloc( len );
+  snprintf( path, len, "%s.fastresume%s", t->name, suffix );
+  return path;
+
+}
+
+/*
+  fillHeader - describe the save files as they are now.
+ */
+static void fillHeader( struct torrentInfo * t, 
+			struct fastResumeHeader * h ) {
+
+  long long size;
+  struct timespec mtime;
+  if ( Storage_Stat( t->storage, &size, &mtime ) ) {
+    perror("Storage_Stat");
+    exit(1);
+  }
+
+  memset( h, 0, sizeof( *h ) );
+  memcpy( h->magic, FAST_RESUME_MAGIC, 4 );
+  h->version = FAST_RESUME_VERSION;
+  memcpy( h->infoHash, t->infoHash, 20 );
+  h->size = size;
+  h->mtimeSec = mtime.tv_sec;
+  h->mtimeNsec = mtime.tv_nsec;
+  h->numChunks = t->numChunks;
+
+}
+
+/*
+  durablePieces - the pieces the fast-resume file may vouch for: those
+  we have checked, and know to be on disk. Pieces assumed in seed mode
+  are not vouched for until checked, nor pieces the writeback thread
+  has not flushed yet. The caller destroys the bitfield.
+ */
+static Bitfield * durablePieces( struct torrentInfo * t ) {
+
+  Bitfield * toRet = Bitfield_Init( t->numChunks );
+
+  Bitfield_AndNot( toRet, t->ourBitfield, t->unflushed );
+  Bitfield_AndNot( toRet, toRet, t->flushing );
+  if ( t->unverified ) {
+    Bitfield_AndNot( toRet, toRet, t->unverified );
+  }
+  return toRet;
+
+}
+
+void saveFastResume( struct torrentInfo * t ) {
+
+  struct fastResumeHeader h;
+  char * path = resumePath( t, "" );
+  char * tmpPath = resumePath( t, ".tmp" );
+
+  // Only pieces that have been flushed are listed, so the modification
+  // time we record covers all of them
+  fillHeader( t, &h );
+
+  FILE * f = fopen( tmpPath, "wb" );
+  if ( ! f ) {
+    t->lastFastResume = getTimeMs();
+    logToFile( t, "WARNING Could not write fast-resume file %s\n", 
+	       tmpPath );
+    free( path );
+    free( tmpPath );
+    return;
+  }
+  Bitfield * verified = durablePieces( t );
+
+  if ( fwrite( &h, sizeof( h ), 1, f ) != 1 ||
+       fwrite( verified->buffer, verified->numBytes, 1, f ) != 1 ||
+       fflush( f ) || fsync( fileno( f ) ) ) {
+    logToFile( t, "WARNING Could not write fast-resume file %s\n", 
+	       tmpPath );
+    fclose( f );
+    remove( tmpPath );
+  }
+  else {
+    fclose( f );
+    if ( rename( tmpPath, path ) ) {
+      logToFile( t, "WARNING Could not rename fast-resume file %s\n", 
+		 tmpPath );
+    }
+    else {
+      t->fastResumeSaved = Bitfield_Count( verified );
+      logToFile( t, "STATUS Saved fast-resume file with %d pieces\n",
+		 t->fastResumeSaved );
+    }
+  }
+
+  t->lastFastResume = getTimeMs();
+  Bitfield_Destroy( verified );
+  free( path );
+  free( tmpPath );
+
+}
+
+int loadFastResume( struct torrentInfo * t ) {
+
+  struct fastResumeHeader h, expected;
+  char * path = resumePath( t, "" );
+  int i, numTrusted = 0;
+
+  FILE * f = fopen( path, "rb" );
+  free( path );
+  if ( ! f ) {
+    return 0;
+  }
+
+  fillHeader( t, &expected );
+  Bitfield * saved = Bitfield_Init( t->numChunks );
+  if ( fread( &h, sizeof( h ), 1, f ) != 1 ||
+       memcmp( &h, &expected, sizeof( h ) ) ||
+       fread( saved->buffer, saved->numBytes, 1, f ) != 1 ) {
+    logToFile( t, "INIT Fast-resume file does not match the save file; "
+	       "checking every piece\n" );
+    fclose( f );
+    Bitfield_Destroy( saved );
+    return 0;
+  }
+  fclose( f );
+
+  for ( i = 0; i < t->numChunks; i ++ ) {
+    if ( Bitfield_IsSet( saved, i ) ) {
+      Bitfield_Set( t->ourBitfield, i );
+      t->numBytesDownloaded += chunkLength( t, i );
+      numTrusted ++;
+    }
+  }
+  Bitfield_Destroy( saved );
+
+  t->fastResumeSaved = numTrusted;
+  logToFile( t, "INIT Fast-resume file lists %d/%d pieces\n",
+	     numTrusted, t->numChunks );
+  return numTrusted;
+
+}
+
+int fastResumeDue( struct torrentInfo * t, unsigned long long now ) {
+
+  Bitfield * verified;
+  int numVerified;
+
+  if ( now - t->lastFastResume < FAST_RESUME_INTERVAL * 1000 ) {
+    return 0;
+  }
+  verified = durablePieces( t );
+  numVerified = Bitfield_Count( verified );
+  Bitfield_Destroy( verified );
+  return numVerified != t->fastResumeSaved;
+
+}
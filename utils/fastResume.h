@@ -0,0 +1,56 @@
+#ifndef _BM_BT_FAST_RESUME
+#define _BM_BT_FAST_RESUME
+
+/*
+  fastResume.h - function declarations for the fast-resume file, which
+  records which pieces of the save file we have already checked, so
+  that a restart does not have to hash them all again. It is kept next
+  to the save file, as <save file>.fastresume, and is only trusted if
+  the save file has not been touched since it was written.
+ */
+
+#include "../common.h"
+#include "base.h"
+#include "requests.h"
+
+/*
+  saveFastResume - write the fast-resume file for our current
+  bitfield. The file is replaced atomically, so a crash part way
+  through leaves the previous one in place.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing. Failures are logged, and only cost a full check
+  on the next start.
+ */
+void saveFastResume( struct torrentInfo * t ) ;
+
+/*
+  loadFastResume - read the fast-resume file, if there is one, and
+  mark the pieces it lists as ones we have. It is only used if it was
+  written for this torrent, and the save file has the same size and
+  modification time as when it was written.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Number of pieces marked, or 0 if the file was missing or
+  did not match.
+ */
+int loadFastResume( struct torrentInfo * t ) ;
+
+/*
+  fastResumeDue - should the fast-resume file be saved again? True if
+  we have finished pieces since it was last saved, and it has been at
+  least FAST_RESUME_INTERVAL seconds.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => now - current time, as returned by getTimeMs()
+
+  Returns: 1 if it should be saved, 0 if not.
+ */
+int fastResumeDue( struct torrentInfo * t, unsigned long long now ) ;
+
+#endif
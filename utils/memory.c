@@ -0,0 +1,96 @@
+
+/*
+  memory.c - function definitions for accounting for the memory the
+  client uses, broken down by what it is used for. Categories with a
+  limit are checked before they grow, so that the client slows down
+  (refusing requests, pausing reads, pausing piece picking) rather
+  than using more memory.
+ */
+
+#include "memory.h"
+
+static const char * categoryNames[ MEM_NUM_CATEGORIES ] = {
+  "Pieces", "Upload Queues", "Receive Buffers", "Bitfields", "Metadata",
+  "Piece Cache"
+};
+
+void * memAlloc( struct torrentInfo * t, int category, size_t size ) {
+
+  void * toRet = Malloc( size );
+  t->memUsed[ category ] += size;
+  return toRet;
+
+}
+
+void * memRealloc( struct torrentInfo * t, int category, void * ptr,
+		   size_t oldSize, size_t newSize ) {
+
+  void * toRet = realloc( ptr, newSize );
+  if ( ! toRet ) {
+    perror("realloc");
+    exit(1);
+  }
+  t->memUsed[ category ] += (long long) newSize - (long long) oldSize;
+  return toRet;
+
+}
+
+void memFree( struct torrentInfo * t, int category, void * ptr, 
+	      size_t size ) {
+
+  free( ptr );
+  t->memUsed[ category ] -= size;
+
+}
+
+void memCharge( struct torrentInfo * t, int category, long long bytes ) {
+
+  t->memUsed[ category ] += bytes;
+
+}
+
+long long memUsed( struct torrentInfo * t, int category ) {
+
+  if ( category == MEM_PIECES ) {
+    return (long long) t->piecePool->numAllocated * t->piecePool->bufferSize;
+  }
+  return t->memUsed[ category ];
+
+}
+
+int memOverLimit( struct torrentInfo * t, int category ) {
+
+  return t->memLimit[ category ] > 0 &&
+    memUsed( t, category ) >= t->memLimit[ category ];
+
+}
+
+int maxMessageLength( struct torrentInfo * t ) {
+
+  // A PIECE message carries a block plus id, index and offset; a 
+  // BITFIELD message carries one bit per piece plus its id.
+  int pieceLen = 9 + SUBCHUNK_SIZE;
+  int bitfieldLen = 1 + t->ourBitfield->numBytes;
+  return pieceLen > bitfieldLen ? pieceLen : bitfieldLen;
+
+}
+
+void printMemoryStatus( struct torrentInfo * t ) {
+
+  int i;
+  long long total = 0;
+
+  for ( i = 0; i < MEM_NUM_CATEGORIES; i ++ ) {
+    long long used = memUsed( t, i );
+    total += used;
+    if ( t->memLimit[i] > 0 ) {
+      printf("%17s: %.1f kB (limit %.1f kB)\n", categoryNames[i], 
+	     1.0 * used / 1000, 1.0 * t->memLimit[i] / 1000 );
+    }
+    else {
+      printf("%17s: %.1f kB\n", categoryNames[i], 1.0 * used / 1000 );
+    }
+  }
+  printf("     Total Memory: %.1f kB\n", 1.0 * total / 1000 );
+
+}
@@ -0,0 +1,119 @@
+#ifndef _BM_BT_MEMORY
+#define _BM_BT_MEMORY
+
+/*
+  memory.h - function declarations for accounting for the memory the
+  client uses, broken down by what it is used for. Categories with a
+  limit are checked before they grow, so that the client slows down
+  (refusing requests, pausing reads, pausing piece picking) rather
+  than using more memory.
+ */
+
+#include "../common.h"
+#include "base.h"
+
+/*
+  memAlloc - allocate memory and count it against a category. Exits
+  on failure, like Malloc.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => category - one of the MEM_* categories
+  => size - number of bytes to allocate
+
+  Returns: Pointer to the allocated memory.
+ */
+void * memAlloc( struct torrentInfo * t, int category, size_t size ) ;
+
+/*
+  memRealloc - resize memory allocated with memAlloc, updating the
+  count for its category. Exits on failure.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => category - category the memory was allocated in
+  => ptr - memory to resize
+  => oldSize - current size of the memory
+  => newSize - size to resize to
+
+  Returns: Pointer to the resized memory.
+ */
+void * memRealloc( struct torrentInfo * t, int category, void * ptr,
+		   size_t oldSize, size_t newSize ) ;
+
+/*
+  memFree - free memory allocated with memAlloc.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => category - category the memory was allocated in
+  => ptr - memory to free
+  => size - size of the memory
+
+  Returns: Nothing.
+ */
+void memFree( struct torrentInfo * t, int category, void * ptr, 
+	      size_t size ) ;
+
+/*
+  memCharge - count memory allocated by some other means (a Bitfield,
+  say) against a category. Pass a negative number of bytes when it
+  is freed.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => category - one of the MEM_* categories
+  => bytes - number of bytes allocated (or freed, if negative)
+
+  Returns: Nothing.
+ */
+void memCharge( struct torrentInfo * t, int category, long long bytes ) ;
+
+/*
+  memUsed - how much memory is in use for a category? Piece buffers
+  are counted by the piece pool itself.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => category - one of the MEM_* categories
+
+  Returns: Number of bytes in use.
+ */
+long long memUsed( struct torrentInfo * t, int category ) ;
+
+/*
+  memOverLimit - has a category reached its limit? Categories without
+  a limit never have.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => category - one of the MEM_* categories
+
+  Returns: 1 if the category is at or over its limit; 0 otherwise.
+ */
+int memOverLimit( struct torrentInfo * t, int category ) ;
+
+/*
+  maxMessageLength - the longest message we accept from a peer. No
+  valid message is longer than a block or our bitfield, so anything
+  longer is refused rather than given a receive buffer.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Maximum message length in bytes, excluding the length prefix.
+ */
+int maxMessageLength( struct torrentInfo * t ) ;
+
+/*
+  printMemoryStatus - print how much memory each category is using,
+  for the status screen.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void printMemoryStatus( struct torrentInfo * t ) ;
+
+#endif
@@ -0,0 +1,186 @@
+
+/*
+  pieceCache.c - function definitions for the cache of whole pieces
+  that uploads are served from. See pieceCache.h.
+
+  The cache holds few pieces (megabytes over the piece size), so the
+  least recently used one is found by looking at them all when a slot
+  is needed, rather than by keeping them in order on every hit. The
+  same goes for finding a slot by its buffer.
+ */
+
+#include "pieceCache.h"
+
+void initPieceCache( struct torrentInfo * t, int megabytes ) {
+
+  int i;
+  int numSlots = (long long) megabytes * 1024 * 1024 / t->chunkSize;
+
+  t->cache = NULL;
+  if ( numSlots < 1 ) {
+    return;
+  }
+  if ( numSlots > t->numChunks ) {
+    numSlots = t->numChunks;
+  }
+
+  struct pieceCache * c = memAlloc( t, MEM_METADATA,
+				    sizeof( struct pieceCache ) );
+  c->numSlots = numSlots;
+  c->slots = memAlloc( t, MEM_METADATA,
+		       numSlots * sizeof( struct cachedPiece ) );
+  for ( i = 0; i < numSlots; i ++ ) {
+    c->slots[i].piece = -1;
+    c->slots[i].filling = 0;
+    c->slots[i].data = NULL;
+    c->slots[i].lastUse = 0;
+  }
+  c->slotOf = memAlloc( t, MEM_METADATA, t->numChunks * sizeof( int ) );
+  for ( i = 0; i < t->numChunks; i ++ ) {
+    c->slotOf[i] = -1;
+  }
+  c->useClock = 0;
+  c->hits = 0;
+  c->misses = 0;
+  c->bytesRead = 0;
+
+  t->memLimit[ MEM_CACHE ] = (long long) numSlots * t->chunkSize;
+  t->cache = c;
+  logToFile( t, "STARTUP Piece cache of %d pieces\n", numSlots );
+
+}
+
+/*
+  chooseSlot - find a slot for a piece: an empty one if there is one,
+  otherwise the least recently used. Slots being filled are skipped.
+
+  Returns: The slot number, or -1 if every slot is being filled.
+ */
+static int chooseSlot( struct pieceCache * c ) {
+
+  int i, oldest = -1;
+  for ( i = 0; i < c->numSlots; i ++ ) {
+    if ( c->slots[i].filling ) {
+      continue;
+    }
+    if ( c->slots[i].piece < 0 ) {
+      return i;
+    }
+    if ( oldest < 0 || c->slots[i].lastUse < c->slots[oldest].lastUse ) {
+      oldest = i;
+    }
+  }
+  return oldest;
+
+}
+
+char * cachedBlock( struct torrentInfo * t, int piece, int begin,
+		    int length ) {
+
+  struct pieceCache * c = t->cache;
+  int slot = c->slotOf[piece];
+
+  if ( slot < 0 || c->slots[slot].filling ) {
+    c->misses ++;
+    return NULL;
+  }
+  c->hits ++;
+  c->slots[slot].lastUse = ++ c->useClock;
+  return c->slots[slot].data + begin;
+
+}
+
+char * claimCacheSlot( struct torrentInfo * t, int piece ) {
+
+  struct pieceCache * c = t->cache;
+  int slot = chooseSlot( c );
+  if ( slot < 0 ) {
+    return NULL;
+  }
+
+  struct cachedPiece * s = &c->slots[slot];
+  if ( s->piece >= 0 ) {
+    c->slotOf[ s->piece ] = -1;
+  }
+  if ( ! s->data ) {
+    s->data = Storage_Alloc( t->chunkSize );
+    memCharge( t, MEM_CACHE, t->chunkSize );
+  }
+  s->piece = piece;
+  s->filling = 1;
+  c->slotOf[piece] = slot;
+  c->bytesRead += chunkLength( t, piece );
+  return s->data;
+
+}
+
+void finishCacheFill( struct torrentInfo * t, char * data, int valid ) {
+
+  struct pieceCache * c = t->cache;
+  int i;
+
+  for ( i = 0; c->slots[i].data != data; i ++ );
+  struct cachedPiece * s = &c->slots[i];
+  s->filling = 0;
+  if ( s->piece < 0 ) {
+    return; // Dropped while it was being read
+  }
+  if ( valid ) {
+    s->lastUse = ++ c->useClock;
+  }
+  else {
+    c->slotOf[ s->piece ] = -1;
+    s->piece = -1;
+  }
+
+}
+
+void dropCachedPiece( struct torrentInfo * t, int piece ) {
+
+  struct pieceCache * c = t->cache;
+  if ( ! c || c->slotOf[piece] < 0 ) {
+    return;
+  }
+  c->slots[ c->slotOf[piece] ].piece = -1;
+  c->slotOf[piece] = -1;
+
+}
+
+void printCacheStatus( struct torrentInfo * t ) {
+
+  struct pieceCache * c = t->cache;
+  if ( ! c ) {
+    return;
+  }
+  long long total = c->hits + c->misses;
+  double hitRate = total ? 100.0 * c->hits / total : 0;
+
+  printf("      Piece Cache: %lld hits, %lld misses (%.1f%% hits), "
+	 "%.1f kB read\n", c->hits, c->misses, hitRate,
+	 1.0 * c->bytesRead / 1000 );
+  logToFile( t, "STATUS Piece cache: %lld hits, %lld misses "
+	     "(%.1f%% hits), %.1f kB read\n", c->hits, c->misses, hitRate,
+	     1.0 * c->bytesRead / 1000 );
+
+}
+
+void destroyPieceCache( struct torrentInfo * t ) {
+
+  int i;
+  struct pieceCache * c = t->cache;
+  if ( ! c ) {
+    return;
+  }
+  for ( i = 0; i < c->numSlots; i ++ ) {
+    if ( c->slots[i].data ) {
+      free( c->slots[i].data );
+      memCharge( t, MEM_CACHE, - t->chunkSize );
+    }
+  }
+  memFree( t, MEM_METADATA, c->slotOf, t->numChunks * sizeof( int ) );
+  memFree( t, MEM_METADATA, c->slots,
+	   c->numSlots * sizeof( struct cachedPiece ) );
+  memFree( t, MEM_METADATA, c, sizeof( struct pieceCache ) );
+  t->cache = NULL;
+
+}
@@ -0,0 +1,141 @@
+#ifndef _BM_BT_PIECECACHE
+#define _BM_BT_PIECECACHE
+
+/*
+  pieceCache.h - function declarations for the cache of whole pieces
+  that uploads are served from. The first request for a block of a
+  piece on disk has the whole piece read into a slot of the cache in
+  one sequential read, so that the rest of its blocks, and the same
+  piece asked for by other peers, come from memory rather than from
+  small random reads of the save file. When the cache is full, the
+  least recently used piece makes way.
+
+  The cache only holds the slots. Filling one is a piece read on the
+  hash pool, which also checks the piece, while the requests for it
+  wait; see deferRequest() in messages/incomingMessages.c.
+
+  Pieces are only cached once they are in the save file; until then
+  they are served from their own buffers.
+ */
+
+#include "../common.h"
+#include "base.h"
+#include "requests.h"
+#include "memory.h"
+
+/*
+  A cachedPiece is one slot of the cache.
+ */
+struct cachedPiece {
+  int piece;                // The piece held, or -1 if none
+  int filling;              // Is it being read into?
+  char * data;              // Allocated when the slot is first used
+  unsigned long long lastUse;
+};
+
+struct pieceCache {
+  struct cachedPiece * slots;
+  int numSlots;
+  int * slotOf;             // Slot holding each piece, or -1
+  unsigned long long useClock;
+
+  // Blocks served from memory, and blocks that had to wait for a read
+  long long hits;
+  long long misses;
+  long long bytesRead;      // Read from the save file to fill slots
+};
+
+/*
+  initPieceCache - set up the piece cache for a torrent. The save
+  file must already be open.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => megabytes - how much memory the cache may use; if this is less
+     than a piece, there is no cache and t->cache is left NULL
+
+  Returns: Nothing.
+ */
+void initPieceCache( struct torrentInfo * t, int megabytes ) ;
+
+/*
+  cachedBlock - find a block of a piece we have on disk in the cache,
+  counting a hit if it is there and a miss if not.
+
+  Parameters:
+  => t - torrentInfo struct for current download; t->cache must be set
+  => piece - the piece number
+  => begin - offset of the block within the piece
+  => length - length of the block
+
+  Returns: A pointer to the block, valid until the cache is next
+  filled, or NULL if the piece is not cached (or still being read).
+ */
+char * cachedBlock( struct torrentInfo * t, int piece, int begin,
+		    int length ) ;
+
+/*
+  claimCacheSlot - take a slot for a piece to be read into: an empty
+  one, or the least recently used. Slots being filled are never
+  taken.
+
+  Parameters:
+  => t - torrentInfo struct for current download; t->cache must be set
+  => piece - the piece that is about to be read
+
+  Returns: The slot's buffer, at least a piece long and aligned for
+  the direct backend, or NULL if every slot is being filled.
+ */
+char * claimCacheSlot( struct torrentInfo * t, int piece ) ;
+
+/*
+  finishCacheFill - end the filling of a slot claimed with
+  claimCacheSlot. If the piece was read and checked, and has not been
+  dropped meanwhile, blocks of it are served from the slot from now on;
+  otherwise the slot is emptied.
+
+  Parameters:
+  => t - torrentInfo struct for current download; t->cache must be set
+  => data - the buffer claimCacheSlot returned
+  => valid - was the piece read and found good?
+
+  Returns: Nothing.
+ */
+void finishCacheFill( struct torrentInfo * t, char * data, int valid ) ;
+
+/*
+  dropCachedPiece - forget any cached copy of a piece, because what is
+  on disk is no longer to be trusted. A slot that is still being read
+  into is emptied when the read finishes. Does nothing if the cache is
+  off or the piece is not cached.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - the piece number
+
+  Returns: Nothing.
+ */
+void dropCachedPiece( struct torrentInfo * t, int piece ) ;
+
+/*
+  printCacheStatus - print and log how well the cache is doing. Does
+  nothing if the cache is off.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void printCacheStatus( struct torrentInfo * t ) ;
+
+/*
+  destroyPieceCache - free the cache and everything in it.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void destroyPieceCache( struct torrentInfo * t ) ;
+
+#endif
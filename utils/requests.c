@@ -0,0 +1,342 @@
+
+/*
+  requests.c - function definitions for managing the block requests
+  we send to peers. Requests are generated in response to events (a
+  peer unchoking us, telling us about new pieces, or delivering a
+  block) for just the peer involved, rather than by scanning every
+  connection on every pass through the main loop.
+ */
+
+#include "requests.h"
+#include "blame.h"
+
+/*
+  unmarkRequested - allow a block to be requested again. Pieces we have
+  already finished no longer have subchunk state, so leave them alone.
+ */
+static void unmarkRequested( struct torrentInfo * t, int piece,
+			     int subChunk ) {
+
+  if ( ! Bitfield_IsSet( t->ourBitfield, piece ) ) {
+    Bitfield_Clear( t->subChunksRequested, 
+		    subChunkIndex( t, piece, subChunk ) );
+  }
+
+}
+
+/*
+  sampleLatency - fold one measured request latency into a peer's
+  smoothed estimates and recompute their request timeout, following
+  RFC 6298 (srtt gain 1/8, rttvar gain 1/4, rto = srtt + 4 * rttvar).
+ */
+static void sampleLatency( struct peerInfo * p, int sample ) {
+
+  if ( p->numRttSamples == 0 ) {
+    p->srtt = sample;
+    p->rttvar = sample / 2;
+  }
+  else {
+    int err = sample - p->srtt;
+    p->rttvar += ( abs( err ) - p->rttvar ) / 4;
+    p->srtt += err / 8;
+  }
+  p->numRttSamples ++;
+
+  p->rto = p->srtt + 4 * p->rttvar;
+  if ( p->rto < MIN_REQUEST_TIMEOUT_MS ) {
+    p->rto = MIN_REQUEST_TIMEOUT_MS;
+  }
+  if ( p->rto > MAX_REQUEST_TIMEOUT_MS ) {
+    p->rto = MAX_REQUEST_TIMEOUT_MS;
+  }
+
+}
+
+/*
+  reclaimStalledPiece - find a partly downloaded piece that no peer we
+  are connected to has, so that it cannot be finished for now, and
+  start it over, taking its buffer for another piece. Peers that have
+  no pieces of it hold no requests for it. Seeds are not counted in
+  the prevalence, and have every piece, so with one connected there
+  is nothing to reclaim. Pieces only lose their sources when a
+  connection closes, so the search is skipped unless one has closed
+  since the last search that came up empty.
+
+  Returns: The piece's buffer, or NULL if no piece is stalled.
+ */
+static char * reclaimStalledPiece( struct torrentInfo * t ) {
+
+  int i, k;
+  char * buffer;
+
+  if ( ! t->sourcesLost || t->numSeeds > 0 ) {
+    return NULL;
+  }
+  for ( i = 0; i < t->numChunks; i ++ ) {
+    if ( ! t->chunkData[i] || t->prevalence[i] > 0 ||
+	 Bitfield_IsSet( t->ourBitfield, i ) ||
+	 t->numSubChunksReceived[i] == numSubChunks( t, i ) ) {
+      continue;
+    }
+    logToFile( t, "STATUS Piece %d has no sources left; giving its "
+	       "buffer to another piece\n", i );
+    for ( k = 0; k < numSubChunks( t, i ); k ++ ) {
+      Bitfield_Clear( t->subChunksReceived, subChunkIndex( t, i, k ) );
+      Bitfield_Clear( t->subChunksRequested, subChunkIndex( t, i, k ) );
+    }
+    t->numSubChunksReceived[i] = 0;
+    Bitfield_Clear( t->chunksRequested, i );
+    free( t->chunkHashState[i] );
+    t->chunkHashState[i] = NULL;
+    buffer = t->chunkData[i];
+    t->chunkData[i] = NULL;
+    return buffer;
+  }
+  t->sourcesLost = 0;
+  return NULL;
+
+}
+
+int chunkLength( struct torrentInfo * t, int piece ) {
+
+  if ( piece == t->numChunks - 1 && t->totalSize % t->chunkSize ) {
+    return t->totalSize % t->chunkSize;
+  }
+  return t->chunkSize;
+
+}
+
+int numSubChunks( struct torrentInfo * t, int piece ) {
+
+  return ( chunkLength( t, piece ) + SUBCHUNK_SIZE - 1 ) / SUBCHUNK_SIZE;
+
+}
+
+int subChunkIndex( struct torrentInfo * t, int piece, int subChunk ) {
+
+  return piece * t->subChunksPerChunk + subChunk;
+
+}
+
+int subChunkLength( struct torrentInfo * t, int piece, int subChunk ) {
+
+  return min( SUBCHUNK_SIZE, 
+	      chunkLength( t, piece ) - subChunk * SUBCHUNK_SIZE );
+
+}
+
+void fillRequests( struct peerInfo * p, struct torrentInfo * t ) {
+
+  int i, k, n, noBuffer = 0;
+
+  // Nothing to ask for, or no way to ask for it. Their unchoke 
+  // or have messages will bring us back here.
+  if ( ! p->defined || p->numWanted == 0 || p->peer_choking ||
+       p->numPendingSubchunks >= MAX_PENDING_SUBCHUNKS ) {
+    return;
+  }
+
+  // Until the save file has been checked, we don't know what we 
+  // need. The end of the check brings us back here.
+  if ( t->resumeChecked < t->numChunks ) {
+    return;
+  }
+
+  // Make sure we are asking for the rarest pieces first
+  sortChunks( t );
+
+  for ( i = 0; i < t->numChunks; i ++ ) {
+
+    int idx = t->chunkOrdering[i];
+
+    if ( Bitfield_IsSet( t->ourBitfield, idx ) ||
+	 ! Bitfield_IsSet( p->haveBlocks, idx ) ||
+	 ( noBuffer && ! t->chunkData[idx] ) ||
+	 ! mayRequestPiece( t, p, idx ) ) {
+      continue;
+    }
+
+    // Our peer has this chunk, and we want it.
+    n = numSubChunks( t, idx );
+    for ( k = 0; k < n; k ++ ) {
+      if ( p->numPendingSubchunks >= MAX_PENDING_SUBCHUNKS ) {
+	return;
+      }
+      if ( ! Bitfield_IsSet( t->subChunksReceived, 
+			     subChunkIndex( t, idx, k ) ) &&
+	   ! Bitfield_IsSet( t->subChunksRequested,
+			     subChunkIndex( t, idx, k ) ) ) {
+	// Only start pieces we have room to hold, making room if a
+	// partly downloaded piece has lost all its sources
+	if ( ! t->chunkData[idx] && 
+	     ! ( t->chunkData[idx] = BP_Acquire( t->piecePool ) ) &&
+	     ! ( t->chunkData[idx] = reclaimStalledPiece( t ) ) ) {
+	  // Nor for any other new piece; finish the ones we have
+	  noBuffer = 1;
+	  break;
+	}
+	sendPieceRequest( p, t, idx, k );
+	recordRequest( p, t, idx, k );
+	claimPiece( t, p, idx );
+      }
+    }
+  }
+
+}
+
+void updateInterest( struct peerInfo * p, struct torrentInfo * t ) {
+
+  if ( p->numWanted > 0 && ! p->am_interested ) {
+    p->am_interested = 1;
+    sendInterested( p, t );
+  }
+  else if ( p->numWanted == 0 && p->am_interested ) {
+    p->am_interested = 0;
+    sendNotInterested( p, t );
+  }
+
+}
+
+void pieceAcquired( struct torrentInfo * t, int piece ) {
+
+  int i;
+
+  for ( i = 0; i < t->peerListLen; i ++ ) {
+    struct peerInfo * p = peerAt( t, i );
+    if ( p->defined && Bitfield_IsSet( p->haveBlocks, piece ) ) {
+      p->numWanted --;
+      updateInterest( p, t );
+    }
+  }
+
+}
+
+void pieceLost( struct torrentInfo * t, int piece ) {
+
+  int i;
+
+  for ( i = 0; i < t->peerListLen; i ++ ) {
+    struct peerInfo * p = peerAt( t, i );
+    if ( p->defined && Bitfield_IsSet( p->haveBlocks, piece ) ) {
+      p->numWanted ++;
+      updateInterest( p, t );
+    }
+  }
+
+}
+
+void fillAllRequests( struct torrentInfo * t ) {
+
+  int i;
+
+  t->requestsReleased = 0;
+
+  for ( i = 0; i < t->peerListLen; i ++ ) {
+    if ( peerAt( t, i )->defined ) {
+      fillRequests( peerAt( t, i ), t );
+    }
+  }
+
+}
+
+void recordRequest( struct peerInfo * p, struct torrentInfo * t,
+		    int piece, int subChunk ) {
+
+  struct pendingRequest * r = &p->pending[ p->numPendingSubchunks ++ ];
+  r->piece = piece;
+  r->subChunk = subChunk;
+  r->sentTime = getTimeMs();
+  r->deadline = r->sentTime + p->rto;
+
+  Bitfield_Set( t->subChunksRequested, 
+		subChunkIndex( t, piece, subChunk ) );
+  Bitfield_Set( t->chunksRequested, piece );
+
+  if ( r->deadline < t->nextRequestDeadline ) {
+    t->nextRequestDeadline = r->deadline;
+  }
+
+}
+
+int completeRequest( struct peerInfo * p, int piece, int subChunk ) {
+
+  int i;
+  for ( i = 0; i < p->numPendingSubchunks; i ++ ) {
+    if ( p->pending[i].piece == piece &&
+	 p->pending[i].subChunk == subChunk ) {
+      // Expired requests are dropped from this table, so anything
+      // we find here was only ever sent once and is a clean sample.
+      sampleLatency( p, getTimeMs() - p->pending[i].sentTime );
+      p->pending[i] = p->pending[ -- p->numPendingSubchunks ];
+      return 1;
+    }
+  }
+  return 0;
+
+}
+
+void releaseRequests( struct peerInfo * p, struct torrentInfo * t ) {
+
+  int i;
+  for ( i = 0; i < p->numPendingSubchunks; i ++ ) {
+    unmarkRequested( t, p->pending[i].piece, p->pending[i].subChunk );
+  }
+  if ( p->numPendingSubchunks > 0 ) {
+    t->requestsReleased = 1;
+  }
+  p->numPendingSubchunks = 0;
+  // Nor should they hold up a piece only they were to supply
+  releasePieceClaims( p, t );
+
+}
+
+int idleTimeout( struct peerInfo * p ) {
+
+  int limit = IDLE_TIMEOUT_MULTIPLE * p->rto / 1000;
+  if ( p->numPendingSubchunks == 0 || limit < MAX_TIMEOUT_WAIT ) {
+    limit = MAX_TIMEOUT_WAIT;
+  }
+  return limit;
+
+}
+
+void expireRequests( struct torrentInfo * t, unsigned long long now ) {
+
+  int i, j, expired;
+  unsigned long long deadline = ~0ULL;
+
+  for ( i = 0; i < t->peerListLen; i ++ ) {
+    struct peerInfo * p = peerAt( t, i );
+    if ( ! p->defined ) {
+      continue;
+    }
+    j = 0;
+    expired = 0;
+    while ( j < p->numPendingSubchunks ) {
+      struct pendingRequest * r = &p->pending[j];
+      if ( r->deadline <= now ) {
+	logToFile( t, "STATUS REQUEST %d.%d TO %s:%d TIMED OUT (%d ms)\n",
+		   r->piece, r->subChunk, p->ipString, p->portNum, 
+		   (int)( r->deadline - r->sentTime ) );
+	unmarkRequested( t, r->piece, r->subChunk );
+	// Nor may a silent peer hold up a piece only they were to supply
+	releasePieceClaim( t, p, r->piece );
+	*r = p->pending[ -- p->numPendingSubchunks ];
+	t->requestsReleased = 1;
+	expired = 1;
+	continue;
+      }
+      if ( r->deadline < deadline ) {
+	deadline = r->deadline;
+      }
+      j ++;
+    }
+    if ( expired ) {
+      // Back off, as TCP does, until they answer something again
+      p->rto = min( 2 * p->rto, MAX_REQUEST_TIMEOUT_MS );
+    }
+  }
+
+  t->nextRequestDeadline = deadline;
+
+}
@@ -0,0 +1,203 @@
+#ifndef _BM_BT_REQUESTS
+#define _BM_BT_REQUESTS
+
+/*
+  requests.h - function declarations for managing the block requests
+  we send to peers. Requests are generated in response to events (a
+  peer unchoking us, telling us about new pieces, or delivering a
+  block) for just the peer involved, rather than by scanning every
+  connection on every pass through the main loop.
+ */
+
+#include "../common.h"
+#include "base.h"
+#include "algorithms.h"
+#include "../messages/outgoingMessages.h"
+
+/*
+  chunkLength - how many bytes are in a piece? All are chunkSize,
+  except possibly the last one.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - piece number
+
+  Returns: Length of the piece in bytes.
+ */
+int chunkLength( struct torrentInfo * t, int piece ) ;
+
+/*
+  numSubChunks - how many subchunks is a piece broken into?
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - piece number
+
+  Returns: Number of subchunks in the piece.
+ */
+int numSubChunks( struct torrentInfo * t, int piece ) ;
+
+/*
+  subChunkIndex - where the state of a subchunk lives in the torrent's
+  subChunksRequested and subChunksReceived bitfields.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - piece number
+  => subChunk - subchunk number within the piece
+
+  Returns: Bit number for this subchunk.
+ */
+int subChunkIndex( struct torrentInfo * t, int piece, int subChunk ) ;
+
+/*
+  subChunkLength - how many bytes are in a subchunk? All are 
+  SUBCHUNK_SIZE, except possibly the last one of the last piece.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - piece number
+  => subChunk - subchunk number within the piece
+
+  Returns: Length of the subchunk in bytes.
+ */
+int subChunkLength( struct torrentInfo * t, int piece, int subChunk ) ;
+
+/*
+  fillRequests - top up the request queue of a single peer. Picks the
+  rarest pieces that the peer has and that we still need, and requests
+  blocks from them until the peer has MAX_PENDING_SUBCHUNKS requests
+  outstanding. Returns immediately if they have nothing we want or are
+  choking us. If the piece pool is empty, a partly downloaded piece
+  that no connected peer has gives up its buffer.
+
+  Parameters:
+  => p - peerInfo struct for the peer whose queue we are filling
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void fillRequests( struct peerInfo * p, struct torrentInfo * t ) ;
+
+/*
+  updateInterest - send an INTERESTED or NOT INTERESTED message if the
+  number of pieces a peer has that we want has moved to or from zero
+  since we last told them.
+
+  Parameters:
+  => p - peerInfo struct for the peer whose numWanted changed
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void updateInterest( struct peerInfo * p, struct torrentInfo * t ) ;
+
+/*
+  pieceAcquired - we no longer want a piece. Update the wanted counts
+  of every peer that has it, and tell those that now have nothing
+  left for us that we are not interested.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - the piece we have just finished
+
+  Returns: Nothing.
+ */
+void pieceAcquired( struct torrentInfo * t, int piece ) ;
+
+/*
+  pieceLost - we want a piece again, having found that the copy we 
+  thought we had is bad. The reverse of pieceAcquired().
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - the piece we no longer have
+
+  Returns: Nothing.
+ */
+void pieceLost( struct torrentInfo * t, int piece ) ;
+
+/*
+  fillAllRequests - top up the request queues of every connected peer.
+  Only used when blocks have been given back by some other peer (choke,
+  timeout, disconnect), so that they are re-requested immediately.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void fillAllRequests( struct torrentInfo * t ) ;
+
+/*
+  recordRequest - note that a block request has been sent to a peer,
+  so that it can be matched against the response or expired later.
+
+  Parameters:
+  => p - peerInfo struct for the peer the request was sent to
+  => t - torrentInfo struct for current download
+  => piece - piece number requested
+  => subChunk - subchunk number within the piece
+
+  Returns: Nothing.
+ */
+void recordRequest( struct peerInfo * p, struct torrentInfo * t,
+		    int piece, int subChunk ) ;
+
+/*
+  completeRequest - match a received block against the requests that
+  are outstanding to the peer that sent it, and remove the request.
+  The time the request took is used to update the peer's latency
+  estimates and request timeout.
+
+  Parameters:
+  => p - peerInfo struct for the peer that sent the block
+  => piece - piece number received
+  => subChunk - subchunk number within the piece
+
+  Returns: 1 if the block matched an outstanding request; 0 if it did
+  not (for instance because the request had already expired).
+ */
+int completeRequest( struct peerInfo * p, int piece, int subChunk ) ;
+
+/*
+  releaseRequests - give back every request outstanding to a peer, so
+  that the blocks can be requested from somebody else, along with any
+  piece they alone were to supply (see mayRequestPiece() in blame.h).
+  Used when a peer chokes us or disconnects.
+
+  Parameters:
+  => p - peerInfo struct for the peer whose requests are released
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void releaseRequests( struct peerInfo * p, struct torrentInfo * t ) ;
+
+/*
+  expireRequests - give back every request that has been outstanding
+  for longer than its peer's request timeout, and back off that timeout.
+  Only needs to be called once t->nextRequestDeadline has passed; 
+  recomputes the deadline.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => now - current time, as returned by getTimeMs()
+
+  Returns: Nothing.
+ */
+void expireRequests( struct torrentInfo * t, unsigned long long now ) ;
+
+/*
+  idleTimeout - how long a peer may go without sending us anything
+  before we disconnect them. Peers we are waiting on get a multiple of
+  their request timeout, so slow links are not abandoned prematurely.
+
+  Parameters:
+  => p - peerInfo struct for the peer in question
+
+  Returns: Timeout in seconds; never less than MAX_TIMEOUT_WAIT.
+ */
+int idleTimeout( struct peerInfo * p ) ;
+
+#endif
@@ -0,0 +1,182 @@
+
+/*
+  scrub.c - function definitions for the background scrub, which
+  hashes the pieces we have on disk again, one at a time and no faster
+  than a set rate, so that a long-running seed notices when its save
+  file rots or is changed under it. Pieces that fail are dropped from
+  our bitfield and downloaded again.
+
+  The rate is kept with a token bucket: scrubCredit grows by scrubRate
+  bytes a second, up to a second's worth or one piece, whichever is
+  larger, and a piece is only started once there is credit for all of
+  it. Uploads come first; while more than a piece is queued to go out,
+  the scrub waits.
+ */
+
+#include "scrub.h"
+
+extern void forgetPiece( struct torrentInfo * torrent, int idx );
+extern void adviseRange( struct torrentInfo * t, int piece, int advice );
+extern void readPieceJob( struct torrentInfo * t, HP_Job * job, int piece,
+			  char * buffer );
+
+/*
+  reportScrub - log how much the scrub has checked since the last
+  report, and how fast.
+ */
+static void reportScrub( struct torrentInfo * t, unsigned long long now ) {
+
+  double seconds = ( now - t->scrubLastReport ) / 1000.0;
+  double rate = seconds > 0 ? t->scrubBytes / seconds / 1000000 : 0;
+
+  logToFile( t, "STATUS Scrub checked %.1f MB in %.0f s (%.2f MB/s), "
+	     "%d passes done, %d bad pieces found\n",
+	     t->scrubBytes / 1000000.0, seconds, rate,
+	     t->scrubPasses, t->scrubBad );
+  t->scrubBytes = 0;
+  t->scrubLastReport = now;
+
+}
+
+/*
+  scrubbable - could we scrub a piece we have? Not if it is still
+  waiting for its seed mode check, which it is left to, nor if it has
+  not been written to the file yet, and still has its buffer.
+ */
+static int scrubbable( struct torrentInfo * t, int piece ) {
+
+  if ( t->unverified && Bitfield_IsSet( t->unverified, piece ) ) {
+    return 0;
+  }
+  return ! t->chunkData[piece];
+
+}
+
+/*
+  firstScrubbable - find the first piece at or after from that we have
+  and could scrub.
+
+  Returns: The piece number, or -1 if there are none.
+ */
+static int firstScrubbable( struct torrentInfo * t, int from ) {
+
+  int piece = Bitfield_NextSet( t->ourBitfield, from );
+  while ( piece >= 0 && ! scrubbable( t, piece ) ) {
+    piece = Bitfield_NextSet( t->ourBitfield, piece + 1 );
+  }
+  return piece;
+
+}
+
+/*
+  nextScrubPiece - find the next piece to scrub, from scrubNext on,
+  starting a new pass from the first piece at the end of the torrent.
+
+  Returns: The piece number, or -1 if there is nothing to scrub.
+ */
+static int nextScrubPiece( struct torrentInfo * t ) {
+
+  int piece = firstScrubbable( t, t->scrubNext );
+  if ( piece < 0 && t->scrubNext > 0 ) {
+    t->scrubPasses ++;
+    logToFile( t, "STATUS Scrub pass %d finished, %d bad pieces found\n",
+	       t->scrubPasses, t->scrubBad );
+    t->scrubNext = 0;
+    piece = firstScrubbable( t, 0 );
+  }
+  return piece;
+
+}
+
+void scrubTick( struct torrentInfo * t, unsigned long long now ) {
+
+  long long cap;
+  int piece;
+  char * buffer = NULL;
+
+  if ( ! t->scrubRate ) {
+    return;
+  }
+
+  cap = t->scrubRate > t->chunkSize ? t->scrubRate : t->chunkSize;
+  t->scrubCredit += t->scrubRate * ( now - t->scrubLastTick ) / 1000;
+  if ( t->scrubCredit > cap ) {
+    t->scrubCredit = cap;
+  }
+  t->scrubLastTick = now;
+
+  if ( now - t->scrubLastReport >= SCRUB_REPORT_INTERVAL * 1000 ) {
+    reportScrub( t, now );
+  }
+
+  // Only scrub what the startup check has vouched for, one piece at
+  // a time, and never while there are uploads waiting
+  if ( t->scrubBusy || t->resumeChecked < t->numChunks ||
+       memUsed( t, MEM_OUTGOING ) >= t->chunkSize ) {
+    return;
+  }
+
+  piece = nextScrubPiece( t );
+  if ( piece < 0 || t->scrubCredit < chunkLength( t, piece ) ) {
+    return;
+  }
+  // Unless the file is mapped, we need a buffer to read it into
+  if ( ! t->storage->map ) {
+    if ( ! ( buffer = BP_Acquire( t->piecePool ) ) ) {
+      return;
+    }
+  }
+  t->scrubCredit -= chunkLength( t, piece );
+  t->scrubNext = piece + 1;
+  t->scrubBusy = 1;
+
+  // Drop any cached copy first, so that we read what is on the disk
+  adviseRange( t, piece, STORAGE_DONTNEED );
+
+  readPieceJob( t, &t->scrubJob, piece, buffer );
+  t->scrubJob.arg = NULL;
+  HP_Submit( t->hashPool, &t->scrubJob );
+
+}
+
+long long scrubDelay( struct torrentInfo * t ) {
+
+  if ( ! t->scrubRate || t->scrubBusy ) {
+    return -1;
+  }
+  if ( t->scrubCredit >= t->chunkSize ) {
+    return 0;
+  }
+  return ( t->chunkSize - t->scrubCredit ) * 1000 / t->scrubRate + 1;
+
+}
+
+void scrubPieceVerified( struct torrentInfo * t, HP_Job * job ) {
+
+  int piece = job->tag;
+
+  t->scrubBusy = 0;
+  t->scrubBytes += job->length;
+  if ( job->load ) {
+    BP_Release( t->piecePool, job->data );
+  }
+
+  // Reading it for the check should not push out what we are serving
+  adviseRange( t, piece, STORAGE_DONTNEED );
+
+  if ( ! Bitfield_IsSet( t->ourBitfield, piece ) ||
+       ! memcmp( job->digest, &t->chunkHashes[ 20 * piece ], 20 ) ) {
+    return;
+  }
+
+  t->scrubBad ++;
+  printf( "Piece %d of the save file is corrupt; downloading it again\n",
+	  piece );
+  logToFile( t, "WARNING Scrub found invalid SHA1 Hash for block %d. "
+	     "Downloading it again.\n", piece );
+  forgetPiece( t, piece );
+
+  // A restart must not trust the piece either
+  saveFastResume( t );
+
+}
@@ -0,0 +1,57 @@
+#ifndef _BM_BT_SCRUB
+#define _BM_BT_SCRUB
+
+/*
+  scrub.h - function declarations for the background scrub, which
+  hashes the pieces we have on disk again, one at a time and no faster
+  than a set rate, so that a long-running seed notices when its save
+  file rots or is changed under it. Pieces that fail are dropped from
+  our bitfield and downloaded again.
+ */
+
+#include "../common.h"
+#include "base.h"
+#include "requests.h"
+#include "memory.h"
+#include "fastResume.h"
+
+/*
+  scrubTick - start checking the next piece we have, if the scrub is
+  on, nothing else is being scrubbed, the rate allows it, and the
+  upload queues are not busy. Also logs the scrub's throughput every
+  SCRUB_REPORT_INTERVAL seconds. Called on every pass of the main loop.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => now - current time, as returned by getTimeMs()
+
+  Returns: Nothing.
+ */
+void scrubTick( struct torrentInfo * t, unsigned long long now ) ;
+
+/*
+  scrubDelay - how long until the rate allows the next piece to be
+  scrubbed, so that the main loop can wake up for it.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Milliseconds, or -1 if the scrub is off or a piece is
+  already being checked.
+ */
+long long scrubDelay( struct torrentInfo * t ) ;
+
+/*
+  scrubPieceVerified - act on the hash of a scrubbed piece. If it no
+  longer matches, the piece is dropped so that it is downloaded again,
+  and the fast-resume file is rewritten without it.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => job - t->scrubJob, finished
+
+  Returns: Nothing.
+ */
+void scrubPieceVerified( struct torrentInfo * t, HP_Job * job ) ;
+
+#endif
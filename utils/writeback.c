@@ -0,0 +1,257 @@
+
+/*
+  writeback.c - function definitions for writing finished pieces to
+  the save file on a writeback thread, and flushing them to disk
+  according to the chosen policy. See writeback.h.
+ */
+
+#include "writeback.h"
+
+/*
+  performRequest - do one request, on the writeback thread.
+ */
+static void performRequest( struct writeback * w,
+			    struct writebackRequest * r ) {
+
+  if ( r->piece < 0 ) {
+    if ( Storage_Sync( w->storage, 0, 0 ) ) {
+      perror("Storage_Sync");
+    }
+    return;
+  }
+
+  if ( Storage_Write( w->storage, r->data, r->offset, r->length ) ) {
+    perror("Storage_Write");
+    exit(1);
+  }
+  switch ( w->policy ) {
+  case WRITEBACK_SYNC:
+    if ( Storage_Sync( w->storage, r->offset, r->length ) ) {
+      perror("Storage_Sync");
+    }
+    break;
+  case WRITEBACK_ASYNC:
+    // Start writing it out, without waiting for the disk
+    Storage_StartSync( w->storage, r->offset, r->length );
+    break;
+  }
+
+}
+
+static void * writebackThread( void * arg ) {
+
+  struct writeback * w = arg;
+  struct writebackRequest * r;
+  char c = 0;
+
+  while ( 1 ) {
+
+    pthread_mutex_lock( &w->lock );
+    while ( ! w->waitingHead && ! w->shutdown ) {
+      pthread_cond_wait( &w->ready, &w->lock );
+    }
+    // Only stop once everything queued has been done
+    if ( ! w->waitingHead ) {
+      pthread_mutex_unlock( &w->lock );
+      return NULL;
+    }
+    r = w->waitingHead;
+    w->waitingHead = r->next;
+    if ( ! w->waitingHead ) {
+      w->waitingTail = NULL;
+    }
+    pthread_mutex_unlock( &w->lock );
+
+    performRequest( w, r );
+
+    pthread_mutex_lock( &w->lock );
+    r->next = NULL;
+    if ( w->doneTail ) {
+      w->doneTail->next = r;
+    }
+    else {
+      w->doneHead = r;
+    }
+    w->doneTail = r;
+    pthread_mutex_unlock( &w->lock );
+
+    // If the pipe is full, a wakeup is already pending
+    if ( write( w->wakeFDs[1], &c, 1 ) < 0 && errno != EAGAIN ) {
+      perror("write");
+      exit(1);
+    }
+
+  }
+
+}
+
+/*
+  submit - queue a request for the writeback thread.
+ */
+static void submit( struct writeback * w, int piece, char * data,
+		    int length, long long offset ) {
+
+  struct writebackRequest * r = Malloc( sizeof( struct writebackRequest ) );
+  r->piece = piece;
+  r->data = data;
+  r->length = length;
+  r->offset = offset;
+  r->next = NULL;
+
+  pthread_mutex_lock( &w->lock );
+  if ( w->waitingTail ) {
+    w->waitingTail->next = r;
+  }
+  else {
+    w->waitingHead = r;
+  }
+  w->waitingTail = r;
+  pthread_cond_signal( &w->ready );
+  pthread_mutex_unlock( &w->lock );
+
+}
+
+/*
+  startFlush - queue a flush covering every piece written so far.
+ */
+static void startFlush( struct torrentInfo * t ) {
+
+  Bitfield_Or( t->flushing, t->flushing, t->unflushed );
+  Bitfield_AndNot( t->unflushed, t->unflushed, t->flushing );
+  t->writeback->flushInFlight = 1;
+  submit( t->writeback, -1, NULL, 0, 0 );
+
+}
+
+void startWriteback( struct torrentInfo * t, int policy ) {
+
+  int i;
+  sigset_t all, old;
+  struct writeback * w = Malloc( sizeof( struct writeback ) );
+
+  w->policy = policy;
+  w->storage = t->storage;
+  pthread_mutex_init( &w->lock, NULL );
+  pthread_cond_init( &w->ready, NULL );
+  w->waitingHead = w->waitingTail = NULL;
+  w->doneHead = w->doneTail = NULL;
+  w->shutdown = 0;
+  w->flushInFlight = 0;
+
+  if ( pipe( w->wakeFDs ) ) {
+    perror("pipe");
+    exit(1);
+  }
+  for ( i = 0; i < 2; i ++ ) {
+    fcntl( w->wakeFDs[i], F_SETFL,
+	   fcntl( w->wakeFDs[i], F_GETFL ) | O_NONBLOCK );
+  }
+
+  // The thread inherits our signal mask; keep signals on this thread
+  sigfillset( &all );
+  pthread_sigmask( SIG_BLOCK, &all, &old );
+  if ( pthread_create( &w->thread, NULL, writebackThread, w ) ) {
+    perror("pthread_create");
+    exit(1);
+  }
+  pthread_sigmask( SIG_SETMASK, &old, NULL );
+
+  t->writeback = w;
+  t->unflushed = Bitfield_Init( t->numChunks );
+  t->flushing = Bitfield_Init( t->numChunks );
+  memCharge( t, MEM_BITFIELDS, 2 * t->unflushed->numBytes );
+  t->lastFlush = getTimeMs();
+
+}
+
+void writePiece( struct torrentInfo * t, int piece ) {
+
+  Bitfield_Set( t->unflushed, piece );
+  submit( t->writeback, piece, t->chunkData[piece],
+	  chunkLength( t, piece ), (long long) piece * t->chunkSize );
+
+}
+
+int writebackFD( struct torrentInfo * t ) {
+
+  return t->writeback->wakeFDs[0];
+
+}
+
+void collectWrites( struct torrentInfo * t ) {
+
+  struct writeback * w = t->writeback;
+  struct writebackRequest * r, * next;
+  char buf[64];
+
+  // Empty the pipe before taking the list, so that a request finishing
+  // in between still leaves a wakeup behind
+  while ( read( w->wakeFDs[0], buf, sizeof( buf ) ) > 0 ) {
+    ;
+  }
+
+  pthread_mutex_lock( &w->lock );
+  r = w->doneHead;
+  w->doneHead = w->doneTail = NULL;
+  pthread_mutex_unlock( &w->lock );
+
+  for ( ; r; r = next ) {
+    next = r->next;
+    if ( r->piece < 0 ) {
+      logToFile( t, "STATUS Flushed %d pieces to disk\n",
+		 Bitfield_Count( t->flushing ) );
+      Bitfield_ClearAll( t->flushing );
+      w->flushInFlight = 0;
+    }
+    else {
+      // Serve it from the file from now on
+      BP_Release( t->piecePool, r->data );
+      t->chunkData[ r->piece ] = NULL;
+      if ( w->policy == WRITEBACK_SYNC ) {
+	Bitfield_Clear( t->unflushed, r->piece );
+      }
+    }
+    free( r );
+  }
+
+}
+
+void writebackTick( struct torrentInfo * t, unsigned long long now ) {
+
+  if ( t->writeback->policy == WRITEBACK_SYNC ||
+       t->writeback->flushInFlight ||
+       now - t->lastFlush < WRITEBACK_INTERVAL * 1000 ) {
+    return;
+  }
+  t->lastFlush = now;
+  if ( ! Bitfield_NoneSet( t->unflushed ) ) {
+    startFlush( t );
+  }
+
+}
+
+void finishWriteback( struct torrentInfo * t ) {
+
+  struct writeback * w = t->writeback;
+
+  if ( ! Bitfield_NoneSet( t->unflushed ) ) {
+    startFlush( t );
+  }
+
+  pthread_mutex_lock( &w->lock );
+  w->shutdown = 1;
+  pthread_cond_signal( &w->ready );
+  pthread_mutex_unlock( &w->lock );
+  pthread_join( w->thread, NULL );
+
+  collectWrites( t );
+  Bitfield_ClearAll( t->unflushed );
+
+  close( w->wakeFDs[0] );
+  close( w->wakeFDs[1] );
+  pthread_mutex_destroy( &w->lock );
+  pthread_cond_destroy( &w->ready );
+  free( w );
+  t->writeback = NULL;
+
+}
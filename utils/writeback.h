@@ -0,0 +1,134 @@
+#ifndef _BM_BT_WRITEBACK
+#define _BM_BT_WRITEBACK
+
+/*
+  writeback.h - function declarations for writing finished pieces to
+  the save file. Pieces are copied into the file on a writeback
+  thread, so that the main loop never waits on the disk, and are made
+  durable according to one of three policies:
+
+    sync  - each piece is flushed to disk as soon as it is written
+    async - disk writes are started as each piece is written, and
+            the file is flushed every WRITEBACK_INTERVAL seconds
+    batch - the file is flushed every WRITEBACK_INTERVAL seconds
+
+  Whatever the policy, everything is flushed at shutdown. Pieces that
+  have been written but not flushed are kept in t->unflushed, and
+  those being flushed in t->flushing; the fast-resume file never lists
+  either.
+ */
+
+#include <pthread.h>
+
+#include "../common.h"
+#include "base.h"
+#include "requests.h"
+#include "memory.h"
+
+/*
+  A writebackRequest is one piece to copy into the save file, or a
+  request to flush the file (piece is -1).
+ */
+struct writebackRequest {
+  int piece;
+  char * data;        // The piece's buffer
+  int length;
+  long long offset;   // Where it goes in the save file
+  struct writebackRequest * next;
+};
+
+struct writeback {
+  pthread_t thread;
+  int policy;
+  Storage * storage;  // The save file
+
+  // Requests waiting for the thread, oldest first, and those it has
+  // finished, oldest first. Both are guarded by lock.
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  struct writebackRequest * waitingHead;
+  struct writebackRequest * waitingTail;
+  struct writebackRequest * doneHead;
+  struct writebackRequest * doneTail;
+  int shutdown;       // Set to make the thread exit once it is idle
+
+  // The thread writes a byte to wakeFDs[1] after finishing a request
+  int wakeFDs[2];
+  int flushInFlight;  // Is a flush queued or running?
+};
+
+/*
+  startWriteback - start the writeback thread for a torrent. The save
+  file must already be open.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => policy - one of the WRITEBACK_* policies in common.h
+
+  Returns: Nothing.
+ */
+void startWriteback( struct torrentInfo * t, int policy ) ;
+
+/*
+  writePiece - queue a checked piece to be copied from its buffer into
+  the save file. Uploads are served from the buffer until the copy is
+  done, when collectWrites() gives the buffer back.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => piece - the piece number
+
+  Returns: Nothing.
+ */
+void writePiece( struct torrentInfo * t, int piece ) ;
+
+/*
+  writebackFD - file descriptor that becomes readable when the
+  writeback thread has finished something.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: A file descriptor to add to a select() read set.
+ */
+int writebackFD( struct torrentInfo * t ) ;
+
+/*
+  collectWrites - act on every request the writeback thread has
+  finished: give back the buffers of pieces that are now in the file,
+  and note which pieces are now durable.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void collectWrites( struct torrentInfo * t ) ;
+
+/*
+  writebackTick - queue a flush of the save file if the policy calls
+  for one, some pieces are not yet durable, none is under way, and it
+  has been WRITEBACK_INTERVAL seconds since the last. Called on every
+  pass of the main loop.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+  => now - current time, as returned by getTimeMs()
+
+  Returns: Nothing.
+ */
+void writebackTick( struct torrentInfo * t, unsigned long long now ) ;
+
+/*
+  finishWriteback - write every queued piece, flush the save file, and
+  stop the writeback thread. Blocks until it is all done. Afterwards
+  every piece in our bitfield is durable.
+
+  Parameters:
+  => t - torrentInfo struct for current download
+
+  Returns: Nothing.
+ */
+void finishWriteback( struct torrentInfo * t ) ;
+
+#endif